@@ -0,0 +1,281 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace gps {
+
+    namespace {
+        const int BIN_COUNT = 12;
+        const int MAX_LEAF_SIZE = 4;
+        const int MAX_DEPTH = 48;
+        // subtrees bigger than this are built on their own thread
+        const int PARALLEL_THRESHOLD = 256;
+        const int PARALLEL_DEPTH = 3;
+    }
+
+    BVH::BVH() : nodeCount(0) {
+    }
+
+    void BVH::build(const std::vector<AABB>& primBounds) {
+
+        int primCount = (int)primBounds.size();
+
+        this->bounds = primBounds;
+        this->primIndices.resize(primCount);
+        this->centroids.resize(primCount);
+        this->primLeaf.assign(primCount, -1);
+        this->nodes.clear();
+
+        if (primCount == 0) {
+            return;
+        }
+
+        for (int i = 0; i < primCount; i++) {
+            primIndices[i] = i;
+            centroids[i] = primBounds[i].center();
+        }
+
+        // a binary tree over N leaves never needs more than 2N - 1 nodes
+        this->nodes.resize(2 * primCount - 1);
+        this->nodes[0].parent = -1;
+        this->nodeCount = 1;
+
+        buildNode(0, 0, primCount, 0);
+
+        this->nodes.resize(this->nodeCount);
+    }
+
+    void BVH::buildNode(int nodeIndex, int first, int count, int depth) {
+
+        BVHNode& node = nodes[nodeIndex];
+
+        AABB nodeBounds;
+        AABB centroidBounds;
+        for (int i = first; i < first + count; i++) {
+            nodeBounds.extend(bounds[primIndices[i]]);
+            centroidBounds.extend(centroids[primIndices[i]]);
+        }
+
+        node.bounds = nodeBounds;
+        node.first = first;
+        node.count = count;
+        node.left = -1;
+
+        int mid = -1;
+        if (count > 1 && depth < MAX_DEPTH) {
+            mid = partition(first, count, nodeBounds, centroidBounds);
+        }
+
+        if (mid <= first || mid >= first + count) {
+            // leaf
+            for (int i = first; i < first + count; i++) {
+                primLeaf[primIndices[i]] = nodeIndex;
+            }
+            return;
+        }
+
+        int left = nodeCount.fetch_add(2);
+        node.left = left;
+        node.count = 0;
+        nodes[left].parent = nodeIndex;
+        nodes[left + 1].parent = nodeIndex;
+
+        int leftCount = mid - first;
+        int rightCount = count - leftCount;
+
+        if (count >= PARALLEL_THRESHOLD && depth < PARALLEL_DEPTH) {
+            std::thread worker(&BVH::buildNode, this, left, first, leftCount, depth + 1);
+            buildNode(left + 1, mid, rightCount, depth + 1);
+            worker.join();
+        } else {
+            buildNode(left, first, leftCount, depth + 1);
+            buildNode(left + 1, mid, rightCount, depth + 1);
+        }
+    }
+
+    // Chooses the cheapest binned SAH split and reorders primIndices around it.
+    // Returns the index of the first primitive of the right child, or -1 for a leaf
+    int BVH::partition(int first, int count, const AABB& nodeBounds, const AABB& centroidBounds) {
+
+        float leafCost = (float)count * nodeBounds.halfArea();
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        int bestSplit = 0;
+
+        for (int axis = 0; axis < 3; axis++) {
+
+            float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            if (extent <= 1e-6f) {
+                continue;
+            }
+
+            AABB binBounds[BIN_COUNT];
+            int binPrims[BIN_COUNT] = { 0 };
+            float scale = (float)BIN_COUNT / extent;
+
+            for (int i = first; i < first + count; i++) {
+                int prim = primIndices[i];
+                int bin = std::min(BIN_COUNT - 1, (int)((centroids[prim][axis] - centroidBounds.min[axis]) * scale));
+                binPrims[bin]++;
+                binBounds[bin].extend(bounds[prim]);
+            }
+
+            // sweep from the right to get the cost of every right side
+            float rightArea[BIN_COUNT];
+            int rightPrims[BIN_COUNT];
+            AABB accumulated;
+            int accumulatedPrims = 0;
+            for (int bin = BIN_COUNT - 1; bin > 0; bin--) {
+                accumulated.extend(binBounds[bin]);
+                accumulatedPrims += binPrims[bin];
+                rightArea[bin] = accumulated.halfArea();
+                rightPrims[bin] = accumulatedPrims;
+            }
+
+            accumulated = AABB();
+            accumulatedPrims = 0;
+            for (int split = 1; split < BIN_COUNT; split++) {
+                accumulated.extend(binBounds[split - 1]);
+                accumulatedPrims += binPrims[split - 1];
+                float cost = accumulated.halfArea() * accumulatedPrims + rightArea[split] * rightPrims[split];
+                if (accumulatedPrims > 0 && rightPrims[split] > 0 && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        if (bestAxis == -1) {
+            // all centroids coincide, fall back to an even split
+            return count > MAX_LEAF_SIZE ? first + count / 2 : -1;
+        }
+
+        // the traversal step costs about as much as testing one primitive
+        if (count <= MAX_LEAF_SIZE && bestCost + nodeBounds.halfArea() >= leafCost) {
+            return -1;
+        }
+
+        float minValue = centroidBounds.min[bestAxis];
+        float scale = (float)BIN_COUNT / (centroidBounds.max[bestAxis] - minValue);
+        const std::vector<glm::vec3>& centers = this->centroids;
+        int* middle = std::partition(&primIndices[first], &primIndices[first] + count, [&](int prim) {
+            int bin = std::min(BIN_COUNT - 1, (int)((centers[prim][bestAxis] - minValue) * scale));
+            return bin < bestSplit;
+        });
+
+        return (int)(middle - &primIndices[0]);
+    }
+
+    void BVH::recomputeNode(int nodeIndex) {
+
+        BVHNode& node = nodes[nodeIndex];
+        if (node.count > 0) {
+            AABB leafBounds;
+            for (int i = node.first; i < node.first + node.count; i++) {
+                leafBounds.extend(bounds[primIndices[i]]);
+            }
+            node.bounds = leafBounds;
+        } else {
+            AABB innerBounds = nodes[node.left].bounds;
+            innerBounds.extend(nodes[node.left + 1].bounds);
+            node.bounds = innerBounds;
+        }
+    }
+
+    void BVH::refit(const std::vector<int>& changedPrims, const std::vector<AABB>& primBounds) {
+
+        for (size_t i = 0; i < changedPrims.size(); i++) {
+
+            int prim = changedPrims[i];
+            bounds[prim] = primBounds[prim];
+            centroids[prim] = primBounds[prim].center();
+
+            // walk from the leaf to the root, siblings are already up to date
+            for (int nodeIndex = primLeaf[prim]; nodeIndex != -1; nodeIndex = nodes[nodeIndex].parent) {
+                recomputeNode(nodeIndex);
+            }
+        }
+    }
+
+    void BVH::queryFrustum(const Frustum& frustum, std::vector<int>& result) const {
+
+        traverse([&](const AABB& box) { return frustum.intersects(box); }, result);
+    }
+
+    void BVH::queryAABB(const AABB& box, std::vector<int>& result) const {
+
+        traverse([&](const AABB& other) { return box.overlaps(other); }, result);
+    }
+
+    void BVH::querySphere(glm::vec3 center, float radius, std::vector<int>& result) const {
+
+        traverse([&](const AABB& box) { return box.overlapsSphere(center, radius); }, result);
+    }
+
+    void BVH::queryRay(const Ray& ray, float maxT, std::vector<int>& result) const {
+
+        traverse([&](const AABB& box) { float t; return ray.intersects(box, maxT, t); }, result);
+    }
+
+    bool BVH::raycast(const Ray& ray, float maxT, int& hitPrim, float& hitT) const {
+
+        hitPrim = -1;
+        hitT = maxT;
+
+        if (nodes.empty()) {
+            return false;
+        }
+
+        int stack[64];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+
+            const BVHNode& node = nodes[stack[--stackSize]];
+            float t;
+            if (!ray.intersects(node.bounds, hitT, t)) {
+                continue;
+            }
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    int prim = primIndices[i];
+                    if (ray.intersects(bounds[prim], hitT, t) && (hitPrim == -1 || t < hitT)) {
+                        hitPrim = prim;
+                        hitT = t;
+                    }
+                }
+            } else {
+                // visit the nearer child first so farther boxes get rejected early
+                float tLeft = FLT_MAX, tRight = FLT_MAX;
+                bool hitLeft = ray.intersects(nodes[node.left].bounds, hitT, tLeft);
+                bool hitRight = ray.intersects(nodes[node.left + 1].bounds, hitT, tRight);
+                if (hitLeft && hitRight) {
+                    stack[stackSize++] = tLeft < tRight ? node.left + 1 : node.left;
+                    stack[stackSize++] = tLeft < tRight ? node.left : node.left + 1;
+                } else if (hitLeft) {
+                    stack[stackSize++] = node.left;
+                } else if (hitRight) {
+                    stack[stackSize++] = node.left + 1;
+                }
+            }
+        }
+
+        return hitPrim != -1;
+    }
+
+    const AABB& BVH::getPrimBounds(int prim) const {
+        return bounds[prim];
+    }
+
+    int BVH::getPrimCount() const {
+        return (int)bounds.size();
+    }
+
+    int BVH::getNodeCount() const {
+        return (int)nodes.size();
+    }
+}
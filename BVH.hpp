@@ -0,0 +1,96 @@
+#ifndef BVH_hpp
+#define BVH_hpp
+
+#include "Bounds.hpp"
+
+#include <atomic>
+#include <vector>
+
+namespace gps {
+
+    struct BVHNode {
+
+        AABB bounds;
+        // leaf: primitives [first, first + count) of primIndices
+        // inner node: children are left and left + 1, count is 0
+        int left;
+        int first;
+        int count;
+        int parent;
+    };
+
+    // Bounding volume hierarchy over a set of primitive boxes (one per mesh instance)
+    class BVH {
+
+    public:
+        BVH();
+
+        // Builds the tree with binned SAH, large subtrees are split on worker threads
+        void build(const std::vector<AABB>& primBounds);
+
+        // Updates the primitive boxes and refits only the nodes above them
+        void refit(const std::vector<int>& changedPrims, const std::vector<AABB>& primBounds);
+
+        // Query functions - append the ids of the primitives whose boxes pass the test
+        void queryFrustum(const Frustum& frustum, std::vector<int>& result) const;
+        void queryAABB(const AABB& box, std::vector<int>& result) const;
+        void querySphere(glm::vec3 center, float radius, std::vector<int>& result) const;
+        void queryRay(const Ray& ray, float maxT, std::vector<int>& result) const;
+
+        // Closest primitive box hit by the ray, returns false when nothing is hit
+        bool raycast(const Ray& ray, float maxT, int& hitPrim, float& hitT) const;
+
+        const AABB& getPrimBounds(int prim) const;
+        int getPrimCount() const;
+        int getNodeCount() const;
+
+    private:
+        std::vector<BVHNode> nodes;
+        std::vector<int> primIndices;
+        std::vector<AABB> bounds;
+        std::vector<glm::vec3> centroids;
+        // leaf node holding each primitive, used by refit
+        std::vector<int> primLeaf;
+        std::atomic<int> nodeCount;
+
+        void buildNode(int nodeIndex, int first, int count, int depth);
+        int partition(int first, int count, const AABB& nodeBounds, const AABB& centroidBounds);
+        void recomputeNode(int nodeIndex);
+
+        template <typename Test>
+        void traverse(Test test, std::vector<int>& result) const;
+    };
+
+    template <typename Test>
+    void BVH::traverse(Test test, std::vector<int>& result) const {
+
+        if (nodes.empty()) {
+            return;
+        }
+
+        int stack[64];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+
+            const BVHNode& node = nodes[stack[--stackSize]];
+            if (!test(node.bounds)) {
+                continue;
+            }
+
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    if (test(bounds[primIndices[i]])) {
+                        result.push_back(primIndices[i]);
+                    }
+                }
+            } else {
+                stack[stackSize++] = node.left;
+                stack[stackSize++] = node.left + 1;
+            }
+        }
+    }
+}
+
+#endif /* BVH_hpp */
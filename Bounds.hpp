@@ -0,0 +1,169 @@
+#ifndef Bounds_hpp
+#define Bounds_hpp
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+
+namespace gps {
+
+    // Axis aligned bounding box
+    struct AABB {
+
+        glm::vec3 min;
+        glm::vec3 max;
+
+        AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+        AABB(glm::vec3 min, glm::vec3 max) : min(min), max(max) {}
+
+        bool isEmpty() const {
+            return min.x > max.x || min.y > max.y || min.z > max.z;
+        }
+
+        void extend(glm::vec3 point) {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+
+        void extend(const AABB& other) {
+            min = glm::min(min, other.min);
+            max = glm::max(max, other.max);
+        }
+
+        glm::vec3 center() const {
+            return (min + max) * 0.5f;
+        }
+
+        glm::vec3 extents() const {
+            return (max - min) * 0.5f;
+        }
+
+        // half of the surface area, used by the SAH cost
+        float halfArea() const {
+            if (isEmpty()) {
+                return 0.0f;
+            }
+            glm::vec3 d = max - min;
+            return d.x * d.y + d.y * d.z + d.z * d.x;
+        }
+
+        bool overlaps(const AABB& other) const {
+            return min.x <= other.max.x && max.x >= other.min.x &&
+                   min.y <= other.max.y && max.y >= other.min.y &&
+                   min.z <= other.max.z && max.z >= other.min.z;
+        }
+
+        bool overlapsSphere(glm::vec3 center, float radius) const {
+            glm::vec3 closest = glm::clamp(center, min, max);
+            glm::vec3 d = closest - center;
+            return glm::dot(d, d) <= radius * radius;
+        }
+
+        // bounds of this box after being moved by the matrix (Arvo's method)
+        AABB transformed(const glm::mat4& matrix) const {
+            if (isEmpty()) {
+                return *this;
+            }
+            glm::vec3 translation = glm::vec3(matrix[3]);
+            AABB result(translation, translation);
+            for (int col = 0; col < 3; col++) {
+                for (int row = 0; row < 3; row++) {
+                    float a = matrix[col][row] * min[col];
+                    float b = matrix[col][row] * max[col];
+                    result.min[row] += glm::min(a, b);
+                    result.max[row] += glm::max(a, b);
+                }
+            }
+            return result;
+        }
+    };
+
+    // Plane stored as dot(normal, p) + d = 0, normal pointing inside
+    struct Plane {
+
+        glm::vec3 normal;
+        float d;
+
+        float distance(glm::vec3 point) const {
+            return glm::dot(normal, point) + d;
+        }
+    };
+
+    // View volume given by its six planes
+    struct Frustum {
+
+        enum { LEFT, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE, PLANE_COUNT };
+
+        Plane planes[PLANE_COUNT];
+
+        // Extracts the planes from a projection * view matrix (Gribb-Hartmann)
+        static Frustum fromMatrix(const glm::mat4& viewProjection) {
+            Frustum frustum;
+            glm::vec4 rows[4];
+            for (int i = 0; i < 4; i++) {
+                rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+            }
+            glm::vec4 equations[PLANE_COUNT] = {
+                rows[3] + rows[0],
+                rows[3] - rows[0],
+                rows[3] + rows[1],
+                rows[3] - rows[1],
+                rows[3] + rows[2],
+                rows[3] - rows[2]
+            };
+            for (int i = 0; i < PLANE_COUNT; i++) {
+                glm::vec3 normal = glm::vec3(equations[i]);
+                float len = glm::length(normal);
+                frustum.planes[i].normal = normal / len;
+                frustum.planes[i].d = equations[i].w / len;
+            }
+            return frustum;
+        }
+
+        // conservative test, a box is rejected only if it lies fully outside one plane
+        bool intersects(const AABB& box) const {
+            for (int i = 0; i < PLANE_COUNT; i++) {
+                const Plane& plane = planes[i];
+                glm::vec3 positive(
+                    plane.normal.x >= 0.0f ? box.max.x : box.min.x,
+                    plane.normal.y >= 0.0f ? box.max.y : box.min.y,
+                    plane.normal.z >= 0.0f ? box.max.z : box.min.z);
+                if (plane.distance(positive) < 0.0f) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    struct Ray {
+
+        glm::vec3 origin;
+        glm::vec3 direction;
+
+        // slab test, returns the entry distance in tNear
+        bool intersects(const AABB& box, float maxT, float& tNear) const {
+            float tMin = 0.0f;
+            float tMax = maxT;
+            for (int axis = 0; axis < 3; axis++) {
+                float invDir = 1.0f / direction[axis];
+                float t0 = (box.min[axis] - origin[axis]) * invDir;
+                float t1 = (box.max[axis] - origin[axis]) * invDir;
+                if (invDir < 0.0f) {
+                    float tmp = t0;
+                    t0 = t1;
+                    t1 = tmp;
+                }
+                tMin = t0 > tMin ? t0 : tMin;
+                tMax = t1 < tMax ? t1 : tMax;
+                if (tMax < tMin) {
+                    return false;
+                }
+            }
+            tNear = tMin;
+            return true;
+        }
+    };
+}
+
+#endif /* Bounds_hpp */
@@ -0,0 +1,40 @@
+#include "CommandBuffer.hpp"
+
+#include <cstddef>
+
+namespace gps {
+
+    namespace {
+        const size_t INITIAL_CAPACITY = 256;
+    }
+
+    CommandBuffer::CommandBuffer() : count(0) {
+    }
+
+    void CommandBuffer::reset() {
+
+        count = 0;
+    }
+
+    void CommandBuffer::record(int type, int object, int mesh, int argument) {
+
+        if ((size_t)count == commands.size()) {
+            commands.resize(commands.empty() ? INITIAL_CAPACITY : commands.size() * 2);
+        }
+        Command& command = commands[count++];
+        command.type = type;
+        command.object = object;
+        command.mesh = mesh;
+        command.argument = argument;
+    }
+
+    int CommandBuffer::getCount() const {
+
+        return count;
+    }
+
+    const Command& CommandBuffer::getCommand(int index) const {
+
+        return commands[index];
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef CommandBuffer_hpp
+#define CommandBuffer_hpp
+
+#include <vector>
+
+namespace gps {
+
+    // One recorded command, plain data so a worker can write it without a GL context.
+    // The meaning of the fields depends on type, which the code replaying it defines
+    struct Command {
+        int type;
+        int object;
+        int mesh;
+        int argument;
+    };
+
+    // Commands recorded by one thread for a part of a frame and replayed in order on the
+    // GL thread. The storage is a linear arena: reset only rewinds it, so after the first
+    // frames recording doesn't allocate
+    class CommandBuffer {
+
+    public:
+        CommandBuffer();
+
+        // Rewinds the buffer, the storage is kept
+        void reset();
+
+        void record(int type, int object, int mesh = 0, int argument = 0);
+
+        int getCount() const;
+        const Command& getCommand(int index) const;
+
+    private:
+        std::vector<Command> commands;
+        int count;
+    };
+}
+
+#endif /* CommandBuffer_hpp */
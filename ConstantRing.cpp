@@ -0,0 +1,104 @@
+#include "ConstantRing.hpp"
+
+#include <cstring>
+
+namespace gps {
+
+    ConstantRing::ConstantRing() : buffer(0), alignment(256), regionSize(0), region(0), orphanCount(0) {
+        for (int i = 0; i < FRAME_COUNT; i++) {
+            fences[i] = 0;
+        }
+    }
+
+    void ConstantRing::init(GLsizeiptr bytesPerFrame) {
+
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        if (alignment <= 0) {
+            alignment = 256;
+        }
+        regionSize = (bytesPerFrame + alignment - 1) / alignment * alignment;
+        glGenBuffers(1, &buffer);
+        allocate();
+    }
+
+    void ConstantRing::allocate() {
+
+        // new storage for the buffer name, reads already queued keep the old one
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, regionSize * FRAME_COUNT, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        for (int i = 0; i < FRAME_COUNT; i++) {
+            if (fences[i] != 0) {
+                glDeleteSync(fences[i]);
+                fences[i] = 0;
+            }
+        }
+    }
+
+    void ConstantRing::beginFrame() {
+
+        region = (region + 1) % FRAME_COUNT;
+        staging.clear();
+        if (fences[region] == 0) {
+            return;
+        }
+        // a zero timeout only polls
+        GLenum status = glClientWaitSync(fences[region], 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+            allocate();
+            orphanCount++;
+        } else {
+            glDeleteSync(fences[region]);
+            fences[region] = 0;
+        }
+    }
+
+    GLintptr ConstantRing::push(const void* data, GLsizeiptr size) {
+
+        GLintptr offset = (GLintptr)((staging.size() + alignment - 1) / alignment * alignment);
+        staging.resize(offset + size);
+        std::memcpy(&staging[offset], data, size);
+        return offset;
+    }
+
+    void ConstantRing::upload() {
+
+        if (staging.empty()) {
+            return;
+        }
+        if ((GLsizeiptr)staging.size() > regionSize) {
+            regionSize = ((GLsizeiptr)staging.size() + alignment - 1) / alignment * alignment;
+            allocate();
+        }
+
+        // the fence (or the orphaning) already made sure nothing reads this region
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        void* target = glMapBufferRange(GL_UNIFORM_BUFFER, region * regionSize, staging.size(),
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (target) {
+            std::memcpy(target, staging.data(), staging.size());
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void ConstantRing::endFrame() {
+
+        if (fences[region] != 0) {
+            glDeleteSync(fences[region]);
+        }
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    void ConstantRing::bind(GLuint bindingPoint, GLintptr offset, GLsizeiptr size) {
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, bindingPoint, buffer, region * regionSize + offset, size);
+    }
+
+    int ConstantRing::takeOrphanCount() {
+
+        int count = orphanCount;
+        orphanCount = 0;
+        return count;
+    }
+}
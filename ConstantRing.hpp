@@ -0,0 +1,60 @@
+#ifndef ConstantRing_hpp
+#define ConstantRing_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <vector>
+
+namespace gps {
+
+    // Uniform buffer split into one region per frame in flight. A frame's constants are
+    // collected on the CPU, uploaded in one go into the region no queued frame reads, and
+    // the draws pick theirs with glBindBufferRange. Each region is fenced when its frame
+    // is submitted; if the GPU is still reading a region when it comes around again, the
+    // buffer is orphaned instead of waiting for it
+    class ConstantRing {
+
+    public:
+        static const int FRAME_COUNT = 3;
+
+        ConstantRing();
+
+        // bytesPerFrame is a first guess, the regions grow when a frame needs more
+        void init(GLsizeiptr bytesPerFrame);
+
+        // Moves to the next region, orphaning the buffer when it is still in use
+        void beginFrame();
+        // Queues size bytes for this frame and returns their offset from the region start,
+        // aligned to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+        GLintptr push(const void* data, GLsizeiptr size);
+        // Copies what the frame pushed into its region, before the first draw reading it
+        void upload();
+        // Fences the region after the frame's last draw
+        void endFrame();
+
+        // Binds size bytes at offset (from push) of this frame's region to a uniform block binding
+        void bind(GLuint bindingPoint, GLintptr offset, GLsizeiptr size);
+
+        // times the buffer was orphaned because the GPU was behind, since the last call
+        int takeOrphanCount();
+
+    private:
+        GLuint buffer;
+        GLint alignment;
+        GLsizeiptr regionSize;
+        int region;
+        GLsync fences[FRAME_COUNT];
+        std::vector<unsigned char> staging;
+        int orphanCount;
+
+        void allocate();
+    };
+}
+
+#endif /* ConstantRing_hpp */
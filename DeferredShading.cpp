@@ -0,0 +1,203 @@
+#include "DeferredShading.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cmath>
+#include <iostream>
+
+namespace gps {
+
+    namespace {
+        // tessellation of the light volume sphere
+        const int SPHERE_RINGS = 8;
+        const int SPHERE_SEGMENTS = 12;
+        const float PI = 3.14159265f;
+
+        GLuint createTarget(GLint internalFormat, GLenum format, GLenum type, int width, int height) {
+
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+            // read texel for texel, never filtered
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            return texture;
+        }
+    }
+
+    DeferredShading::DeferredShading()
+        : width(0), height(0), gBufferFBO(0), albedoTexture(0), normalTexture(0), specularTexture(0), depthTexture(0),
+          sphereVAO(0), sphereVBO(0), sphereEBO(0), sphereIndexCount(0), instanceVBO(0), lightVolumeCount(0) {
+    }
+
+    void DeferredShading::init() {
+
+        // the flat faces of the sphere cut inside the unit sphere, it is grown so they
+        // stay outside of it
+        float scale = 1.0f / (std::cos(PI / SPHERE_SEGMENTS) * std::cos(PI / SPHERE_RINGS));
+
+        std::vector<GLfloat> vertices;
+        for (int ring = 0; ring <= SPHERE_RINGS; ring++) {
+            float theta = PI * ring / SPHERE_RINGS;
+            for (int segment = 0; segment <= SPHERE_SEGMENTS; segment++) {
+                float phi = 2.0f * PI * segment / SPHERE_SEGMENTS;
+                vertices.push_back(scale * std::sin(theta) * std::cos(phi));
+                vertices.push_back(scale * std::cos(theta));
+                vertices.push_back(scale * std::sin(theta) * std::sin(phi));
+            }
+        }
+
+        // counter clockwise seen from outside
+        std::vector<GLuint> indices;
+        for (int ring = 0; ring < SPHERE_RINGS; ring++) {
+            for (int segment = 0; segment < SPHERE_SEGMENTS; segment++) {
+                GLuint a = ring * (SPHERE_SEGMENTS + 1) + segment;
+                GLuint b = a + SPHERE_SEGMENTS + 1;
+                GLuint c = b + 1;
+                GLuint d = a + 1;
+                indices.push_back(a);
+                indices.push_back(c);
+                indices.push_back(b);
+                indices.push_back(a);
+                indices.push_back(d);
+                indices.push_back(c);
+            }
+        }
+        sphereIndexCount = (GLsizei)indices.size();
+
+        glGenVertexArrays(1, &sphereVAO);
+        glGenBuffers(1, &sphereVBO);
+        glGenBuffers(1, &sphereEBO);
+        glGenBuffers(1, &instanceVBO);
+
+        glBindVertexArray(sphereVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+
+        // one light per instance
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STREAM_DRAW);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (GLvoid*)0);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (GLvoid*)sizeof(glm::vec4));
+        glVertexAttribDivisor(2, 1);
+        glBindVertexArray(0);
+    }
+
+    void DeferredShading::resize(int width, int height) {
+
+        if (width == this->width && height == this->height) {
+            return;
+        }
+        deleteGBuffer();
+        this->width = width;
+        this->height = height;
+
+        albedoTexture = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+        normalTexture = createTarget(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, width, height);
+        specularTexture = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+        depthTexture = createTarget(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, width, height);
+
+        glGenFramebuffers(1, &gBufferFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, gBufferFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, specularTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, drawBuffers);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "G-buffer " << width << "x" << height << " is incomplete" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void DeferredShading::beginGeometryPass() {
+
+        glBindFramebuffer(GL_FRAMEBUFFER, gBufferFBO);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    void DeferredShading::bindGBuffer(gps::Shader shader, int firstTextureUnit, const glm::mat4& projection) {
+
+        const char* names[] = { "gAlbedo", "gNormal", "gSpecular", "gDepth" };
+        GLuint textures[] = { albedoTexture, normalTexture, specularTexture, depthTexture };
+        for (int i = 0; i < 4; i++) {
+            glActiveTexture(GL_TEXTURE0 + firstTextureUnit + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glUniform1i(glGetUniformLocation(shader.shaderProgram, names[i]), firstTextureUnit + i);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        glm::mat4 inverseProjection = glm::inverse(projection);
+        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "inverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection));
+        glUniform2f(glGetUniformLocation(shader.shaderProgram, "screenSize"), (float)width, (float)height);
+    }
+
+    void DeferredShading::drawLightVolumes(gps::Shader shader, const std::vector<PointLight>& eyeLights) {
+
+        instanceData.clear();
+        for (size_t i = 0; i < eyeLights.size(); i++) {
+            instanceData.push_back(glm::vec4(eyeLights[i].position, eyeLights[i].radius));
+            instanceData.push_back(glm::vec4(eyeLights[i].color, (float)eyeLights[i].shadowSlot));
+        }
+        lightVolumeCount = (int)instanceData.size() / 2;
+        if (lightVolumeCount == 0) {
+            return;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        // orphaned, the draw of the last frame may still read the old storage
+        glBufferData(GL_ARRAY_BUFFER, instanceData.size() * sizeof(glm::vec4), &instanceData[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        shader.useShaderProgram();
+
+        // back faces pass where the scene is in front of them, which also works with the camera
+        // inside a volume. Pixels in front of the whole volume are rejected by its shader
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_GEQUAL);
+        glCullFace(GL_FRONT);
+        // volumes reaching past the far plane keep their back faces
+        glEnable(GL_DEPTH_CLAMP);
+
+        glBindVertexArray(sphereVAO);
+        glDrawElementsInstanced(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_INT, 0, lightVolumeCount);
+        glBindVertexArray(0);
+
+        glDisable(GL_DEPTH_CLAMP);
+        glCullFace(GL_BACK);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+    }
+
+    int DeferredShading::getLightVolumeCount() {
+
+        return lightVolumeCount;
+    }
+
+    void DeferredShading::deleteGBuffer() {
+
+        if (gBufferFBO == 0) {
+            return;
+        }
+        glDeleteFramebuffers(1, &gBufferFBO);
+        GLuint textures[] = { albedoTexture, normalTexture, specularTexture, depthTexture };
+        glDeleteTextures(4, textures);
+        gBufferFBO = 0;
+    }
+}
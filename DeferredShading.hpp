@@ -0,0 +1,74 @@
+#ifndef DeferredShading_hpp
+#define DeferredShading_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "LightManager.hpp"
+#include "Shader.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Deferred path of the main pass: the geometry is drawn once into a G-buffer (albedo and
+    // moon visibility, view space normal, specular color, depth), then the lights are applied
+    // per pixel from it, the point lights as instanced sphere volumes
+    class DeferredShading {
+
+    public:
+        DeferredShading();
+
+        // Creates the light volume sphere and its instance buffer
+        void init();
+
+        // (Re)creates the G-buffer when the viewport size changes
+        void resize(int width, int height);
+
+        // Binds and clears the G-buffer, the geometry pass writes its three color targets
+        void beginGeometryPass();
+
+        // Binds the G-buffer textures to firstTextureUnit and the three units after it and sets
+        // the uniforms positions are reconstructed with, the shader must be in use
+        void bindGBuffer(gps::Shader shader, int firstTextureUnit, const glm::mat4& projection);
+
+        // Adds the lights, already in eye space (see LightManager), to the current framebuffer,
+        // whose depth buffer must hold the G-buffer depth. Only the pixels in front of a
+        // volume's back faces are shaded
+        void drawLightVolumes(gps::Shader shader, const std::vector<PointLight>& eyeLights);
+
+        // volumes drawn by the last drawLightVolumes
+        int getLightVolumeCount();
+
+    private:
+        int width;
+        int height;
+
+        GLuint gBufferFBO;
+        GLuint albedoTexture;
+        GLuint normalTexture;
+        GLuint specularTexture;
+        GLuint depthTexture;
+
+        GLuint sphereVAO;
+        GLuint sphereVBO;
+        GLuint sphereEBO;
+        GLsizei sphereIndexCount;
+        GLuint instanceVBO;
+
+        // per light: view space position and radius, then color and shadow slot
+        std::vector<glm::vec4> instanceData;
+        int lightVolumeCount;
+
+        void deleteGBuffer();
+    };
+}
+
+#endif /* DeferredShading_hpp */
@@ -0,0 +1,67 @@
+#include "GpuTimer.hpp"
+
+namespace gps {
+
+    GpuTimer::GpuTimer() : current(0), totalMs(0.0), samples(0) {
+
+        for (int i = 0; i < QUERY_COUNT; i++) {
+            queries[i] = 0;
+            pending[i] = false;
+        }
+    }
+
+    void GpuTimer::init() {
+
+        glGenQueries(QUERY_COUNT, queries);
+    }
+
+    void GpuTimer::begin() {
+
+        collect();
+
+        // every query is still in flight, skip this measurement rather than wait
+        if (pending[current]) {
+            return;
+        }
+        glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+    }
+
+    void GpuTimer::end() {
+
+        if (pending[current]) {
+            return;
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        pending[current] = true;
+        current = (current + 1) % QUERY_COUNT;
+    }
+
+    void GpuTimer::collect() {
+
+        for (int i = 0; i < QUERY_COUNT; i++) {
+            if (!pending[i]) {
+                continue;
+            }
+            GLuint available = 0;
+            glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+                totalMs += elapsed / 1000000.0;
+                samples++;
+                pending[i] = false;
+            }
+        }
+    }
+
+    double GpuTimer::getAverageMs() {
+
+        return samples > 0 ? totalMs / samples : 0.0;
+    }
+
+    void GpuTimer::reset() {
+
+        totalMs = 0.0;
+        samples = 0;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef GpuTimer_hpp
+#define GpuTimer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    // Measures the GPU time of a block of commands with GL_TIME_ELAPSED queries.
+    // Results are collected a few frames later, only once they are available
+    class GpuTimer {
+
+    public:
+        GpuTimer();
+
+        void init();
+        void begin();
+        void end();
+
+        // average of the collected results in milliseconds, 0 when there are none
+        double getAverageMs();
+        void reset();
+
+    private:
+        static const int QUERY_COUNT = 4;
+
+        GLuint queries[QUERY_COUNT];
+        bool pending[QUERY_COUNT];
+        int current;
+        double totalMs;
+        int samples;
+
+        void collect();
+    };
+}
+
+#endif /* GpuTimer_hpp */
@@ -0,0 +1,264 @@
+#include "IrradianceProbes.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <glm/gtc/type_ptr.hpp>
+
+namespace gps {
+
+    namespace {
+        // directions sampled around every probe, spread over the sphere on a Fibonacci spiral
+        const int PROBE_RAY_COUNT = 128;
+        // reflectance of the static geometry for the bounce, the tracer has no textures
+        const float BOUNCE_ALBEDO = 0.5f;
+        const float BOUNCE_DISTANCE = 100.0f;
+        const float MOON_RAY_LENGTH = 1000.0f;
+        const float LIGHT_CLEARANCE = 0.05f;
+        const float RAY_OFFSET = 0.002f;
+        const float PI = 3.14159265f;
+        // SH band 0 and band 1 convolved with the cosine lobe, for a unit delta light:
+        // pi * Y00^2 and 2 pi / 3 * Y1m^2
+        const float BAND0_WEIGHT = 0.25f;
+        const float BAND1_WEIGHT = 0.5f;
+
+        const char PROBES_MAGIC[4] = { 'P', 'R', 'B', 'E' };
+        const int PROBES_VERSION = 1;
+
+        struct ProbesHeader {
+            char magic[4];
+            int version;
+            int resolution[3];
+            float boundsMin[3];
+            float boundsMax[3];
+        };
+
+        // adds light arriving from direction to the irradiance coefficients, visibility in w
+        void addDirection(glm::vec4* probe, glm::vec3 direction, glm::vec3 color, float visibility) {
+            glm::vec4 value(color, visibility);
+            probe[0] += value * BAND0_WEIGHT;
+            probe[1] += value * (BAND1_WEIGHT * direction.x);
+            probe[2] += value * (BAND1_WEIGHT * direction.y);
+            probe[3] += value * (BAND1_WEIGHT * direction.z);
+        }
+
+        glm::vec3 fibonacciDirection(int i, int count) {
+            float y = 1.0f - 2.0f * ((float)i + 0.5f) / (float)count;
+            float r = std::sqrt(std::max(0.0f, 1.0f - y * y));
+            float phi = 2.39996323f * (float)i;
+            return glm::vec3(r * std::cos(phi), y, r * std::sin(phi));
+        }
+    }
+
+    const int IrradianceProbes::MAX_RESOLUTION;
+
+    IrradianceProbes::IrradianceProbes() : resolution(0, 0, 0), clamped(false) {
+        for (int k = 0; k < COEFFICIENT_COUNT; k++) {
+            textures[k] = 0;
+        }
+    }
+
+    void IrradianceProbes::bake(const AABB& bounds, float spacing, const RayTracer& scene, const std::vector<glm::vec3>& triangleCorners,
+                                const BakeSettings& settings, ThreadPool& threadPool) {
+
+        this->bounds = bounds;
+        glm::vec3 size = bounds.max - bounds.min;
+        glm::ivec3 wanted(
+            std::max((int)std::ceil(size.x / spacing) + 1, 2),
+            std::max((int)std::ceil(size.y / spacing) + 1, 2),
+            std::max((int)std::ceil(size.z / spacing) + 1, 2));
+        resolution = glm::ivec3(std::min(wanted.x, MAX_RESOLUTION), std::min(wanted.y, MAX_RESOLUTION), std::min(wanted.z, MAX_RESOLUTION));
+        clamped = wanted.x > MAX_RESOLUTION || wanted.y > MAX_RESOLUTION || wanted.z > MAX_RESOLUTION;
+        int probeCount = getProbeCount();
+        for (int k = 0; k < COEFFICIENT_COUNT; k++) {
+            coefficients[k].assign(probeCount, glm::vec4(0.0f));
+        }
+
+        glm::vec3 step(size.x / (resolution.x - 1), size.y / (resolution.y - 1), size.z / (resolution.z - 1));
+        glm::vec3 moonDirection = glm::normalize(settings.moonDirection);
+        // each sampled direction stands for this much of the sphere
+        float sampleWeight = 4.0f * PI / (float)PROBE_RAY_COUNT;
+
+        threadPool.parallelFor(resolution.z * resolution.y, [&](int row) {
+            int z = row / resolution.y;
+            int y = row % resolution.y;
+            for (int x = 0; x < resolution.x; x++) {
+                int index = row * resolution.x + x;
+                glm::vec3 position = bounds.min + glm::vec3(x * step.x, y * step.y, z * step.z);
+                glm::vec4 probe[COEFFICIENT_COUNT];
+                for (int k = 0; k < COEFFICIENT_COUNT; k++) {
+                    probe[k] = glm::vec4(0.0f);
+                }
+
+                // the static lights are single directions
+                if (!scene.occluded(position, moonDirection, MOON_RAY_LENGTH)) {
+                    addDirection(probe, moonDirection, settings.moonColor, 0.0f);
+                }
+                for (size_t i = 0; i < settings.lights.size(); i++) {
+                    const PointLight& light = settings.lights[i];
+                    glm::vec3 toLight = light.position - position;
+                    float distance = glm::length(toLight);
+                    if (distance <= 0.0f || distance >= light.radius) {
+                        continue;
+                    }
+                    glm::vec3 direction = toLight / distance;
+                    if (distance > LIGHT_CLEARANCE && scene.occluded(position, direction, distance - LIGHT_CLEARANCE)) {
+                        continue;
+                    }
+                    addDirection(probe, direction, light.color * pointLightAttenuation(distance, light.radius), 0.0f);
+                }
+
+                // one bounce off the static geometry, and whether the surroundings are open
+                for (int i = 0; i < PROBE_RAY_COUNT; i++) {
+                    glm::vec3 direction = fibonacciDirection(i, PROBE_RAY_COUNT);
+                    float hitT;
+                    int hitTriangle;
+                    glm::vec3 radiance(0.0f);
+                    float visibility = 1.0f;
+                    if (scene.intersect(position, direction, BOUNCE_DISTANCE, hitT, hitTriangle)) {
+                        const glm::vec3* corner = &triangleCorners[3 * hitTriangle];
+                        glm::vec3 normal = glm::cross(corner[1] - corner[0], corner[2] - corner[0]);
+                        float length = glm::length(normal);
+                        if (length > 0.0f) {
+                            normal /= length;
+                            // the side facing the probe
+                            if (glm::dot(normal, direction) > 0.0f) {
+                                normal = -normal;
+                            }
+                            glm::vec3 hitPosition = position + direction * hitT;
+                            radiance = bakeDirectLight(scene, settings, hitPosition, normal) * (BOUNCE_ALBEDO / PI);
+                        }
+                        visibility = hitT < settings.aoDistance ? 0.0f : 1.0f;
+                    }
+                    // visibility is divided by pi, a fully open probe ends up at 1
+                    addDirection(probe, direction, radiance * sampleWeight, visibility * sampleWeight / PI);
+                }
+
+                for (int k = 0; k < COEFFICIENT_COUNT; k++) {
+                    coefficients[k][index] = probe[k];
+                }
+            }
+        });
+    }
+
+    bool IrradianceProbes::save(const std::string& path) {
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        ProbesHeader header;
+        std::memcpy(header.magic, PROBES_MAGIC, sizeof(header.magic));
+        header.version = PROBES_VERSION;
+        header.resolution[0] = resolution.x;
+        header.resolution[1] = resolution.y;
+        header.resolution[2] = resolution.z;
+        for (int axis = 0; axis < 3; axis++) {
+            header.boundsMin[axis] = bounds.min[axis];
+            header.boundsMax[axis] = bounds.max[axis];
+        }
+
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+        for (int k = 0; k < COEFFICIENT_COUNT && written; k++) {
+            written = fwrite(coefficients[k].data(), sizeof(glm::vec4), coefficients[k].size(), file) == coefficients[k].size();
+        }
+        fclose(file);
+        return written;
+    }
+
+    bool IrradianceProbes::load(const std::string& path) {
+
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        ProbesHeader header;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1
+            && std::memcmp(header.magic, PROBES_MAGIC, sizeof(header.magic)) == 0
+            && header.version == PROBES_VERSION;
+        for (int axis = 0; axis < 3 && valid; axis++) {
+            valid = header.resolution[axis] >= 2 && header.resolution[axis] <= MAX_RESOLUTION;
+        }
+        if (valid) {
+            resolution = glm::ivec3(header.resolution[0], header.resolution[1], header.resolution[2]);
+            bounds = AABB(glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]),
+                          glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]));
+            for (int k = 0; k < COEFFICIENT_COUNT && valid; k++) {
+                coefficients[k].resize(getProbeCount());
+                valid = fread(coefficients[k].data(), sizeof(glm::vec4), coefficients[k].size(), file) == coefficients[k].size();
+            }
+        }
+        fclose(file);
+        if (!valid) {
+            resolution = glm::ivec3(0, 0, 0);
+            return false;
+        }
+
+        // trilinear filtering between the probes, clamped at the grid border
+        for (int k = 0; k < COEFFICIENT_COUNT; k++) {
+            if (textures[k] == 0) {
+                glGenTextures(1, &textures[k]);
+            }
+            glBindTexture(GL_TEXTURE_3D, textures[k]);
+            glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, resolution.x, resolution.y, resolution.z, 0, GL_RGBA, GL_FLOAT, coefficients[k].data());
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_3D, 0);
+        return true;
+    }
+
+    bool IrradianceProbes::isLoaded() {
+
+        return textures[0] != 0 && getProbeCount() > 0;
+    }
+
+    void IrradianceProbes::bind(gps::Shader shader, int firstTextureUnit) {
+
+        GLint units[COEFFICIENT_COUNT];
+        for (int k = 0; k < COEFFICIENT_COUNT; k++) {
+            glActiveTexture(GL_TEXTURE0 + firstTextureUnit + k);
+            glBindTexture(GL_TEXTURE_3D, textures[k]);
+            units[k] = firstTextureUnit + k;
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1iv(glGetUniformLocation(shader.shaderProgram, "probeCoefficients"), COEFFICIENT_COUNT, units);
+
+        // world position to texture coordinates, the probes sit on the texel centers
+        glm::vec3 scale(0.0f), bias(0.0f);
+        glm::vec3 size = bounds.max - bounds.min;
+        if (isLoaded()) {
+            glm::vec3 count((float)resolution.x, (float)resolution.y, (float)resolution.z);
+            for (int axis = 0; axis < 3; axis++) {
+                scale[axis] = size[axis] > 0.0f ? (count[axis] - 1.0f) / (count[axis] * size[axis]) : 0.0f;
+                bias[axis] = 0.5f / count[axis] - bounds.min[axis] * scale[axis];
+            }
+        }
+        glUniform3fv(glGetUniformLocation(shader.shaderProgram, "probeGridScale"), 1, glm::value_ptr(scale));
+        glUniform3fv(glGetUniformLocation(shader.shaderProgram, "probeGridBias"), 1, glm::value_ptr(bias));
+    }
+
+    int IrradianceProbes::getProbeCount() {
+
+        return resolution.x * resolution.y * resolution.z;
+    }
+
+    glm::vec3 IrradianceProbes::getSpacing() {
+
+        if (getProbeCount() == 0) {
+            return glm::vec3(0.0f);
+        }
+        glm::vec3 size = bounds.max - bounds.min;
+        return glm::vec3(size.x / (resolution.x - 1), size.y / (resolution.y - 1), size.z / (resolution.z - 1));
+    }
+
+    bool IrradianceProbes::isClamped() {
+
+        return clamped;
+    }
+}
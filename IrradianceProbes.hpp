@@ -0,0 +1,71 @@
+#ifndef IrradianceProbes_hpp
+#define IrradianceProbes_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "Bounds.hpp"
+#include "Lightmap.hpp"
+#include "RayTracer.hpp"
+#include "Shader.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Grid of L1 spherical harmonic irradiance probes over the scene, the baked lighting of
+    // the moving objects. Every probe holds the static lights it sees, one bounce off the
+    // static geometry and the visibility of its surroundings, already convolved with the
+    // cosine lobe: irradiance(n) = c0 + c1 n.x + c2 n.y + c3 n.z, visibility in the alphas
+    class IrradianceProbes {
+
+    public:
+        static const int COEFFICIENT_COUNT = 4;
+        // probes along one axis at most
+        static const int MAX_RESOLUTION = 64;
+
+        IrradianceProbes();
+
+        // Bakes one probe every spacing units over bounds, or fewer along the axes that would
+        // need more than MAX_RESOLUTION (see getSpacing). triangleCorners are the ones the
+        // scene was built from, the bounce needs their normals
+        void bake(const AABB& bounds, float spacing, const RayTracer& scene, const std::vector<glm::vec3>& triangleCorners,
+                  const BakeSettings& settings, ThreadPool& threadPool);
+
+        bool save(const std::string& path);
+
+        // Reads a baked grid and uploads it as COEFFICIENT_COUNT 3D textures, false when
+        // the file is missing or unreadable
+        bool load(const std::string& path);
+        bool isLoaded();
+
+        // Binds the coefficient textures to firstTextureUnit and the units after it and sets
+        // the grid uniforms, the shader must be in use
+        void bind(gps::Shader shader, int firstTextureUnit);
+
+        int getProbeCount();
+        // distance between neighbouring probes along each axis
+        glm::vec3 getSpacing();
+        // the spacing along some axis is larger than the one asked for
+        bool isClamped();
+
+    private:
+        AABB bounds;
+        glm::ivec3 resolution;
+        bool clamped;
+        // coefficient k of probe (x, y, z) at coefficients[k][(z * res.y + y) * res.x + x]
+        std::vector<glm::vec4> coefficients[COEFFICIENT_COUNT];
+        GLuint textures[COEFFICIENT_COUNT];
+    };
+}
+
+#endif /* IrradianceProbes_hpp */
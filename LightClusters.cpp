@@ -0,0 +1,268 @@
+#include "LightClusters.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define CLUSTERS_SSE
+    #include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    namespace {
+        // the slices stop here, fragments further away use the last slice
+        const float MAX_CLUSTER_DEPTH = 100.0f;
+        // light indices are stored in 16 bits
+        const size_t MAX_LIGHTS = 65535;
+        const int TILE_COUNT = LightClusters::CLUSTERS_X * LightClusters::CLUSTERS_Y;
+
+        void uploadTextureBuffer(GLuint buffer, size_t bytes, const void* data) {
+
+            glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+            // orphaned, the draws of the last frame may still read the old storage
+            glBufferData(GL_TEXTURE_BUFFER, std::max(bytes, (size_t)16), NULL, GL_STREAM_DRAW);
+            if (bytes > 0) {
+                glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+            }
+        }
+    }
+
+    LightClusters::LightClusters(ThreadPool* threadPool)
+        : threadPool(threadPool), lightBuffer(0), lightTexture(0), gridBuffer(0), gridTexture(0), indexBuffer(0), indexTexture(0),
+          boundsProjection(0.0f), nearPlane(0.1f), farPlane(MAX_CLUSTER_DEPTH), occupiedClusters(0), maxClusterLights(0) {
+
+        // padded to whole SIMD groups
+        int paddedTiles = (TILE_COUNT + 3) / 4 * 4;
+        for (int slice = 0; slice < CLUSTERS_Z; slice++) {
+            tileMinX[slice].assign(paddedTiles, 1e30f);
+            tileMaxX[slice].assign(paddedTiles, -1e30f);
+            tileMinY[slice].assign(paddedTiles, 1e30f);
+            tileMaxY[slice].assign(paddedTiles, -1e30f);
+            sliceMinZ[slice] = 0.0f;
+            sliceMaxZ[slice] = 0.0f;
+        }
+    }
+
+    void LightClusters::init() {
+
+        glGenBuffers(1, &lightBuffer);
+        glGenBuffers(1, &gridBuffer);
+        glGenBuffers(1, &indexBuffer);
+        uploadTextureBuffer(lightBuffer, 0, NULL);
+        uploadTextureBuffer(gridBuffer, 0, NULL);
+        uploadTextureBuffer(indexBuffer, 0, NULL);
+
+        // per light: view space position and radius, then color and shadow slot
+        glGenTextures(1, &lightTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer);
+
+        // per cluster: first index and light count
+        glGenTextures(1, &gridTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, gridBuffer);
+
+        glGenTextures(1, &indexTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, indexBuffer);
+
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    int LightClusters::sliceOf(float viewDepth) {
+
+        if (viewDepth <= nearPlane) {
+            return 0;
+        }
+        int slice = (int)std::floor(std::log(viewDepth / nearPlane) / std::log(farPlane / nearPlane) * CLUSTERS_Z);
+        return std::min(slice, CLUSTERS_Z - 1);
+    }
+
+    void LightClusters::computeClusterBounds(const glm::mat4& projection) {
+
+        boundsProjection = projection;
+        nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+        float cameraFar = projection[3][2] / (projection[2][2] + 1.0f);
+        farPlane = std::min(cameraFar, MAX_CLUSTER_DEPTH);
+
+        for (int slice = 0; slice < CLUSTERS_Z; slice++) {
+            float sliceNear = nearPlane * std::pow(farPlane / nearPlane, (float)slice / CLUSTERS_Z);
+            float sliceFar = nearPlane * std::pow(farPlane / nearPlane, (float)(slice + 1) / CLUSTERS_Z);
+            sliceMinZ[slice] = -sliceFar;
+            sliceMaxZ[slice] = -sliceNear;
+
+            // a point at ndc x and depth d sits at view x = ndc x * d / projection[0][0]
+            for (int y = 0; y < CLUSTERS_Y; y++) {
+                for (int x = 0; x < CLUSTERS_X; x++) {
+                    float ndcX0 = -1.0f + 2.0f * x / CLUSTERS_X;
+                    float ndcX1 = -1.0f + 2.0f * (x + 1) / CLUSTERS_X;
+                    float ndcY0 = -1.0f + 2.0f * y / CLUSTERS_Y;
+                    float ndcY1 = -1.0f + 2.0f * (y + 1) / CLUSTERS_Y;
+
+                    int tile = y * CLUSTERS_X + x;
+                    tileMinX[slice][tile] = std::min(ndcX0 * sliceNear, ndcX0 * sliceFar) / projection[0][0];
+                    tileMaxX[slice][tile] = std::max(ndcX1 * sliceNear, ndcX1 * sliceFar) / projection[0][0];
+                    tileMinY[slice][tile] = std::min(ndcY0 * sliceNear, ndcY0 * sliceFar) / projection[1][1];
+                    tileMaxY[slice][tile] = std::max(ndcY1 * sliceNear, ndcY1 * sliceFar) / projection[1][1];
+                }
+            }
+        }
+    }
+
+    void LightClusters::binSlice(int slice) {
+
+        std::vector<unsigned short>* tileLights = sliceTileLights[slice];
+        for (int tile = 0; tile < TILE_COUNT; tile++) {
+            tileLights[tile].clear();
+        }
+
+        const float* minX = &tileMinX[slice][0];
+        const float* maxX = &tileMaxX[slice][0];
+        const float* minY = &tileMinY[slice][0];
+        const float* maxY = &tileMaxY[slice][0];
+
+        for (size_t i = 0; i < viewLights.size(); i++) {
+            if (slice < lightFirstSlice[i] || slice > lightLastSlice[i]) {
+                continue;
+            }
+
+            // the z distance to the sphere is the same for every tile of the slice
+            glm::vec4 light = viewLights[i];
+            float dz = std::max(0.0f, std::max(sliceMinZ[slice] - light.z, light.z - sliceMaxZ[slice]));
+            float remaining = light.w * light.w - dz * dz;
+            if (remaining < 0.0f) {
+                continue;
+            }
+
+#if defined(CLUSTERS_SSE)
+            __m128 centerX = _mm_set1_ps(light.x);
+            __m128 centerY = _mm_set1_ps(light.y);
+            __m128 limit = _mm_set1_ps(remaining);
+            __m128 zero = _mm_setzero_ps();
+            for (int tile = 0; tile < TILE_COUNT; tile += 4) {
+                __m128 dx = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minX + tile), centerX),
+                                                        _mm_sub_ps(centerX, _mm_loadu_ps(maxX + tile))));
+                __m128 dy = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minY + tile), centerY),
+                                                        _mm_sub_ps(centerY, _mm_loadu_ps(maxY + tile))));
+                __m128 distance = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+                int mask = _mm_movemask_ps(_mm_cmple_ps(distance, limit));
+                while (mask != 0) {
+                    int lane = 0;
+                    while (!(mask & (1 << lane))) {
+                        lane++;
+                    }
+                    mask &= ~(1 << lane);
+                    if (tile + lane < TILE_COUNT) {
+                        tileLights[tile + lane].push_back((unsigned short)i);
+                    }
+                }
+            }
+#else
+            for (int tile = 0; tile < TILE_COUNT; tile++) {
+                float dx = std::max(0.0f, std::max(minX[tile] - light.x, light.x - maxX[tile]));
+                float dy = std::max(0.0f, std::max(minY[tile] - light.y, light.y - maxY[tile]));
+                if (dx * dx + dy * dy <= remaining) {
+                    tileLights[tile].push_back((unsigned short)i);
+                }
+            }
+#endif
+        }
+    }
+
+    void LightClusters::update(const std::vector<PointLight>& eyeLights, const glm::mat4& projection) {
+
+        if (projection != boundsProjection) {
+            computeClusterBounds(projection);
+        }
+
+        size_t lightCount = std::min(eyeLights.size(), MAX_LIGHTS);
+        viewLights.resize(lightCount);
+        lightFirstSlice.resize(lightCount);
+        lightLastSlice.resize(lightCount);
+        lightData.resize(lightCount * 2);
+        for (size_t i = 0; i < lightCount; i++) {
+            glm::vec3 position = eyeLights[i].position;
+            float radius = eyeLights[i].radius;
+            viewLights[i] = glm::vec4(position, radius);
+            lightData[2 * i] = viewLights[i];
+            lightData[2 * i + 1] = glm::vec4(eyeLights[i].color, packLightFlags(eyeLights[i]));
+
+            float depth = -position.z;
+            if (radius <= 0.0f || depth + radius <= nearPlane || depth - radius >= farPlane) {
+                lightFirstSlice[i] = 0;
+                lightLastSlice[i] = -1;
+            } else {
+                lightFirstSlice[i] = sliceOf(depth - radius);
+                lightLastSlice[i] = sliceOf(depth + radius);
+            }
+        }
+
+        threadPool->parallelFor(CLUSTERS_Z, [this](int slice) {
+            binSlice(slice);
+        });
+
+        // the per slice lists are packed into one index list, clusters ordered slice, row, column
+        grid.resize(CLUSTER_COUNT * 2);
+        indices.clear();
+        occupiedClusters = 0;
+        maxClusterLights = 0;
+        for (int slice = 0; slice < CLUSTERS_Z; slice++) {
+            for (int tile = 0; tile < TILE_COUNT; tile++) {
+                const std::vector<unsigned short>& tileLights = sliceTileLights[slice][tile];
+                int cluster = slice * TILE_COUNT + tile;
+                grid[2 * cluster] = (GLuint)indices.size();
+                grid[2 * cluster + 1] = (GLuint)tileLights.size();
+                indices.insert(indices.end(), tileLights.begin(), tileLights.end());
+
+                if (!tileLights.empty()) {
+                    occupiedClusters++;
+                    maxClusterLights = std::max(maxClusterLights, (int)tileLights.size());
+                }
+            }
+        }
+
+        uploadTextureBuffer(lightBuffer, lightData.size() * sizeof(glm::vec4), lightData.empty() ? NULL : &lightData[0]);
+        uploadTextureBuffer(gridBuffer, grid.size() * sizeof(GLuint), &grid[0]);
+        uploadTextureBuffer(indexBuffer, indices.size() * sizeof(unsigned short), indices.empty() ? NULL : &indices[0]);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void LightClusters::bind(gps::Shader shader, int firstTextureUnit, int viewportWidth, int viewportHeight) {
+
+        glActiveTexture(GL_TEXTURE0 + firstTextureUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "lightData"), firstTextureUnit);
+        glActiveTexture(GL_TEXTURE0 + firstTextureUnit + 1);
+        glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterGrid"), firstTextureUnit + 1);
+        glActiveTexture(GL_TEXTURE0 + firstTextureUnit + 2);
+        glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "clusterLights"), firstTextureUnit + 2);
+        glActiveTexture(GL_TEXTURE0);
+
+        // slice = log(depth) * scale - bias, the inverse of the split in computeClusterBounds
+        float logRange = std::log(farPlane / nearPlane);
+        glUniform3i(glGetUniformLocation(shader.shaderProgram, "clusterCount"), CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z);
+        glUniform2f(glGetUniformLocation(shader.shaderProgram, "clusterTileScale"),
+            (float)CLUSTERS_X / viewportWidth, (float)CLUSTERS_Y / viewportHeight);
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "clusterSliceScale"), CLUSTERS_Z / logRange);
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "clusterSliceBias"), CLUSTERS_Z * std::log(nearPlane) / logRange);
+    }
+
+    int LightClusters::getIndexCount() {
+
+        return (int)indices.size();
+    }
+
+    int LightClusters::getOccupiedClusterCount() {
+
+        return occupiedClusters;
+    }
+
+    int LightClusters::getMaxClusterLights() {
+
+        return maxClusterLights;
+    }
+}
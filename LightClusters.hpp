@@ -0,0 +1,93 @@
+#ifndef LightClusters_hpp
+#define LightClusters_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "LightManager.hpp"
+#include "Shader.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Clustered forward lighting: the view frustum is split into a grid of froxels (screen
+    // tiles x exponential depth slices), the point lights are binned into them on the CPU
+    // and the fragment shader only walks the lights of its own froxel
+    class LightClusters {
+
+    public:
+        static const int CLUSTERS_X = 16;
+        static const int CLUSTERS_Y = 9;
+        static const int CLUSTERS_Z = 24;
+        static const int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+
+        LightClusters(ThreadPool* threadPool);
+
+        // Creates the texture buffers
+        void init();
+
+        // Bins the lights, already in eye space (see LightManager), and uploads the light,
+        // grid and index buffers
+        void update(const std::vector<PointLight>& eyeLights, const glm::mat4& projection);
+
+        // Binds the texture buffers to firstTextureUnit and the two units after it and sets
+        // the clustering uniforms, the shader must be in use
+        void bind(gps::Shader shader, int firstTextureUnit, int viewportWidth, int viewportHeight);
+
+        // statistics of the last update
+        int getIndexCount();
+        int getOccupiedClusterCount();
+        int getMaxClusterLights();
+
+    private:
+        ThreadPool* threadPool;
+
+        GLuint lightBuffer;
+        GLuint lightTexture;
+        GLuint gridBuffer;
+        GLuint gridTexture;
+        GLuint indexBuffer;
+        GLuint indexTexture;
+
+        // froxel bounds in view space, x and y per tile of a slice (structure of arrays for
+        // the SIMD test), z per slice
+        glm::mat4 boundsProjection;
+        float nearPlane;
+        float farPlane;
+        std::vector<float> tileMinX[CLUSTERS_Z];
+        std::vector<float> tileMaxX[CLUSTERS_Z];
+        std::vector<float> tileMinY[CLUSTERS_Z];
+        std::vector<float> tileMaxY[CLUSTERS_Z];
+        float sliceMinZ[CLUSTERS_Z];
+        float sliceMaxZ[CLUSTERS_Z];
+
+        // lights in view space, with the slices they can reach
+        std::vector<glm::vec4> viewLights;
+        std::vector<int> lightFirstSlice;
+        std::vector<int> lightLastSlice;
+
+        // per slice output of the binning jobs, light indices grouped by tile
+        std::vector<unsigned short> sliceTileLights[CLUSTERS_Z][CLUSTERS_X * CLUSTERS_Y];
+
+        std::vector<GLuint> grid;
+        std::vector<unsigned short> indices;
+        std::vector<glm::vec4> lightData;
+        int occupiedClusters;
+        int maxClusterLights;
+
+        void computeClusterBounds(const glm::mat4& projection);
+        void binSlice(int slice);
+        int sliceOf(float viewDepth);
+    };
+}
+
+#endif /* LightClusters_hpp */
@@ -0,0 +1,140 @@
+#include "LightManager.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    namespace {
+        // attenuation of shaderStart.frag, 1 / (CONSTANT + LINEAR d + QUADRATIC d^2)
+        const float ATTENUATION_CONSTANT = 1.0f;
+        const float ATTENUATION_LINEAR = 1.5f;
+        const float ATTENUATION_QUADRATIC = 3.0f;
+        // contributions under this are cut, the shader fades the light out before its radius
+        const float LIGHT_CUTOFF = 1.0f / 64.0f;
+    }
+
+    float pointLightRadius(glm::vec3 color) {
+
+        float brightest = std::max(color.x, std::max(color.y, color.z));
+        if (brightest / ATTENUATION_CONSTANT <= LIGHT_CUTOFF) {
+            return 0.0f;
+        }
+        float attenuation = LIGHT_CUTOFF / brightest;
+
+        // solves QUADRATIC d^2 + LINEAR d + CONSTANT = 1 / attenuation
+        float c = ATTENUATION_CONSTANT - 1.0f / attenuation;
+        float discriminant = ATTENUATION_LINEAR * ATTENUATION_LINEAR - 4.0f * ATTENUATION_QUADRATIC * c;
+        return (-ATTENUATION_LINEAR + std::sqrt(discriminant)) / (2.0f * ATTENUATION_QUADRATIC);
+    }
+
+    float pointLightAttenuation(float distance, float radius) {
+
+        float attenuation = 1.0f / (ATTENUATION_CONSTANT + ATTENUATION_LINEAR * distance + ATTENUATION_QUADRATIC * distance * distance);
+        float ratio = distance / radius;
+        float falloff = glm::clamp(1.0f - ratio * ratio * ratio * ratio, 0.0f, 1.0f);
+        return attenuation * falloff * falloff;
+    }
+
+    float packLightFlags(const PointLight& light) {
+
+        return (float)((light.shadowSlot + 1) | (light.baked ? LIGHT_FLAG_BAKED : 0));
+    }
+
+    LightManager::LightManager() {
+    }
+
+    int LightManager::addLight(glm::vec3 position, glm::vec3 color) {
+
+        PointLight light;
+        light.position = position;
+        light.color = color;
+        light.radius = pointLightRadius(color);
+        light.shadowSlot = -1;
+        light.baked = false;
+        lights.push_back(light);
+        return (int)lights.size() - 1;
+    }
+
+    PointLight& LightManager::getLight(int light) {
+
+        return lights[light];
+    }
+
+    int LightManager::getLightCount() {
+
+        return (int)lights.size();
+    }
+
+    void LightManager::update(const glm::mat4& view, const BVH& sceneBVH, const std::vector<bool>& instanceVisible) {
+
+        int instanceCount = (int)instanceVisible.size();
+        eyeLights.clear();
+        lightInstances.clear();
+        lightInstanceOffsets.clear();
+        lightInstanceOffsets.push_back(0);
+
+        // visible instances inside each light's sphere
+        for (size_t i = 0; i < lights.size(); i++) {
+            const PointLight& light = lights[i];
+            if (light.radius <= 0.0f) {
+                continue;
+            }
+
+            queryResult.clear();
+            sceneBVH.querySphere(light.position, light.radius, queryResult);
+            size_t first = lightInstances.size();
+            for (size_t j = 0; j < queryResult.size(); j++) {
+                if (instanceVisible[queryResult[j]]) {
+                    lightInstances.push_back(queryResult[j]);
+                }
+            }
+            if (lightInstances.size() == first) {
+                continue;
+            }
+
+            // moved to eye space once here instead of for every fragment
+            PointLight eyeLight = light;
+            eyeLight.position = glm::vec3(view * glm::vec4(light.position, 1.0f));
+            eyeLights.push_back(eyeLight);
+            lightInstanceOffsets.push_back((int)lightInstances.size());
+        }
+
+        // the light -> instances lists turned around into instance -> lights
+        instanceLightOffsets.assign(instanceCount + 1, 0);
+        for (size_t j = 0; j < lightInstances.size(); j++) {
+            instanceLightOffsets[lightInstances[j] + 1]++;
+        }
+        for (int i = 0; i < instanceCount; i++) {
+            instanceLightOffsets[i + 1] += instanceLightOffsets[i];
+        }
+        instanceLightIndices.resize(lightInstances.size());
+        std::vector<int>& cursor = queryResult;
+        cursor.assign(instanceLightOffsets.begin(), instanceLightOffsets.end() - 1);
+        for (size_t light = 0; light < eyeLights.size(); light++) {
+            for (int j = lightInstanceOffsets[light]; j < lightInstanceOffsets[light + 1]; j++) {
+                instanceLightIndices[cursor[lightInstances[j]]++] = (int)light;
+            }
+        }
+    }
+
+    const std::vector<PointLight>& LightManager::getEyeLights() {
+
+        return eyeLights;
+    }
+
+    int LightManager::getInstanceLightCount(int instance) {
+
+        return instanceLightOffsets[instance + 1] - instanceLightOffsets[instance];
+    }
+
+    const int* LightManager::getInstanceLights(int instance) {
+
+        return instanceLightIndices.empty() ? NULL : &instanceLightIndices[instanceLightOffsets[instance]];
+    }
+
+    int LightManager::getListEntryCount() {
+
+        return (int)instanceLightIndices.size();
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef LightManager_hpp
+#define LightManager_hpp
+
+#include "BVH.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    struct PointLight {
+
+        glm::vec3 position;
+        glm::vec3 color;
+        // distance where the light stops contributing, see pointLightRadius
+        float radius;
+        // cube of the light in the point shadow atlas, -1 when it casts no shadows
+        int shadowSlot;
+        // part of the lightmaps, lightmapped surfaces skip it at runtime
+        bool baked;
+    };
+
+    // Distance where 1 / (1 + 1.5 d + 3 d^2), the attenuation of shaderStart.frag, brings
+    // the brightest channel of color under a visible threshold
+    float pointLightRadius(glm::vec3 color);
+
+    // Attenuation of shaderStart.frag at distance, faded out to 0 at radius
+    float pointLightAttenuation(float distance, float radius);
+
+    // Shadow slot + 1 in the low 8 bits and LIGHT_FLAG_BAKED, the w of the light data the
+    // fragment shader reads
+    const int LIGHT_FLAG_BAKED = 256;
+    float packLightFlags(const PointLight& light);
+
+    // Owns the point lights of the scene. Once per frame they are moved to eye space and
+    // every visible mesh instance gets the list of lights whose spheres overlap its box,
+    // lights reaching no visible instance are left out of the frame
+    class LightManager {
+
+    public:
+        LightManager();
+
+        // Adds a light with the radius of its color, returns its index
+        int addLight(glm::vec3 position, glm::vec3 color);
+
+        PointLight& getLight(int light);
+        int getLightCount();
+
+        // Range culls the lights against the visible instances of the scene BVH and builds
+        // the per instance lists
+        void update(const glm::mat4& view, const BVH& sceneBVH, const std::vector<bool>& instanceVisible);
+
+        // lights of the frame with their positions in eye space
+        const std::vector<PointLight>& getEyeLights();
+        // indices into getEyeLights of the lights reaching an instance, count 0 when it is hidden
+        int getInstanceLightCount(int instance);
+        const int* getInstanceLights(int instance);
+
+        // statistics of the last update
+        int getListEntryCount();
+
+    private:
+        std::vector<PointLight> lights;
+        std::vector<PointLight> eyeLights;
+
+        // per instance lists, packed: instance i owns [offsets[i], offsets[i + 1])
+        std::vector<int> instanceLightOffsets;
+        std::vector<int> instanceLightIndices;
+
+        // scratch, instances overlapped by each light of the frame
+        std::vector<int> queryResult;
+        std::vector<int> lightInstances;
+        std::vector<int> lightInstanceOffsets;
+    };
+}
+
+#endif /* LightManager_hpp */
@@ -0,0 +1,539 @@
+#include "Lightmap.hpp"
+#include "Shader.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace gps {
+
+    namespace {
+        // empty texels around every chart, so bilinear filtering never reads a neighbour
+        const int CHART_PADDING = 2;
+        // every unwrap attempt that overflows the atlas lowers the density by this much
+        const float DENSITY_STEP = 0.8f;
+        const int MAX_UNWRAP_ATTEMPTS = 32;
+        // ray origins are pushed off the surface by this much, against self intersection
+        const float RAY_OFFSET = 0.002f;
+        // the moon is far away, its shadow rays only have to leave the scene
+        const float MOON_RAY_LENGTH = 1000.0f;
+        // rays toward a point light stop this short of it, its own lamp housing does not shadow it
+        const float LIGHT_CLEARANCE = 0.05f;
+        const int DILATION_PASSES = CHART_PADDING;
+
+        const char LIGHTMAP_MAGIC[4] = { 'L', 'M', 'A', 'P' };
+        const int LIGHTMAP_VERSION = 2;
+
+        struct LightmapHeader {
+            char magic[4];
+            int version;
+            int width;
+            int height;
+            unsigned long long unwrapHash;
+        };
+
+        struct Chart {
+            int mesh;
+            int axis;
+            std::vector<int> triangles;
+            glm::vec2 min;
+            glm::vec2 max;
+            // placement in the atlas, padding included
+            int x, y, width, height;
+        };
+
+        unsigned long long hashBytes(const void* data, size_t size, unsigned long long hash) {
+            return Shader::hashString(std::string((const char*)data, size), hash);
+        }
+
+        int findRoot(std::vector<int>& parent, int i) {
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        }
+
+        // 0..5: +x -x +y -y +z -z, by the largest component of the normal
+        int dominantAxis(glm::vec3 normal) {
+            glm::vec3 absolute(std::fabs(normal.x), std::fabs(normal.y), std::fabs(normal.z));
+            int axis = 0;
+            if (absolute.y > absolute[axis]) axis = 1;
+            if (absolute.z > absolute[axis]) axis = 2;
+            return 2 * axis + (normal[axis] < 0.0f ? 1 : 0);
+        }
+
+        glm::vec2 projectOnAxis(glm::vec3 position, int axis) {
+            switch (axis / 2) {
+            case 0: return glm::vec2(position.z, position.y);
+            case 1: return glm::vec2(position.x, position.z);
+            default: return glm::vec2(position.x, position.y);
+            }
+        }
+
+        int nextPowerOfTwo(int value) {
+            int power = 1;
+            while (power < value) {
+                power *= 2;
+            }
+            return power;
+        }
+
+        // Shelf packs the charts at density, false when the atlas would not fit in maxSize
+        bool packCharts(std::vector<Chart>& charts, float density, int maxSize, int& width, int& height) {
+
+            long long area = 0;
+            int widest = 0;
+            for (size_t i = 0; i < charts.size(); i++) {
+                Chart& chart = charts[i];
+                glm::vec2 extent = (chart.max - chart.min) * density;
+                chart.width = (int)std::ceil(extent.x) + 1 + 2 * CHART_PADDING;
+                chart.height = (int)std::ceil(extent.y) + 1 + 2 * CHART_PADDING;
+                area += (long long)chart.width * chart.height;
+                widest = std::max(widest, chart.width);
+            }
+            if (widest > maxSize) {
+                return false;
+            }
+
+            // a square-ish atlas, shelves lose some space at their ends
+            width = nextPowerOfTwo((int)std::ceil(std::sqrt((double)area * 1.2)));
+            width = std::min(std::max(width, nextPowerOfTwo(widest)), maxSize);
+
+            std::vector<int> order(charts.size());
+            for (size_t i = 0; i < order.size(); i++) {
+                order[i] = (int)i;
+            }
+            std::stable_sort(order.begin(), order.end(),
+                [&charts](int a, int b) { return charts[a].height > charts[b].height; });
+
+            int x = 0, y = 0, shelfHeight = 0;
+            for (size_t i = 0; i < order.size(); i++) {
+                Chart& chart = charts[order[i]];
+                if (x + chart.width > width) {
+                    y += shelfHeight;
+                    x = 0;
+                    shelfHeight = 0;
+                }
+                chart.x = x;
+                chart.y = y;
+                x += chart.width;
+                shelfHeight = std::max(shelfHeight, chart.height);
+            }
+            height = y + shelfHeight;
+            return height <= maxSize;
+        }
+
+        unsigned int hashTexel(unsigned int x, unsigned int y) {
+            unsigned int h = x * 73856093u ^ y * 19349663u;
+            h ^= h >> 16;
+            h *= 0x7feb352du;
+            h ^= h >> 15;
+            h *= 0x846ca68bu;
+            h ^= h >> 16;
+            return h;
+        }
+
+        float radicalInverse(unsigned int bits) {
+            bits = (bits << 16) | (bits >> 16);
+            bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+            bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+            bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+            bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+            return (float)bits * 2.3283064365386963e-10f;
+        }
+
+        // Fraction of cosine weighted rays leaving the point unblocked within distance. The
+        // Hammersley set is rotated per texel, so neighbours trade banding for fine noise
+        float bakeOcclusion(const RayTracer& scene, glm::vec3 origin, glm::vec3 normal, int sampleCount,
+                            float distance, unsigned int seed) {
+
+            if (sampleCount <= 0) {
+                return 1.0f;
+            }
+            glm::vec3 helper = std::fabs(normal.x) > 0.5f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+            glm::vec3 tangent = glm::normalize(glm::cross(helper, normal));
+            glm::vec3 bitangent = glm::cross(normal, tangent);
+            float rotation = (float)(seed & 0xffff) / 65536.0f;
+
+            int open = 0;
+            for (int i = 0; i < sampleCount; i++) {
+                float u = ((float)i + 0.5f) / (float)sampleCount;
+                float v = radicalInverse((unsigned int)i) + rotation;
+                v -= std::floor(v);
+                float r = std::sqrt(u);
+                float phi = 6.2831853f * v;
+                glm::vec3 direction = tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi))
+                    + normal * std::sqrt(std::max(0.0f, 1.0f - u));
+                if (!scene.occluded(origin, direction, distance)) {
+                    open++;
+                }
+            }
+            return (float)open / (float)sampleCount;
+        }
+
+        unsigned short floatToHalf(float value) {
+            unsigned int bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            unsigned short sign = (unsigned short)((bits >> 16) & 0x8000);
+            int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+            unsigned int mantissa = bits & 0x7fffff;
+            // too small values flush to zero, too large ones clamp to the largest half
+            if (exponent <= 0) {
+                return sign;
+            }
+            if (exponent >= 31) {
+                return (unsigned short)(sign | 0x7bff);
+            }
+            return (unsigned short)(sign | (exponent << 10) | (mantissa >> 13));
+        }
+    }
+
+    LightmapUnwrap unwrapLightmap(const std::vector<BakeMesh>& meshes, float texelsPerUnit, int maxSize) {
+
+        // charts: triangles facing the same axis, connected through shared positions
+        std::vector<Chart> charts;
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const BakeMesh& mesh = meshes[m];
+            int triangleCount = (int)(mesh.indices.size() / 3);
+            int vertexCount = (int)mesh.positions.size();
+
+            std::vector<int> axes(triangleCount);
+            for (int t = 0; t < triangleCount; t++) {
+                glm::vec3 p0 = mesh.positions[mesh.indices[3 * t]];
+                glm::vec3 p1 = mesh.positions[mesh.indices[3 * t + 1]];
+                glm::vec3 p2 = mesh.positions[mesh.indices[3 * t + 2]];
+                glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+                if (glm::dot(faceNormal, faceNormal) == 0.0f) {
+                    faceNormal = mesh.normals[mesh.indices[3 * t]];
+                }
+                axes[t] = dominantAxis(faceNormal);
+            }
+
+            // vertices split only for their normals or texture coordinates share a position id
+            std::vector<int> sorted(vertexCount);
+            for (int v = 0; v < vertexCount; v++) {
+                sorted[v] = v;
+            }
+            std::sort(sorted.begin(), sorted.end(), [&mesh](int a, int b) {
+                const glm::vec3& pa = mesh.positions[a];
+                const glm::vec3& pb = mesh.positions[b];
+                if (pa.x != pb.x) return pa.x < pb.x;
+                if (pa.y != pb.y) return pa.y < pb.y;
+                if (pa.z != pb.z) return pa.z < pb.z;
+                return a < b;
+            });
+            std::vector<int> positionIds(vertexCount);
+            int positionCount = 0;
+            for (int i = 0; i < vertexCount; i++) {
+                if (i > 0 && mesh.positions[sorted[i]] != mesh.positions[sorted[i - 1]]) {
+                    positionCount++;
+                }
+                positionIds[sorted[i]] = positionCount;
+            }
+            positionCount++;
+
+            std::vector<int> parent(triangleCount);
+            for (int t = 0; t < triangleCount; t++) {
+                parent[t] = t;
+            }
+            std::vector<int> owner((size_t)positionCount * 6, -1);
+            for (int t = 0; t < triangleCount; t++) {
+                for (int corner = 0; corner < 3; corner++) {
+                    int& first = owner[(size_t)positionIds[mesh.indices[3 * t + corner]] * 6 + axes[t]];
+                    if (first == -1) {
+                        first = t;
+                    } else {
+                        int a = findRoot(parent, first);
+                        int b = findRoot(parent, t);
+                        if (a != b) {
+                            parent[b] = a;
+                        }
+                    }
+                }
+            }
+
+            std::vector<int> chartOfRoot(triangleCount, -1);
+            for (int t = 0; t < triangleCount; t++) {
+                int root = findRoot(parent, t);
+                if (chartOfRoot[root] == -1) {
+                    chartOfRoot[root] = (int)charts.size();
+                    Chart chart;
+                    chart.mesh = (int)m;
+                    chart.axis = axes[t];
+                    chart.min = glm::vec2(1e30f);
+                    chart.max = glm::vec2(-1e30f);
+                    charts.push_back(chart);
+                }
+                Chart& chart = charts[chartOfRoot[root]];
+                chart.triangles.push_back(t);
+                for (int corner = 0; corner < 3; corner++) {
+                    glm::vec2 projected = projectOnAxis(mesh.positions[mesh.indices[3 * t + corner]], chart.axis);
+                    chart.min = glm::min(chart.min, projected);
+                    chart.max = glm::max(chart.max, projected);
+                }
+            }
+        }
+
+        LightmapUnwrap unwrap;
+        unwrap.width = 0;
+        unwrap.height = 0;
+        unwrap.chartCount = (int)charts.size();
+        unwrap.hash = hashBytes(&texelsPerUnit, sizeof(texelsPerUnit), Shader::HASH_SEED);
+        unwrap.hash = hashBytes(&maxSize, sizeof(maxSize), unwrap.hash);
+        for (size_t m = 0; m < meshes.size(); m++) {
+            if (!meshes[m].positions.empty()) {
+                unwrap.hash = hashBytes(&meshes[m].positions[0], meshes[m].positions.size() * sizeof(glm::vec3), unwrap.hash);
+            }
+            if (!meshes[m].indices.empty()) {
+                unwrap.hash = hashBytes(&meshes[m].indices[0], meshes[m].indices.size() * sizeof(GLuint), unwrap.hash);
+            }
+        }
+        unwrap.sourceVertices.resize(meshes.size());
+        unwrap.coords.resize(meshes.size());
+        unwrap.indices.resize(meshes.size());
+        if (charts.empty()) {
+            return unwrap;
+        }
+
+        float density = texelsPerUnit;
+        int width = 0, height = 0;
+        for (int attempt = 0; attempt < MAX_UNWRAP_ATTEMPTS; attempt++) {
+            if (packCharts(charts, density, maxSize, width, height)) {
+                break;
+            }
+            density *= DENSITY_STEP;
+        }
+        unwrap.width = width;
+        unwrap.height = height;
+
+        // a vertex used by several charts gets one copy per chart
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const BakeMesh& mesh = meshes[m];
+            unwrap.indices[m].resize(mesh.indices.size());
+        }
+        std::vector<std::vector<int> > vertexChart(meshes.size());
+        std::vector<std::vector<GLuint> > vertexCopy(meshes.size());
+        for (size_t m = 0; m < meshes.size(); m++) {
+            vertexChart[m].assign(meshes[m].positions.size(), -1);
+            vertexCopy[m].resize(meshes[m].positions.size());
+        }
+        glm::vec2 atlasSize((float)width, (float)height);
+        for (size_t c = 0; c < charts.size(); c++) {
+            const Chart& chart = charts[c];
+            const BakeMesh& mesh = meshes[chart.mesh];
+            glm::vec2 offset((float)(chart.x + CHART_PADDING) + 0.5f, (float)(chart.y + CHART_PADDING) + 0.5f);
+            for (size_t i = 0; i < chart.triangles.size(); i++) {
+                int t = chart.triangles[i];
+                for (int corner = 0; corner < 3; corner++) {
+                    GLuint vertex = mesh.indices[3 * t + corner];
+                    if (vertexChart[chart.mesh][vertex] != (int)c) {
+                        vertexChart[chart.mesh][vertex] = (int)c;
+                        vertexCopy[chart.mesh][vertex] = (GLuint)unwrap.sourceVertices[chart.mesh].size();
+                        glm::vec2 texel = (projectOnAxis(mesh.positions[vertex], chart.axis) - chart.min) * density + offset;
+                        unwrap.sourceVertices[chart.mesh].push_back(vertex);
+                        unwrap.coords[chart.mesh].push_back(texel / atlasSize);
+                    }
+                    unwrap.indices[chart.mesh][3 * t + corner] = vertexCopy[chart.mesh][vertex];
+                }
+            }
+        }
+        return unwrap;
+    }
+
+    glm::vec3 bakeDirectLight(const RayTracer& scene, const BakeSettings& settings, glm::vec3 position, glm::vec3 normal) {
+
+        glm::vec3 irradiance(0.0f);
+        glm::vec3 origin = position + normal * RAY_OFFSET;
+
+        glm::vec3 moonDirection = glm::normalize(settings.moonDirection);
+        float moonCosine = glm::dot(normal, moonDirection);
+        if (moonCosine > 0.0f && !scene.occluded(origin, moonDirection, MOON_RAY_LENGTH)) {
+            irradiance += settings.moonColor * moonCosine;
+        }
+
+        for (size_t i = 0; i < settings.lights.size(); i++) {
+            const PointLight& light = settings.lights[i];
+            glm::vec3 toLight = light.position - position;
+            float distance = glm::length(toLight);
+            if (distance <= 0.0f || distance >= light.radius) {
+                continue;
+            }
+            glm::vec3 direction = toLight / distance;
+            float cosine = glm::dot(normal, direction);
+            if (cosine <= 0.0f) {
+                continue;
+            }
+            if (distance > LIGHT_CLEARANCE && scene.occluded(origin, direction, distance - LIGHT_CLEARANCE)) {
+                continue;
+            }
+            irradiance += light.color * (cosine * pointLightAttenuation(distance, light.radius));
+        }
+        return irradiance;
+    }
+
+    std::vector<glm::vec4> bakeLightmap(const LightmapUnwrap& unwrap, const std::vector<BakeMesh>& meshes,
+                                        const RayTracer& scene, const BakeSettings& settings, ThreadPool& threadPool) {
+
+        int width = unwrap.width;
+        int height = unwrap.height;
+        size_t texelCount = (size_t)width * height;
+        std::vector<glm::vec3> positions(texelCount);
+        std::vector<glm::vec3> normals(texelCount);
+        std::vector<char> covered(texelCount, 0);
+
+        // texel centers inside each triangle get its interpolated position and normal
+        glm::vec2 atlasSize((float)width, (float)height);
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const BakeMesh& mesh = meshes[m];
+            const std::vector<GLuint>& indices = unwrap.indices[m];
+            for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+                GLuint v[3];
+                glm::vec2 corner[3];
+                for (int k = 0; k < 3; k++) {
+                    v[k] = indices[t + k];
+                    corner[k] = unwrap.coords[m][v[k]] * atlasSize;
+                }
+                float area = (corner[1].x - corner[0].x) * (corner[2].y - corner[0].y)
+                    - (corner[2].x - corner[0].x) * (corner[1].y - corner[0].y);
+                if (std::fabs(area) < 1e-12f) {
+                    continue;
+                }
+
+                int x0 = std::max(0, (int)std::floor(std::min(corner[0].x, std::min(corner[1].x, corner[2].x))));
+                int x1 = std::min(width - 1, (int)std::ceil(std::max(corner[0].x, std::max(corner[1].x, corner[2].x))));
+                int y0 = std::max(0, (int)std::floor(std::min(corner[0].y, std::min(corner[1].y, corner[2].y))));
+                int y1 = std::min(height - 1, (int)std::ceil(std::max(corner[0].y, std::max(corner[1].y, corner[2].y))));
+                for (int y = y0; y <= y1; y++) {
+                    for (int x = x0; x <= x1; x++) {
+                        glm::vec2 p((float)x + 0.5f, (float)y + 0.5f);
+                        float w0 = ((corner[1].x - p.x) * (corner[2].y - p.y) - (corner[2].x - p.x) * (corner[1].y - p.y)) / area;
+                        float w1 = ((corner[2].x - p.x) * (corner[0].y - p.y) - (corner[0].x - p.x) * (corner[2].y - p.y)) / area;
+                        float w2 = 1.0f - w0 - w1;
+                        if (w0 < -1e-4f || w1 < -1e-4f || w2 < -1e-4f) {
+                            continue;
+                        }
+                        GLuint s0 = unwrap.sourceVertices[m][v[0]];
+                        GLuint s1 = unwrap.sourceVertices[m][v[1]];
+                        GLuint s2 = unwrap.sourceVertices[m][v[2]];
+                        size_t texel = (size_t)y * width + x;
+                        positions[texel] = mesh.positions[s0] * w0 + mesh.positions[s1] * w1 + mesh.positions[s2] * w2;
+                        glm::vec3 normal = mesh.normals[s0] * w0 + mesh.normals[s1] * w1 + mesh.normals[s2] * w2;
+                        float length = glm::length(normal);
+                        normals[texel] = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+                        covered[texel] = 1;
+                    }
+                }
+            }
+        }
+
+        std::vector<glm::vec4> texels(texelCount, glm::vec4(0.0f));
+        threadPool.parallelFor(height, [&](int y) {
+            for (int x = 0; x < width; x++) {
+                size_t texel = (size_t)y * width + x;
+                if (!covered[texel]) {
+                    continue;
+                }
+                glm::vec3 irradiance = bakeDirectLight(scene, settings, positions[texel], normals[texel]);
+                float occlusion = bakeOcclusion(scene, positions[texel] + normals[texel] * RAY_OFFSET, normals[texel],
+                    settings.aoSamples, settings.aoDistance, hashTexel((unsigned int)x, (unsigned int)y));
+                texels[texel] = glm::vec4(irradiance, occlusion);
+            }
+        });
+
+        // grows the charts into their padding, bilinear taps at chart edges read baked values
+        std::vector<char> grown;
+        for (int pass = 0; pass < DILATION_PASSES; pass++) {
+            grown = covered;
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    size_t texel = (size_t)y * width + x;
+                    if (covered[texel]) {
+                        continue;
+                    }
+                    glm::vec4 sum(0.0f);
+                    int count = 0;
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            int nx = x + dx, ny = y + dy;
+                            if (nx < 0 || ny < 0 || nx >= width || ny >= height) {
+                                continue;
+                            }
+                            size_t neighbour = (size_t)ny * width + nx;
+                            if (covered[neighbour]) {
+                                sum += texels[neighbour];
+                                count++;
+                            }
+                        }
+                    }
+                    if (count > 0) {
+                        texels[texel] = sum / (float)count;
+                        grown[texel] = 1;
+                    }
+                }
+            }
+            covered.swap(grown);
+        }
+        return texels;
+    }
+
+    bool saveLightmap(const std::string& path, const LightmapUnwrap& unwrap, const std::vector<glm::vec4>& texels) {
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        LightmapHeader header;
+        std::memcpy(header.magic, LIGHTMAP_MAGIC, sizeof(header.magic));
+        header.version = LIGHTMAP_VERSION;
+        header.width = unwrap.width;
+        header.height = unwrap.height;
+        header.unwrapHash = unwrap.hash;
+
+        std::vector<unsigned short> halves(texels.size() * 4);
+        for (size_t i = 0; i < texels.size(); i++) {
+            for (int channel = 0; channel < 4; channel++) {
+                halves[4 * i + channel] = floatToHalf(texels[i][channel]);
+            }
+        }
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(halves.data(), sizeof(unsigned short), halves.size(), file) == halves.size();
+        fclose(file);
+        return written;
+    }
+
+    GLuint loadLightmap(const std::string& path, const LightmapUnwrap& unwrap) {
+
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) {
+            return 0;
+        }
+        LightmapHeader header;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1
+            && std::memcmp(header.magic, LIGHTMAP_MAGIC, sizeof(header.magic)) == 0
+            && header.version == LIGHTMAP_VERSION
+            && header.width == unwrap.width && header.height == unwrap.height
+            && header.unwrapHash == unwrap.hash;
+        std::vector<unsigned short> halves;
+        if (valid) {
+            halves.resize((size_t)header.width * header.height * 4);
+            valid = fread(halves.data(), sizeof(unsigned short), halves.size(), file) == halves.size();
+        }
+        fclose(file);
+        if (!valid || halves.empty()) {
+            return 0;
+        }
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, header.width, header.height, 0, GL_RGBA, GL_HALF_FLOAT, halves.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+}
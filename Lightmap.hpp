@@ -0,0 +1,82 @@
+#ifndef Lightmap_hpp
+#define Lightmap_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "LightManager.hpp"
+#include "RayTracer.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Geometry of one mesh in world space, the input of the unwrap and of the bakes
+    struct BakeMesh {
+
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> normals;
+        std::vector<GLuint> indices;
+    };
+
+    // Lightmap UV set of a model. The triangles of every mesh are grouped into charts of
+    // connected triangles facing the same axis, box projected and shelf packed into one
+    // atlas. Vertices shared by several charts are split
+    struct LightmapUnwrap {
+
+        int width;
+        int height;
+        // per mesh: source vertex of every unwrapped vertex, its lightmap coordinates in
+        // [0, 1] and the triangles indexing the unwrapped vertices
+        std::vector<std::vector<GLuint> > sourceVertices;
+        std::vector<std::vector<glm::vec2> > coords;
+        std::vector<std::vector<GLuint> > indices;
+        int chartCount;
+        // hash of the positions, the triangles and the texel density the UVs came from
+        unsigned long long hash;
+    };
+
+    // Unwraps the meshes at texelsPerUnit, lowered until the atlas fits in maxSize. The
+    // result only depends on the input, so the runtime can rebuild the UVs a bake used
+    LightmapUnwrap unwrapLightmap(const std::vector<BakeMesh>& meshes, float texelsPerUnit, int maxSize);
+
+    // Static lighting of the baked texels
+    struct BakeSettings {
+
+        // direction toward the moon and its color
+        glm::vec3 moonDirection;
+        glm::vec3 moonColor;
+        // lights the bake includes, with their radius
+        std::vector<PointLight> lights;
+        int aoSamples;
+        float aoDistance;
+    };
+
+    // Rasterizes the meshes into the atlas and ray casts each texel: diffuse moon and
+    // point light irradiance with shadows (rgb) and ambient occlusion (a). Rows are spread
+    // over the thread pool. Texels no triangle covers are filled from their neighbours
+    std::vector<glm::vec4> bakeLightmap(const LightmapUnwrap& unwrap, const std::vector<BakeMesh>& meshes,
+                                        const RayTracer& scene, const BakeSettings& settings, ThreadPool& threadPool);
+
+    // Irradiance reaching a point with the given normal from the moon and the point lights,
+    // shadows included
+    glm::vec3 bakeDirectLight(const RayTracer& scene, const BakeSettings& settings, glm::vec3 position, glm::vec3 normal);
+
+    // Lightmap files: a small header with the unwrap's size and hash, and the texels as half floats
+    bool saveLightmap(const std::string& path, const LightmapUnwrap& unwrap, const std::vector<glm::vec4>& texels);
+
+    // Loads a lightmap into a new RGBA16F texture, 0 when the file is missing or was baked
+    // for another unwrap (the geometry changed since the bake)
+    GLuint loadLightmap(const std::string& path, const LightmapUnwrap& unwrap);
+}
+
+#endif /* Lightmap_hpp */
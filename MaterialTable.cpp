@@ -0,0 +1,119 @@
+#include "MaterialTable.hpp"
+
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+namespace gps {
+
+    namespace {
+        bool sameColors(const Material& a, const Material& b) {
+            return a.ambient == b.ambient && a.diffuse == b.diffuse && a.specular == b.specular;
+        }
+    }
+
+    MaterialTable::MaterialTable() : buffer(0), texture(0), addedCount(0) {
+    }
+
+    unsigned long long MaterialTable::hashColors(const Material& material) {
+
+        // + 0.0f so -0 and 0, which compare equal, also hash the same
+        float values[9] = {
+            material.ambient.x + 0.0f, material.ambient.y + 0.0f, material.ambient.z + 0.0f,
+            material.diffuse.x + 0.0f, material.diffuse.y + 0.0f, material.diffuse.z + 0.0f,
+            material.specular.x + 0.0f, material.specular.y + 0.0f, material.specular.z + 0.0f
+        };
+        std::string bytes(sizeof(values), '\0');
+        std::memcpy(&bytes[0], values, sizeof(values));
+        return Shader::hashString(bytes);
+    }
+
+    unsigned long long MaterialTable::hashTextures(const std::vector<Texture>& textures) {
+
+        if (textures.empty()) {
+            return 0;
+        }
+        // the .obj loader adds them in a fixed order of types
+        unsigned long long hash = Shader::HASH_SEED;
+        for (size_t i = 0; i < textures.size(); i++) {
+            hash = Shader::hashString(textures[i].type, hash);
+            std::string content(sizeof(textures[i].contentHash), '\0');
+            std::memcpy(&content[0], &textures[i].contentHash, sizeof(textures[i].contentHash));
+            hash = Shader::hashString(content, hash);
+        }
+        return hash;
+    }
+
+    int MaterialTable::add(const Material& material, const std::vector<Texture>& textures) {
+
+        addedCount++;
+        unsigned long long textureKey = hashTextures(textures);
+        unsigned long long hash = Shader::hashString(std::string((const char*)&textureKey, sizeof(textureKey)), hashColors(material));
+        typedef std::unordered_multimap<unsigned long long, int>::iterator Iterator;
+        std::pair<Iterator, Iterator> range = entriesOfHash.equal_range(hash);
+        for (Iterator it = range.first; it != range.second; ++it) {
+            if (textureKeys[it->second] == textureKey && sameColors(materials[it->second], material)) {
+                return it->second;
+            }
+        }
+
+        materials.push_back(material);
+        textureKeys.push_back(textureKey);
+        entriesOfHash.insert(std::make_pair(hash, (int)materials.size() - 1));
+        return (int)materials.size() - 1;
+    }
+
+    void MaterialTable::upload() {
+
+        std::vector<glm::vec4> texels;
+        texels.reserve(materials.size() * TEXELS_PER_MATERIAL);
+        for (size_t i = 0; i < materials.size(); i++) {
+            texels.push_back(glm::vec4(materials[i].ambient, 0.0f));
+            texels.push_back(glm::vec4(materials[i].diffuse, 0.0f));
+            texels.push_back(glm::vec4(materials[i].specular, 0.0f));
+        }
+        if (texels.empty()) {
+            texels.push_back(glm::vec4(0.0f));
+        }
+
+        if (buffer == 0) {
+            glGenBuffers(1, &buffer);
+            glGenTextures(1, &texture);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(glm::vec4), &texels[0], GL_STATIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void MaterialTable::bind(gps::Shader shader, int textureUnit) {
+
+        glActiveTexture(GL_TEXTURE0 + textureUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "materials"), textureUnit);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    const Material& MaterialTable::getMaterial(int index) {
+
+        return materials[index];
+    }
+
+    int MaterialTable::getCount() {
+
+        return (int)materials.size();
+    }
+
+    int MaterialTable::getAddedCount() {
+
+        return addedCount;
+    }
+
+    int MaterialTable::getTextureSetCount() {
+
+        std::unordered_set<unsigned long long> textureSets(textureKeys.begin(), textureKeys.end());
+        return (int)textureSets.size();
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef MaterialTable_hpp
+#define MaterialTable_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "Mesh.hpp"
+#include "Shader.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // The distinct materials of every loaded model, their colors in one texture buffer.
+    // Materials with the same colors and the same texture contents share an entry whatever
+    // their names or files, and a draw only passes its entry's index (a constant vertex
+    // attribute) instead of setting the colors as uniforms, so switching materials no
+    // longer changes program state
+    class MaterialTable {
+
+    public:
+        // texels per material: ambient, diffuse and specular, w unused
+        static const int TEXELS_PER_MATERIAL = 3;
+
+        MaterialTable();
+
+        // Index of the entry with material's colors and textures of the same contents
+        // (see Texture::contentHash) and types, added when there is none yet
+        int add(const Material& material, const std::vector<Texture>& textures);
+
+        // Copies the entries into the texture buffer, after the last add
+        void upload();
+
+        // Binds the texture buffer to textureUnit as "materials", the shader must be in use
+        void bind(gps::Shader shader, int textureUnit);
+
+        const Material& getMaterial(int index);
+        int getCount();
+        // calls to add, merged or not
+        int getAddedCount();
+        // distinct sets of textures among the entries, the draws of one set only differ
+        // by their entry and could be merged
+        int getTextureSetCount();
+
+    private:
+        GLuint buffer;
+        GLuint texture;
+
+        std::vector<Material> materials;
+        // hash of the types and contents of each entry's textures, 0 without textures
+        std::vector<unsigned long long> textureKeys;
+        // hash of the colors and textures to the entries with that hash
+        std::unordered_multimap<unsigned long long, int> entriesOfHash;
+        int addedCount;
+
+        static unsigned long long hashColors(const Material& material);
+        static unsigned long long hashTextures(const std::vector<Texture>& textures);
+    };
+}
+
+#endif /* MaterialTable_hpp */
@@ -1,4 +1,9 @@
 #include "Mesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
 namespace gps {
 
 	/* Mesh Constructor */
@@ -7,6 +12,20 @@ namespace gps {
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		// light gray when the .obj has no material
+		this->material.ambient = glm::vec3(0.0f);
+		this->material.diffuse = glm::vec3(0.8f);
+		this->material.specular = glm::vec3(0.0f);
+		this->materialId = -1;
+		this->shadowBuffers.VAO = this->shadowBuffers.VBO = this->shadowBuffers.EBO = 0;
+		this->shadowIndexCount = 0;
+		this->shadowless = false;
+		this->lightmapBuffers.VAO = this->lightmapBuffers.VBO = this->lightmapBuffers.EBO = 0;
+		this->lightmapIndexCount = 0;
+
+		for (size_t i = 0; i < this->vertices.size(); i++) {
+			this->bounds.extend(this->vertices[i].Position);
+		}
 
 		this->setupMesh();
 	}
@@ -15,11 +34,34 @@ namespace gps {
 	    return this->buffers;
 	}
 
+	Buffers Mesh::getDepthBuffers() {
+	    return this->depthBuffers;
+	}
+
+	Buffers Mesh::getShadowBuffers() {
+	    return this->shadowBuffers;
+	}
+
+	Buffers Mesh::getLightmapBuffers() {
+	    return this->lightmapBuffers;
+	}
+
 	/* Mesh drawing function - also applies associated textures */
 	void Mesh::Draw(gps::Shader shader)	{
 
 		shader.useShaderProgram();
 
+		this->bindTextures(shader);
+
+		glBindVertexArray(this->buffers.VAO);
+		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+
+		this->unbindTextures();
+    }
+
+	void Mesh::bindTextures(gps::Shader shader) {
+
 		//set textures
 		for (GLuint i = 0; i < textures.size(); i++) {
 
@@ -27,18 +69,219 @@ namespace gps {
 			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
 			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
 		}
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+	void Mesh::unbindTextures() {
 
         for(GLuint i = 0; i < this->textures.size(); i++) {
 
             glActiveTexture(GL_TEXTURE0 + i);
             glBindTexture(GL_TEXTURE_2D, 0);
         }
+	}
 
-    }
+	void Mesh::setLightmapUVs(const std::vector<GLuint>& sourceVertices, const std::vector<glm::vec2>& coords,
+	                          const std::vector<GLuint>& lightmapIndices) {
+
+		if (lightmapIndices.empty()) {
+			return;
+		}
+
+		std::vector<LightmapVertex> lightmapVertices(sourceVertices.size());
+		for (size_t i = 0; i < sourceVertices.size(); i++) {
+			const Vertex& source = this->vertices[sourceVertices[i]];
+			lightmapVertices[i].Position = source.Position;
+			lightmapVertices[i].Normal = source.Normal;
+			lightmapVertices[i].TexCoords = source.TexCoords;
+			lightmapVertices[i].LightmapCoords = coords[i];
+		}
+
+		if (this->lightmapBuffers.VAO == 0) {
+			glGenVertexArrays(1, &this->lightmapBuffers.VAO);
+			glGenBuffers(1, &this->lightmapBuffers.VBO);
+			glGenBuffers(1, &this->lightmapBuffers.EBO);
+		}
+
+		glBindVertexArray(this->lightmapBuffers.VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->lightmapBuffers.VBO);
+		glBufferData(GL_ARRAY_BUFFER, lightmapVertices.size() * sizeof(LightmapVertex), &lightmapVertices[0], GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->lightmapBuffers.EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, lightmapIndices.size() * sizeof(GLuint), &lightmapIndices[0], GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(LightmapVertex), (GLvoid*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(LightmapVertex), (GLvoid*)offsetof(LightmapVertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(LightmapVertex), (GLvoid*)offsetof(LightmapVertex, TexCoords));
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(LightmapVertex), (GLvoid*)offsetof(LightmapVertex, LightmapCoords));
+
+		glBindVertexArray(0);
+		this->lightmapIndexCount = lightmapIndices.size();
+	}
+
+	bool Mesh::hasLightmapUVs() {
+
+		return this->lightmapIndexCount > 0;
+	}
+
+	void Mesh::DrawLightmapped(gps::Shader shader) {
+
+		if (!this->hasLightmapUVs()) {
+			this->Draw(shader);
+			return;
+		}
+
+		shader.useShaderProgram();
+
+		this->bindTextures(shader);
+
+		glBindVertexArray(this->lightmapBuffers.VAO);
+		glDrawElements(GL_TRIANGLES, (GLsizei)this->lightmapIndexCount, GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+
+		this->unbindTextures();
+	}
+
+	void Mesh::DrawDepth(gps::Shader shader) {
+
+		shader.useShaderProgram();
+
+		glBindVertexArray(this->depthBuffers.VAO);
+		glDrawElements(GL_TRIANGLES, (GLsizei)this->positionIndices.size(), GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+	}
+
+	void Mesh::setShadowProxy(const ShadowProxy& proxy) {
+
+		this->shadowless = proxy.indices.empty();
+		if (this->shadowless) {
+			this->shadowIndexCount = 0;
+			return;
+		}
+
+		if (this->shadowBuffers.VAO == 0) {
+			glGenVertexArrays(1, &this->shadowBuffers.VAO);
+			glGenBuffers(1, &this->shadowBuffers.VBO);
+			glGenBuffers(1, &this->shadowBuffers.EBO);
+		}
+
+		glBindVertexArray(this->shadowBuffers.VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->shadowBuffers.VBO);
+		glBufferData(GL_ARRAY_BUFFER, proxy.positions.size() * sizeof(glm::vec3), &proxy.positions[0], GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->shadowBuffers.EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, proxy.indices.size() * sizeof(GLuint), &proxy.indices[0], GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+
+		glBindVertexArray(0);
+		this->shadowIndexCount = proxy.indices.size();
+	}
+
+	bool Mesh::hasShadowProxy() {
+
+		return this->shadowIndexCount > 0;
+	}
+
+	bool Mesh::castsShadow() {
+
+		return !this->shadowless;
+	}
+
+	void Mesh::DrawShadow(gps::Shader shader) {
+
+		if (this->shadowless) {
+			return;
+		}
+		if (!this->hasShadowProxy()) {
+			this->DrawDepth(shader);
+			return;
+		}
+
+		shader.useShaderProgram();
+
+		glBindVertexArray(this->shadowBuffers.VAO);
+		glDrawElements(GL_TRIANGLES, (GLsizei)this->shadowIndexCount, GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+	}
+
+	size_t Mesh::getShadowTriangleCount() {
+
+		if (this->shadowless) {
+			return 0;
+		}
+		return (this->hasShadowProxy() ? this->shadowIndexCount : this->positionIndices.size()) / 3;
+	}
+
+	std::vector<float> Mesh::computeTriangleOpacity() {
+
+		std::vector<float> opacity;
+
+		const Texture* diffuse = NULL;
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			if (this->textures[i].type == "diffuseTexture" && !this->textures[i].alphaCoverage.empty()) {
+				diffuse = &this->textures[i];
+			}
+		}
+		if (diffuse == NULL) {
+			return opacity;
+		}
+
+		// coverage at the corners and the center of each triangle, the texture repeats
+		const int size = Texture::ALPHA_COVERAGE_SIZE;
+		opacity.resize(this->indices.size() / 3);
+		for (size_t t = 0; t < opacity.size(); t++) {
+			glm::vec2 uv[4];
+			uv[3] = glm::vec2(0.0f);
+			for (int v = 0; v < 3; v++) {
+				uv[v] = this->vertices[this->indices[3 * t + v]].TexCoords;
+				uv[3] += uv[v] / 3.0f;
+			}
+
+			float sum = 0.0f;
+			for (int i = 0; i < 4; i++) {
+				int x = (int)((uv[i].x - std::floor(uv[i].x)) * size) % size;
+				int y = (int)((uv[i].y - std::floor(uv[i].y)) * size) % size;
+				sum += diffuse->alphaCoverage[y * size + x] / 255.0f;
+			}
+			opacity[t] = sum / 4.0f;
+		}
+
+		return opacity;
+	}
+
+	void Mesh::buildPositionStream() {
+
+		// sorting the vertices by position puts the copies of a position next to each other
+		std::vector<GLuint> order(this->vertices.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [this](GLuint a, GLuint b) {
+			const glm::vec3& pa = this->vertices[a].Position;
+			const glm::vec3& pb = this->vertices[b].Position;
+			if (pa.x != pb.x) return pa.x < pb.x;
+			if (pa.y != pb.y) return pa.y < pb.y;
+			return pa.z < pb.z;
+		});
+
+		std::vector<GLuint> remap(this->vertices.size());
+		this->positions.clear();
+		for (size_t i = 0; i < order.size(); i++) {
+			const glm::vec3& position = this->vertices[order[i]].Position;
+			if (this->positions.empty() || this->positions.back() != position) {
+				this->positions.push_back(position);
+			}
+			remap[order[i]] = (GLuint)this->positions.size() - 1;
+		}
+
+		this->positionIndices.resize(this->indices.size());
+		for (size_t i = 0; i < this->indices.size(); i++) {
+			this->positionIndices[i] = remap[this->indices[i]];
+		}
+	}
 
 	// Initializes all the buffer objects/arrays
 	void Mesh::setupMesh() {
@@ -68,5 +311,24 @@ namespace gps {
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
 
 		glBindVertexArray(0);
+
+		// tightly packed positions for the depth passes, 12 bytes per vertex instead of 32
+		this->buildPositionStream();
+
+		glGenVertexArrays(1, &this->depthBuffers.VAO);
+		glGenBuffers(1, &this->depthBuffers.VBO);
+		glGenBuffers(1, &this->depthBuffers.EBO);
+
+		glBindVertexArray(this->depthBuffers.VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->depthBuffers.VBO);
+		glBufferData(GL_ARRAY_BUFFER, this->positions.size() * sizeof(glm::vec3), &this->positions[0], GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->depthBuffers.EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->positionIndices.size() * sizeof(GLuint), &this->positionIndices[0], GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+
+		glBindVertexArray(0);
 	}
 }
@@ -12,6 +12,8 @@
 #include <glm/glm.hpp>
 
 #include "Shader.hpp"
+#include "Bounds.hpp"
+#include "ShadowProxy.hpp"
 
 #include <string>
 #include <vector>
@@ -26,12 +28,27 @@ namespace gps {
         glm::vec2 TexCoords;
     };
 
+    // Vertex of the lightmapped copy of a mesh, charts split some of the source vertices
+    struct LightmapVertex {
+
+        glm::vec3 Position;
+        glm::vec3 Normal;
+        glm::vec2 TexCoords;
+        glm::vec2 LightmapCoords;
+    };
+
     struct Texture {
 
         GLuint id;
         //ambientTexture, diffuseTexture, specularTexture
         std::string type;
         std::string path;
+        // hash of the image file's bytes, copies of one image under other names share it
+        unsigned long long contentHash;
+        // average alpha of the image over an ALPHA_COVERAGE_SIZE grid, empty when it is opaque
+        std::vector<unsigned char> alphaCoverage;
+
+        static const int ALPHA_COVERAGE_SIZE = 32;
     };
 
     struct Material {
@@ -53,20 +70,72 @@ namespace gps {
         std::vector<Vertex> vertices;
         std::vector<GLuint> indices;
         std::vector<Texture> textures;
+        // colors of the .mtl material, the untextured shader variants use the diffuse one
+        Material material;
+        // entry of the scene's material table, -1 until the materials are merged
+        int materialId;
+        // object space bounds of the vertices
+        AABB bounds;
+        // name of the shape in the .obj file
+        std::string name;
+        // position only copy of the mesh for the depth passes, vertices that only differ
+        // by normal or texture coordinates are merged
+        std::vector<glm::vec3> positions;
+        std::vector<GLuint> positionIndices;
 
 	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
 
 	    Buffers getBuffers();
+	    Buffers getDepthBuffers();
+	    Buffers getShadowBuffers();
+	    Buffers getLightmapBuffers();
 
 	    void Draw(gps::Shader shader);
 
+	    // Draws the position only stream, for shaders that only read vPosition
+	    void DrawDepth(gps::Shader shader);
+
+	    // Replaces the geometry drawn by DrawShadow, an empty proxy means the mesh casts nothing
+	    void setShadowProxy(const ShadowProxy& proxy);
+	    bool hasShadowProxy();
+	    bool castsShadow();
+
+	    // Draws the shadow proxy, or the position only stream when there is none
+	    void DrawShadow(gps::Shader shader);
+	    size_t getShadowTriangleCount();
+
+	    // Uploads the lightmap unwrap of the mesh: the source vertex of every new vertex,
+	    // its lightmap coordinates and the triangles over the new vertices
+	    void setLightmapUVs(const std::vector<GLuint>& sourceVertices, const std::vector<glm::vec2>& coords,
+	                        const std::vector<GLuint>& lightmapIndices);
+	    bool hasLightmapUVs();
+
+	    // Draws the lightmapped copy with the textures of Draw, lightmap coordinates at location 3
+	    void DrawLightmapped(gps::Shader shader);
+
+	    // Average alpha of the diffuse texture under each triangle, empty when the mesh is opaque
+	    std::vector<float> computeTriangleOpacity();
+
     private:
         /*  Render data  */
         Buffers buffers;
+        Buffers depthBuffers;
+        Buffers shadowBuffers;
+        size_t shadowIndexCount;
+        // the proxy came out empty, every triangle was too transparent to cast
+        bool shadowless;
+        Buffers lightmapBuffers;
+        size_t lightmapIndexCount;
+
+	    void bindTextures(gps::Shader shader);
+	    void unbindTextures();
 
 	    // Initializes all the buffer objects/arrays
 	    void setupMesh();
 
+	    // Fills positions and positionIndices from the full vertices
+	    void buildPositionStream();
+
     };
 
 }
@@ -1,16 +1,41 @@
 #include "Model3D.hpp"
 
+#include <fstream>
+#include <sstream>
+
 namespace gps {
 
+	namespace {
+		// proxies that keep more than this fraction of the triangles aren't worth a draw path
+		const float MAX_PROXY_TRIANGLE_RATIO = 0.75f;
+		// foliage triangles under this average alpha cast no shadow
+		const float MIN_FOLIAGE_OPACITY = 0.5f;
+	}
+
+	int Model3D::textureFileCount = 0;
+	int Model3D::uniqueTextureCount = 0;
+
+	Model3D::Model3D() : materialCount(0) {
+	}
+
+	std::unordered_map<unsigned long long, Model3D::SharedTexture>& Model3D::getSharedTextures() {
+
+		static std::unordered_map<unsigned long long, SharedTexture>* sharedTextures =
+			new std::unordered_map<unsigned long long, SharedTexture>();
+		return *sharedTextures;
+	}
+
 	void Model3D::LoadModel(std::string fileName) {
 
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
 		ReadOBJ(fileName, basePath);
+		ReadShadowOverride(fileName, basePath);
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)	{
 
 		ReadOBJ(fileName, basePath);
+		ReadShadowOverride(fileName, basePath);
 	}
 
 	// Draw each mesh from the model
@@ -20,6 +45,115 @@ namespace gps {
 			meshes[i].Draw(shaderProgram);
 	}
 
+	void Model3D::DrawMesh(gps::Shader shaderProgram, int meshIndex) {
+
+		meshes[meshIndex].Draw(shaderProgram);
+	}
+
+	void Model3D::DrawMeshLightmapped(gps::Shader shaderProgram, int meshIndex) {
+
+		meshes[meshIndex].DrawLightmapped(shaderProgram);
+	}
+
+	void Model3D::DrawMeshDepth(gps::Shader shaderProgram, int meshIndex) {
+
+		meshes[meshIndex].DrawDepth(shaderProgram);
+	}
+
+	void Model3D::DrawMeshShadow(gps::Shader shaderProgram, int meshIndex) {
+
+		meshes[meshIndex].DrawShadow(shaderProgram);
+	}
+
+	void Model3D::BuildShadowProxies(float cellSize, float foliageCellSize) {
+
+		// the override is drawn instead of every mesh
+		if (hasShadowOverride()) {
+			return;
+		}
+
+		for (size_t i = 0; i < meshes.size(); i++) {
+
+			std::vector<float> opacity = meshes[i].computeTriangleOpacity();
+			bool foliage = !opacity.empty();
+
+			ShadowProxy proxy = simplifyForShadow(meshes[i].positions, meshes[i].positionIndices,
+				foliage ? foliageCellSize : cellSize, opacity, MIN_FOLIAGE_OPACITY);
+
+			// foliage always takes its proxy, the transparent triangles must go, and when
+			// none is left the mesh casts nothing
+			if (foliage || proxy.indices.size() < MAX_PROXY_TRIANGLE_RATIO * meshes[i].positionIndices.size()) {
+				meshes[i].setShadowProxy(proxy);
+			}
+		}
+	}
+
+	bool Model3D::hasShadowOverride() {
+
+		return !shadowMeshes.empty();
+	}
+
+	void Model3D::DrawShadowOverride(gps::Shader shaderProgram) {
+
+		for (size_t i = 0; i < shadowMeshes.size(); i++) {
+			shadowMeshes[i].DrawDepth(shaderProgram);
+		}
+	}
+
+	size_t Model3D::getShadowOverrideTriangleCount() {
+
+		size_t count = 0;
+		for (size_t i = 0; i < shadowMeshes.size(); i++) {
+			count += shadowMeshes[i].positionIndices.size() / 3;
+		}
+		return count;
+	}
+
+	void Model3D::ReadShadowOverride(std::string fileName, std::string basePath) {
+
+		std::string overrideName = fileName.substr(0, fileName.find_last_of('.')) + "_shadow.obj";
+		if (!std::ifstream(overrideName.c_str()).good()) {
+			return;
+		}
+
+		// ReadOBJ fills meshes, the model's own meshes are set aside meanwhile
+		std::vector<gps::Mesh> modelMeshes;
+		modelMeshes.swap(meshes);
+		ReadOBJ(overrideName, basePath);
+		shadowMeshes.insert(shadowMeshes.end(), meshes.begin(), meshes.end());
+		meshes.swap(modelMeshes);
+	}
+
+	int Model3D::getMeshCount() {
+
+		return (int)meshes.size();
+	}
+
+	AABB Model3D::getMeshBounds(int meshIndex) {
+
+		return meshes[meshIndex].bounds;
+	}
+
+	gps::Mesh& Model3D::getMesh(int meshIndex) {
+
+		return meshes[meshIndex];
+	}
+
+	int Model3D::getMaterialCount() {
+
+		return materialCount;
+	}
+
+	int Model3D::getTextureFileCount() {
+
+		return textureFileCount;
+	}
+
+	int Model3D::getUniqueTextureCount() {
+
+		return uniqueTextureCount;
+	}
+
 	// Does the parsing of the .obj file and fills in the data structure
 	void Model3D::ReadOBJ(std::string fileName, std::string basePath) {
 
@@ -45,6 +179,7 @@ namespace gps {
 
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
+		materialCount += (int)materials.size();
 
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
@@ -52,6 +187,8 @@ namespace gps {
 			std::vector<gps::Vertex> vertices;
 			std::vector<GLuint> indices;
 			std::vector<gps::Texture> textures;
+			bool hasMaterial = false;
+			gps::Material currentMaterial;
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
@@ -109,7 +246,7 @@ namespace gps {
 				materialId = shapes[s].mesh.material_ids[0];
 				if (materialId != -1) {
 
-					gps::Material currentMaterial;
+					hasMaterial = true;
 					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
 					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
 					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
@@ -147,6 +284,10 @@ namespace gps {
 			}
 
 			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			meshes.back().name = shapes[s].name;
+			if (hasMaterial) {
+				meshes.back().material = currentMaterial;
+			}
 		}
 	}
 
@@ -157,15 +298,37 @@ namespace gps {
 
 				if (loadedTextures[i].path == path)	{
 
-					//already loaded texture
-					return loadedTextures[i];
+					//already loaded texture, the same file may be used as another type
+					gps::Texture loadedTexture = loadedTextures[i];
+					loadedTexture.type = type;
+					return loadedTexture;
 				}
 			}
 
+			std::ifstream file(path.c_str(), std::ios::binary);
+			std::stringstream fileData;
+			fileData << file.rdbuf();
+			std::string bytes = fileData.str();
+			textureFileCount++;
+
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
+			currentTexture.contentHash = Shader::hashString(bytes);
+
+			// a copy of an image some model already loaded, under another name
+			std::unordered_map<unsigned long long, SharedTexture>& sharedTextures = getSharedTextures();
+			std::unordered_map<unsigned long long, SharedTexture>::iterator shared = sharedTextures.find(currentTexture.contentHash);
+			if (shared == sharedTextures.end()) {
+				SharedTexture sharedTexture;
+				sharedTexture.id = ReadTextureFromFile(path.c_str(), bytes, sharedTexture.alphaCoverage);
+				sharedTexture.references = 0;
+				shared = sharedTextures.insert(std::make_pair(currentTexture.contentHash, sharedTexture)).first;
+				uniqueTextureCount++;
+			}
+			shared->second.references++;
+			currentTexture.id = shared->second.id;
+			currentTexture.alphaCoverage = shared->second.alphaCoverage;
 
 			loadedTextures.push_back(currentTexture);
 
@@ -173,11 +336,11 @@ namespace gps {
 		}
 
 	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+	GLuint Model3D::ReadTextureFromFile(const char* file_name, const std::string& fileData, std::vector<unsigned char>& alphaCoverage) {
 
 		int x, y, n;
 		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
+		unsigned char* image_data = stbi_load_from_memory((const stbi_uc*)fileData.data(), (int)fileData.size(), &x, &y, &n, force_channels);
 
 		if (!image_data) {
 			fprintf(stderr, "ERROR: could not load %s\n", file_name);
@@ -211,6 +374,31 @@ namespace gps {
 			}
 		}
 
+		// average alpha per cell, kept only for images with transparent pixels
+		bool transparent = false;
+		for (int i = 3; i < x * y * 4 && !transparent; i += 4) {
+			transparent = image_data[i] < 255;
+		}
+		alphaCoverage.clear();
+		if (transparent) {
+			const int size = gps::Texture::ALPHA_COVERAGE_SIZE;
+			std::vector<unsigned int> sums(size * size, 0);
+			std::vector<unsigned int> counts(size * size, 0);
+			for (int row = 0; row < y; row++) {
+				for (int col = 0; col < x; col++) {
+					int cell = (row * size / y) * size + col * size / x;
+					sums[cell] += image_data[(row * x + col) * 4 + 3];
+					counts[cell]++;
+				}
+			}
+			alphaCoverage.resize(size * size, 255);
+			for (int cell = 0; cell < size * size; cell++) {
+				if (counts[cell] > 0) {
+					alphaCoverage[cell] = (unsigned char)(sums[cell] / counts[cell]);
+				}
+			}
+		}
+
 		GLuint textureID;
 		glGenTextures(1, &textureID);
 		glBindTexture(GL_TEXTURE_2D, textureID);
@@ -238,9 +426,14 @@ namespace gps {
 
 	Model3D::~Model3D() {
 
+        std::unordered_map<unsigned long long, SharedTexture>& sharedTextures = getSharedTextures();
         for (size_t i = 0; i < loadedTextures.size(); i++) {
 
-            glDeleteTextures(1, &loadedTextures.at(i).id);
+            std::unordered_map<unsigned long long, SharedTexture>::iterator shared = sharedTextures.find(loadedTextures.at(i).contentHash);
+            if (shared != sharedTextures.end() && --shared->second.references == 0) {
+                glDeleteTextures(1, &shared->second.id);
+                sharedTextures.erase(shared);
+            }
         }
 
         for (size_t i = 0; i < meshes.size(); i++) {
@@ -251,6 +444,34 @@ namespace gps {
             glDeleteBuffers(1, &VBO);
             glDeleteBuffers(1, &EBO);
             glDeleteVertexArrays(1, &VAO);
+
+            Buffers depthBuffers = meshes.at(i).getDepthBuffers();
+            glDeleteBuffers(1, &depthBuffers.VBO);
+            glDeleteBuffers(1, &depthBuffers.EBO);
+            glDeleteVertexArrays(1, &depthBuffers.VAO);
+
+            Buffers shadowBuffers = meshes.at(i).getShadowBuffers();
+            glDeleteBuffers(1, &shadowBuffers.VBO);
+            glDeleteBuffers(1, &shadowBuffers.EBO);
+            glDeleteVertexArrays(1, &shadowBuffers.VAO);
+
+            Buffers lightmapBuffers = meshes.at(i).getLightmapBuffers();
+            glDeleteBuffers(1, &lightmapBuffers.VBO);
+            glDeleteBuffers(1, &lightmapBuffers.EBO);
+            glDeleteVertexArrays(1, &lightmapBuffers.VAO);
+        }
+
+        for (size_t i = 0; i < shadowMeshes.size(); i++) {
+
+            Buffers buffers = shadowMeshes.at(i).getBuffers();
+            glDeleteBuffers(1, &buffers.VBO);
+            glDeleteBuffers(1, &buffers.EBO);
+            glDeleteVertexArrays(1, &buffers.VAO);
+
+            Buffers depthBuffers = shadowMeshes.at(i).getDepthBuffers();
+            glDeleteBuffers(1, &depthBuffers.VBO);
+            glDeleteBuffers(1, &depthBuffers.EBO);
+            glDeleteVertexArrays(1, &depthBuffers.VAO);
         }
 	}
 }
@@ -8,6 +8,7 @@
 
 #include <iostream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace gps {
@@ -15,6 +16,7 @@ namespace gps {
     class Model3D {
 
     public:
+        Model3D();
         ~Model3D();
 
 		void LoadModel(std::string fileName);
@@ -23,20 +25,80 @@ namespace gps {
 
 		void Draw(gps::Shader shaderProgram);
 
+		// Draws a single component mesh, used when meshes are culled individually
+		void DrawMesh(gps::Shader shaderProgram, int meshIndex);
+
+		// Draws the lightmapped copy of a component mesh, the mesh itself when it has no lightmap UVs
+		void DrawMeshLightmapped(gps::Shader shaderProgram, int meshIndex);
+
+		// Draws the position only stream of a component mesh, for the depth passes
+		void DrawMeshDepth(gps::Shader shaderProgram, int meshIndex);
+
+		// Draws what a component mesh casts into the shadow map, its proxy when it has one
+		void DrawMeshShadow(gps::Shader shaderProgram, int meshIndex);
+
+		// Generates a proxy for every mesh the clustering simplifies enough. cellSize is in
+		// object space, meshes with transparent diffuse textures use foliageCellSize and
+		// lose their mostly transparent triangles. Nothing is built for a model with a
+		// *_shadow.obj override
+		void BuildShadowProxies(float cellSize, float foliageCellSize);
+
+		// Meshes of the *_shadow.obj file found next to the model, drawn by the shadow passes
+		// instead of every component mesh
+		bool hasShadowOverride();
+		void DrawShadowOverride(gps::Shader shaderProgram);
+		size_t getShadowOverrideTriangleCount();
+
+		int getMeshCount();
+
+		// Object space bounds of a component mesh
+		AABB getMeshBounds(int meshIndex);
+
+		gps::Mesh& getMesh(int meshIndex);
+
+		// Materials declared by the model's .mtl file
+		int getMaterialCount();
+
+		// Image files read by every model, and the distinct images among them: files with
+		// the same bytes share one texture across all the models
+		static int getTextureFileCount();
+		static int getUniqueTextureCount();
+
     private:
+		struct SharedTexture {
+			GLuint id;
+			std::vector<unsigned char> alphaCoverage;
+			// models holding the texture, it is deleted with the last one
+			int references;
+		};
+
+		// textures of all the models by contentHash. The models are globals of another
+		// translation unit, so the table is never destroyed: it must outlive their destructors
+		static std::unordered_map<unsigned long long, SharedTexture>& getSharedTextures();
+		static int textureFileCount;
+		static int uniqueTextureCount;
+
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
-		// Associated textures
+		// Meshes of the *_shadow.obj override
+        std::vector<gps::Mesh> shadowMeshes;
+		// Associated textures, one reference to a shared texture each
         std::vector<gps::Texture> loadedTextures;
+		int materialCount;
 
 		// Does the parsing of the .obj file and fills in the data structure
 		void ReadOBJ(std::string fileName, std::string basePath);
 
-		// Retrieves a texture associated with the object - by its name and type
+		// Reads the *_shadow.obj override of a model file when it exists
+		void ReadShadowOverride(std::string fileName, std::string basePath);
+
+		// Retrieves a texture associated with the object - by its name and type, then by the
+		// contents of the file
 		gps::Texture LoadTexture(std::string path, std::string type);
 
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// Decodes the bytes of an image file and loads it into the video memory
+		// alphaCoverage receives the average alpha per cell when the image isn't opaque
+		GLuint ReadTextureFromFile(const char* file_name, const std::string& fileData, std::vector<unsigned char>& alphaCoverage);
     };
 }
 
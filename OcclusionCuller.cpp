@@ -0,0 +1,322 @@
+#include "OcclusionCuller.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define OCCLUSION_SSE
+    #include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    OcclusionCuller::OcclusionCuller(ThreadPool* threadPool)
+        : threadPool(threadPool), viewProjection(1.0f), triangleCount(0) {
+
+        std::fill(depth, depth + WIDTH * HEIGHT, 1.0f);
+        std::fill(tileMaxDepth, tileMaxDepth + TILES_X * TILES_Y, 1.0f);
+    }
+
+    int OcclusionCuller::addOccluderMesh(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices) {
+
+        OccluderMesh mesh;
+        mesh.positions = positions;
+        mesh.indices = indices;
+        occluderMeshes.push_back(mesh);
+
+        return (int)occluderMeshes.size() - 1;
+    }
+
+    void OcclusionCuller::beginFrame(const glm::mat4& viewProjection) {
+
+        this->viewProjection = viewProjection;
+        this->occluders.clear();
+        this->triangleCount = 0;
+    }
+
+    void OcclusionCuller::drawOccluder(int occluderMesh, const glm::mat4& modelMatrix) {
+
+        Occluder occluder;
+        occluder.mesh = occluderMesh;
+        occluder.modelMatrix = modelMatrix;
+        occluders.push_back(occluder);
+    }
+
+    void OcclusionCuller::rasterize() {
+
+        if (occluderTriangles.size() < occluders.size()) {
+            occluderTriangles.resize(occluders.size());
+        }
+
+        // transform, clip and project the occluders, one job per occluder
+        threadPool->parallelFor((int)occluders.size(), [this](int i) { setupTriangles(i); });
+
+        for (size_t i = 0; i < occluders.size(); i++) {
+            triangleCount += (int)occluderTriangles[i].size();
+        }
+
+        // every job owns one row of tiles, so no two threads write the same pixel
+        threadPool->parallelFor(TILES_Y, [this](int tileRow) { rasterizeBand(tileRow); });
+    }
+
+    void OcclusionCuller::setupTriangles(int occluderIndex) {
+
+        const Occluder& occluder = occluders[occluderIndex];
+        const OccluderMesh& mesh = occluderMeshes[occluder.mesh];
+        std::vector<ScreenTriangle>& triangles = occluderTriangles[occluderIndex];
+        triangles.clear();
+
+        glm::mat4 mvp = viewProjection * occluder.modelMatrix;
+
+        std::vector<glm::vec4> clip(mesh.positions.size());
+        for (size_t i = 0; i < mesh.positions.size(); i++) {
+            clip[i] = mvp * glm::vec4(mesh.positions[i], 1.0f);
+        }
+
+        for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+
+            glm::vec4 input[3] = { clip[mesh.indices[t]], clip[mesh.indices[t + 1]], clip[mesh.indices[t + 2]] };
+
+            // clip against the near plane (z + w >= 0), a triangle becomes at most a quad
+            glm::vec4 polygon[4];
+            int vertexCount = 0;
+            for (int i = 0; i < 3; i++) {
+                const glm::vec4& a = input[i];
+                const glm::vec4& b = input[(i + 1) % 3];
+                float da = a.z + a.w;
+                float db = b.z + b.w;
+                if (da >= 0.0f) {
+                    polygon[vertexCount++] = a;
+                }
+                if ((da >= 0.0f) != (db >= 0.0f)) {
+                    float s = da / (da - db);
+                    polygon[vertexCount++] = a + (b - a) * s;
+                }
+            }
+
+            if (vertexCount < 3) {
+                continue;
+            }
+
+            float sx[4], sy[4], sz[4];
+            for (int i = 0; i < vertexCount; i++) {
+                float invW = 1.0f / polygon[i].w;
+                sx[i] = (polygon[i].x * invW * 0.5f + 0.5f) * WIDTH;
+                sy[i] = (polygon[i].y * invW * 0.5f + 0.5f) * HEIGHT;
+                sz[i] = polygon[i].z * invW * 0.5f + 0.5f;
+            }
+
+            for (int i = 1; i + 1 < vertexCount; i++) {
+                ScreenTriangle tri;
+                int fan[3] = { 0, i, i + 1 };
+                for (int k = 0; k < 3; k++) {
+                    tri.x[k] = sx[fan[k]];
+                    tri.y[k] = sy[fan[k]];
+                    tri.z[k] = sz[fan[k]];
+                }
+
+                float minX = std::min(tri.x[0], std::min(tri.x[1], tri.x[2]));
+                float maxX = std::max(tri.x[0], std::max(tri.x[1], tri.x[2]));
+                float minY = std::min(tri.y[0], std::min(tri.y[1], tri.y[2]));
+                float maxY = std::max(tri.y[0], std::max(tri.y[1], tri.y[2]));
+                if (maxX < 0.0f || maxY < 0.0f || minX > WIDTH || minY > HEIGHT) {
+                    continue;
+                }
+
+                triangles.push_back(tri);
+            }
+        }
+    }
+
+    void OcclusionCuller::rasterizeBand(int tileRow) {
+
+        int minY = tileRow * TILE_SIZE;
+        int maxY = minY + TILE_SIZE;
+
+        std::fill(depth + minY * WIDTH, depth + maxY * WIDTH, 1.0f);
+
+        for (size_t o = 0; o < occluders.size(); o++) {
+            const std::vector<ScreenTriangle>& triangles = occluderTriangles[o];
+            for (size_t t = 0; t < triangles.size(); t++) {
+                const ScreenTriangle& tri = triangles[t];
+                if (std::max(tri.y[0], std::max(tri.y[1], tri.y[2])) < minY ||
+                    std::min(tri.y[0], std::min(tri.y[1], tri.y[2])) > maxY) {
+                    continue;
+                }
+                rasterizeTriangle(tri, minY, maxY);
+            }
+        }
+
+        // tile max depth for this row of tiles
+        for (int tx = 0; tx < TILES_X; tx++) {
+            float maxDepth = 0.0f;
+            for (int y = minY; y < maxY; y++) {
+                const float* row = depth + y * WIDTH + tx * TILE_SIZE;
+                for (int x = 0; x < TILE_SIZE; x++) {
+                    maxDepth = std::max(maxDepth, row[x]);
+                }
+            }
+            tileMaxDepth[tileRow * TILES_X + tx] = maxDepth;
+        }
+    }
+
+    void OcclusionCuller::rasterizeTriangle(const ScreenTriangle& triangle, int minY, int maxY) {
+
+        float x0 = triangle.x[0], y0 = triangle.y[0], z0 = triangle.z[0];
+        float x1 = triangle.x[1], y1 = triangle.y[1], z1 = triangle.z[1];
+        float x2 = triangle.x[2], y2 = triangle.y[2], z2 = triangle.z[2];
+
+        float area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+        if (std::fabs(area) < 1e-8f) {
+            return;
+        }
+        // both windings are drawn, flip to counter clock-wise so all edges are positive inside
+        if (area < 0.0f) {
+            std::swap(x1, x2);
+            std::swap(y1, y2);
+            std::swap(z1, z2);
+            area = -area;
+        }
+
+        int startX = std::max(0, (int)std::floor(std::min(x0, std::min(x1, x2))));
+        int endX = std::min(WIDTH - 1, (int)std::ceil(std::max(x0, std::max(x1, x2))));
+        int startY = std::max(minY, (int)std::floor(std::min(y0, std::min(y1, y2))));
+        int endY = std::min(maxY - 1, (int)std::ceil(std::max(y0, std::max(y1, y2))));
+        if (startX > endX || startY > endY) {
+            return;
+        }
+        // pixels are processed in groups of 4, WIDTH is a multiple of 4
+        startX &= ~3;
+
+        // edge i goes from vertex i to vertex i + 1, E(x, y) = a * x + b * y + c
+        float a0 = y0 - y1, b0 = x1 - x0, c0 = x0 * y1 - x1 * y0;
+        float a1 = y1 - y2, b1 = x2 - x1, c1 = x1 * y2 - x2 * y1;
+        float a2 = y2 - y0, b2 = x0 - x2, c2 = x2 * y0 - x0 * y2;
+
+        // depth plane
+        float dzdx = ((z1 - z0) * (y2 - y0) - (z2 - z0) * (y1 - y0)) / area;
+        float dzdy = ((x1 - x0) * (z2 - z0) - (x2 - x0) * (z1 - z0)) / area;
+        float zc = z0 - dzdx * x0 - dzdy * y0;
+
+#if defined(OCCLUSION_SSE)
+        const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 stepE0 = _mm_set1_ps(a0 * 4.0f);
+        const __m128 stepE1 = _mm_set1_ps(a1 * 4.0f);
+        const __m128 stepE2 = _mm_set1_ps(a2 * 4.0f);
+        const __m128 stepZ = _mm_set1_ps(dzdx * 4.0f);
+
+        for (int y = startY; y <= endY; y++) {
+            float py = (float)y + 0.5f;
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)startX), offsets);
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), _mm_set1_ps(b0 * py + c0));
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), _mm_set1_ps(b1 * py + c1));
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), _mm_set1_ps(b2 * py + c2));
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dzdx), px), _mm_set1_ps(dzdy * py + zc));
+
+            float* row = depth + y * WIDTH;
+            for (int x = startX; x <= endX; x += 4) {
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                if (_mm_movemask_ps(inside)) {
+                    __m128 current = _mm_loadu_ps(row + x);
+                    __m128 closer = _mm_min_ps(current, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, current)));
+                }
+                e0 = _mm_add_ps(e0, stepE0);
+                e1 = _mm_add_ps(e1, stepE1);
+                e2 = _mm_add_ps(e2, stepE2);
+                z = _mm_add_ps(z, stepZ);
+            }
+        }
+#else
+        for (int y = startY; y <= endY; y++) {
+            float py = (float)y + 0.5f;
+            float* row = depth + y * WIDTH;
+            for (int x = startX; x <= endX; x++) {
+                float px = (float)x + 0.5f;
+                float e0 = a0 * px + b0 * py + c0;
+                float e1 = a1 * px + b1 * py + c1;
+                float e2 = a2 * px + b2 * py + c2;
+                if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f) {
+                    float z = dzdx * px + dzdy * py + zc;
+                    row[x] = std::min(row[x], z);
+                }
+            }
+        }
+#endif
+    }
+
+    bool OcclusionCuller::isVisible(const AABB& box) const {
+
+        if (occluders.empty()) {
+            return true;
+        }
+
+        float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+        float maxX = -FLT_MAX, maxY = -FLT_MAX;
+
+        for (int i = 0; i < 8; i++) {
+            glm::vec3 corner(
+                (i & 1) ? box.max.x : box.min.x,
+                (i & 2) ? box.max.y : box.min.y,
+                (i & 4) ? box.max.z : box.min.z);
+            glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+
+            // box crosses the near plane, it can't be hidden
+            if (clip.z < -clip.w || clip.w <= 0.0f) {
+                return true;
+            }
+
+            float invW = 1.0f / clip.w;
+            float sx = (clip.x * invW * 0.5f + 0.5f) * WIDTH;
+            float sy = (clip.y * invW * 0.5f + 0.5f) * HEIGHT;
+            float sz = clip.z * invW * 0.5f + 0.5f;
+            minX = std::min(minX, sx);
+            maxX = std::max(maxX, sx);
+            minY = std::min(minY, sy);
+            maxY = std::max(maxY, sy);
+            minZ = std::min(minZ, sz);
+        }
+
+        int startX = std::max(0, (int)std::floor(minX));
+        int endX = std::min(WIDTH - 1, (int)std::ceil(maxX));
+        int startY = std::max(0, (int)std::floor(minY));
+        int endY = std::min(HEIGHT - 1, (int)std::ceil(maxY));
+        if (startX > endX || startY > endY) {
+            // off screen, left to the frustum test
+            return true;
+        }
+
+        for (int ty = startY / TILE_SIZE; ty <= endY / TILE_SIZE; ty++) {
+            for (int tx = startX / TILE_SIZE; tx <= endX / TILE_SIZE; tx++) {
+
+                // the whole tile is closer than the box
+                if (tileMaxDepth[ty * TILES_X + tx] < minZ) {
+                    continue;
+                }
+
+                int tileStartX = std::max(startX, tx * TILE_SIZE);
+                int tileEndX = std::min(endX, tx * TILE_SIZE + TILE_SIZE - 1);
+                int tileStartY = std::max(startY, ty * TILE_SIZE);
+                int tileEndY = std::min(endY, ty * TILE_SIZE + TILE_SIZE - 1);
+                for (int y = tileStartY; y <= tileEndY; y++) {
+                    for (int x = tileStartX; x <= tileEndX; x++) {
+                        if (depth[y * WIDTH + x] >= minZ) {
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+
+        return false;
+    }
+
+    int OcclusionCuller::getOccluderCount() const {
+        return (int)occluders.size();
+    }
+
+    int OcclusionCuller::getTriangleCount() const {
+        return triangleCount;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include "Bounds.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Software occlusion culling: a few occluder meshes are rasterized on the CPU into
+    // a small depth buffer, then mesh bounding boxes are tested against it before they
+    // are submitted to the GPU
+    class OcclusionCuller {
+
+    public:
+        static const int WIDTH = 256;
+        static const int HEIGHT = 128;
+        static const int TILE_SIZE = 8;
+        static const int TILES_X = WIDTH / TILE_SIZE;
+        static const int TILES_Y = HEIGHT / TILE_SIZE;
+
+        OcclusionCuller(ThreadPool* threadPool);
+
+        // Keeps a copy of an occluder's triangles, called at load - returns its id
+        int addOccluderMesh(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices);
+
+        // Clears the depth buffer and the queued occluders
+        void beginFrame(const glm::mat4& viewProjection);
+
+        // Queues an occluder mesh to be drawn this frame
+        void drawOccluder(int occluderMesh, const glm::mat4& modelMatrix);
+
+        // Rasterizes the queued occluders and builds the tile max depth level
+        void rasterize();
+
+        // false when the box is hidden behind the occluders for the whole area it covers
+        bool isVisible(const AABB& box) const;
+
+        int getOccluderCount() const;
+        int getTriangleCount() const;
+
+    private:
+        struct OccluderMesh {
+            std::vector<glm::vec3> positions;
+            std::vector<unsigned int> indices;
+        };
+
+        struct Occluder {
+            int mesh;
+            glm::mat4 modelMatrix;
+        };
+
+        // triangle in pixel coordinates, z is the window depth in [0, 1]
+        struct ScreenTriangle {
+            float x[3];
+            float y[3];
+            float z[3];
+        };
+
+        ThreadPool* threadPool;
+        glm::mat4 viewProjection;
+        std::vector<OccluderMesh> occluderMeshes;
+        std::vector<Occluder> occluders;
+        std::vector<std::vector<ScreenTriangle> > occluderTriangles;
+        int triangleCount;
+
+        float depth[WIDTH * HEIGHT];
+        // farthest depth stored in every TILE_SIZE x TILE_SIZE tile
+        float tileMaxDepth[TILES_X * TILES_Y];
+
+        void setupTriangles(int occluderIndex);
+        void rasterizeBand(int tileRow);
+        void rasterizeTriangle(const ScreenTriangle& tri, int minY, int maxY);
+    };
+}
+
+#endif /* OcclusionCuller_hpp */
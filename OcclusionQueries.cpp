@@ -0,0 +1,168 @@
+#include "OcclusionQueries.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+namespace gps {
+
+    namespace {
+        // boxes are grown a little so a surface never hides its own box
+        const float BOX_MARGIN = 0.01f;
+    }
+
+    OcclusionQueries::OcclusionQueries()
+        : queryTarget(GL_ANY_SAMPLES_PASSED), boxVAO(0), boxVBO(0), boxEBO(0), skippedCount(0), conditionalCount(0) {
+    }
+
+    void OcclusionQueries::init(int slotCount) {
+
+        // the conservative query is cheaper, but it is only core from GL 4.3
+#if defined(GL_ANY_SAMPLES_PASSED_CONSERVATIVE) && !defined(__APPLE__)
+        if (GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility) {
+            queryTarget = GL_ANY_SAMPLES_PASSED_CONSERVATIVE;
+        }
+#endif
+
+        queries.resize(slotCount);
+        if (slotCount > 0) {
+            glGenQueries(slotCount, &queries[0]);
+        }
+        boxes.assign(slotCount, AABB());
+        issued.assign(slotCount, false);
+        skipped.assign(slotCount, false);
+        usedThisFrame.assign(slotCount, false);
+        active.assign(slotCount, false);
+
+        // unit cube, stretched over each box in the vertex shader
+        GLfloat vertices[] = {
+            0.0f, 0.0f, 0.0f,
+            1.0f, 0.0f, 0.0f,
+            1.0f, 1.0f, 0.0f,
+            0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 1.0f,
+            1.0f, 0.0f, 1.0f,
+            1.0f, 1.0f, 1.0f,
+            0.0f, 1.0f, 1.0f
+        };
+        GLuint indices[] = {
+            0, 2, 1, 0, 3, 2,
+            4, 5, 6, 4, 6, 7,
+            0, 1, 5, 0, 5, 4,
+            3, 6, 2, 3, 7, 6,
+            0, 4, 7, 0, 7, 3,
+            1, 2, 6, 1, 6, 5
+        };
+
+        glGenVertexArrays(1, &boxVAO);
+        glGenBuffers(1, &boxVBO);
+        glGenBuffers(1, &boxEBO);
+
+        glBindVertexArray(boxVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        glBindVertexArray(0);
+    }
+
+    void OcclusionQueries::setBox(int slot, const AABB& box) {
+
+        boxes[slot] = AABB(box.min - glm::vec3(BOX_MARGIN), box.max + glm::vec3(BOX_MARGIN));
+        skipped[slot] = false;
+    }
+
+    void OcclusionQueries::skipSlot(int slot) {
+
+        skipped[slot] = true;
+    }
+
+    void OcclusionQueries::beginConditional(int slot) {
+
+        // no result for the slot yet, draw normally
+        if (!issued[slot]) {
+            return;
+        }
+
+        glBeginConditionalRender(queries[slot], GL_QUERY_NO_WAIT);
+        active[slot] = true;
+        usedThisFrame[slot] = true;
+        conditionalCount++;
+    }
+
+    void OcclusionQueries::endConditional(int slot) {
+
+        if (active[slot]) {
+            glEndConditionalRender();
+            active[slot] = false;
+        }
+    }
+
+    void OcclusionQueries::issueQueries(gps::Shader shader, const glm::mat4& viewProjection, glm::vec3 cameraPosition) {
+
+        shader.useShaderProgram();
+        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+        GLint boxMinLoc = glGetUniformLocation(shader.shaderProgram, "boxMin");
+        GLint boxMaxLoc = glGetUniformLocation(shader.shaderProgram, "boxMax");
+
+        // boxes only touch the depth test, never the framebuffer
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDisable(GL_CULL_FACE);
+        glBindVertexArray(boxVAO);
+
+        for (size_t slot = 0; slot < queries.size(); slot++) {
+
+            // the result of the query used this frame is ready by now on most drivers,
+            // it is only read when available so the CPU never waits for it
+            if (usedThisFrame[slot]) {
+                GLuint available = 0;
+                glGetQueryObjectuiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available) {
+                    GLuint samplesPassed = 0;
+                    glGetQueryObjectuiv(queries[slot], GL_QUERY_RESULT, &samplesPassed);
+                    if (samplesPassed == 0) {
+                        skippedCount++;
+                    }
+                }
+                usedThisFrame[slot] = false;
+            }
+
+            // a camera inside the box would only see its back faces
+            const AABB& box = boxes[slot];
+            bool cameraInside = cameraPosition.x >= box.min.x && cameraPosition.x <= box.max.x &&
+                                cameraPosition.y >= box.min.y && cameraPosition.y <= box.max.y &&
+                                cameraPosition.z >= box.min.z && cameraPosition.z <= box.max.z;
+            if (skipped[slot] || box.isEmpty() || cameraInside) {
+                issued[slot] = false;
+                continue;
+            }
+
+            glUniform3fv(boxMinLoc, 1, glm::value_ptr(box.min));
+            glUniform3fv(boxMaxLoc, 1, glm::value_ptr(box.max));
+            glBeginQuery(queryTarget, queries[slot]);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+            glEndQuery(queryTarget);
+            issued[slot] = true;
+        }
+
+        glBindVertexArray(0);
+        glEnable(GL_CULL_FACE);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+
+    int OcclusionQueries::takeSkippedCount() {
+
+        int count = skippedCount;
+        skippedCount = 0;
+        return count;
+    }
+
+    int OcclusionQueries::takeConditionalCount() {
+
+        int count = conditionalCount;
+        conditionalCount = 0;
+        return count;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef OcclusionQueries_hpp
+#define OcclusionQueries_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "Bounds.hpp"
+#include "Shader.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // GPU occlusion culling: the bounding boxes of the tested draws are rendered against
+    // the depth buffer at the end of a frame, and in the next frame the draws are wrapped
+    // in conditional rendering so the GPU drops them without a CPU readback
+    class OcclusionQueries {
+
+    public:
+        OcclusionQueries();
+
+        // Creates slotCount query objects and the box geometry
+        void init(int slotCount);
+
+        // Box tested for a slot, set before issueQueries
+        void setBox(int slot, const AABB& box);
+
+        // Slots left out of this frame's queries (e.g. outside the frustum)
+        void skipSlot(int slot);
+
+        // Wrap a draw, the draw is skipped on the GPU when the slot's last query saw no samples
+        void beginConditional(int slot);
+        void endConditional(int slot);
+
+        // Renders the boxes of every slot against the current depth buffer
+        void issueQueries(gps::Shader shader, const glm::mat4& viewProjection, glm::vec3 cameraPosition);
+
+        // Conditional draws known to have been skipped since the last call
+        int takeSkippedCount();
+        int takeConditionalCount();
+
+    private:
+        GLenum queryTarget;
+        GLuint boxVAO;
+        GLuint boxVBO;
+        GLuint boxEBO;
+
+        std::vector<GLuint> queries;
+        std::vector<AABB> boxes;
+        // the query holds a result for the slot's current box
+        std::vector<bool> issued;
+        std::vector<bool> skipped;
+        // the last query was used by a conditional draw this frame
+        std::vector<bool> usedThisFrame;
+        std::vector<bool> active;
+
+        int skippedCount;
+        int conditionalCount;
+    };
+}
+
+#endif /* OcclusionQueries_hpp */
@@ -0,0 +1,166 @@
+#include "PointShadows.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+
+namespace gps {
+
+    namespace {
+        // close enough to keep the lantern housings out of their own light's cube
+        const float NEAR_PLANE = 0.05f;
+        const int FACE_COUNT = 6;
+        // faces dirtied by a moving caster are worth this many frames of waiting
+        const float DYNAMIC_PRIORITY = 4.0f;
+
+        // cube map face order: +X, -X, +Y, -Y, +Z, -Z
+        const glm::vec3 FACE_DIRECTIONS[FACE_COUNT] = {
+            glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+            glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+        };
+        const glm::vec3 FACE_UPS[FACE_COUNT] = {
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+            glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+        };
+    }
+
+    PointShadows::PointShadows() : atlasTexture(0), faceFBO(0), lightCount(0) {
+    }
+
+    void PointShadows::init(int lightCount) {
+
+        this->lightCount = lightCount;
+        positions.assign(lightCount, glm::vec3(0.0f));
+        radii.assign(lightCount, 0.0f);
+        Face face;
+        face.lightSpace = glm::mat4(1.0f);
+        face.stale = false;
+        face.dynamicStale = false;
+        face.age = 0;
+        faces.assign(lightCount * FACE_COUNT, face);
+
+        glGenTextures(1, &atlasTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, atlasTexture);
+        glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, GL_DEPTH_COMPONENT24, FACE_SIZE, FACE_SIZE, lightCount * FACE_COUNT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        // hardware PCF on the lookup
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        glGenFramebuffers(1, &faceFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, faceFBO);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        for (int layer = 0; layer < lightCount * FACE_COUNT; layer++) {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, atlasTexture, 0, layer);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void PointShadows::setLight(int slot, glm::vec3 position, float radius) {
+
+        if (position == positions[slot] && radius == radii[slot]) {
+            return;
+        }
+        positions[slot] = position;
+        radii[slot] = radius;
+
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, NEAR_PLANE, std::max(radius, 2.0f * NEAR_PLANE));
+        for (int i = 0; i < FACE_COUNT; i++) {
+            Face& face = faces[slot * FACE_COUNT + i];
+            face.lightSpace = projection * glm::lookAt(position, position + FACE_DIRECTIONS[i], FACE_UPS[i]);
+            face.frustum = Frustum::fromMatrix(face.lightSpace);
+            face.stale = radius > 0.0f;
+        }
+    }
+
+    void PointShadows::invalidate(const AABB& box) {
+
+        for (int slot = 0; slot < lightCount; slot++) {
+            if (!box.overlapsSphere(positions[slot], radii[slot])) {
+                continue;
+            }
+            for (int i = 0; i < FACE_COUNT; i++) {
+                Face& face = faces[slot * FACE_COUNT + i];
+                if (face.frustum.intersects(box)) {
+                    face.stale = true;
+                    face.dynamicStale = true;
+                }
+            }
+        }
+    }
+
+    void PointShadows::schedule(glm::vec3 cameraPosition, const Frustum& cameraFrustum, int budget, std::vector<int>& scheduled) {
+
+        ranking.clear();
+        for (int slot = 0; slot < lightCount; slot++) {
+            AABB reach(positions[slot] - glm::vec3(radii[slot]), positions[slot] + glm::vec3(radii[slot]));
+            // the faces of lights out of view stay stale until they come back
+            if (!cameraFrustum.intersects(reach)) {
+                continue;
+            }
+            float distance = glm::length(positions[slot] - cameraPosition);
+            for (int i = 0; i < FACE_COUNT; i++) {
+                int index = slot * FACE_COUNT + i;
+                Face& face = faces[index];
+                if (!face.stale) {
+                    continue;
+                }
+                face.age++;
+                float priority = (face.age + (face.dynamicStale ? DYNAMIC_PRIORITY : 0.0f)) / (1.0f + distance);
+                ranking.push_back(std::make_pair(-priority, index));
+            }
+        }
+
+        size_t count = std::min(ranking.size(), (size_t)budget);
+        std::partial_sort(ranking.begin(), ranking.begin() + count, ranking.end());
+        for (size_t i = 0; i < count; i++) {
+            scheduled.push_back(ranking[i].second);
+        }
+    }
+
+    glm::mat4 PointShadows::beginFace(int index) {
+
+        Face& face = faces[index];
+        face.stale = false;
+        face.dynamicStale = false;
+        face.age = 0;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, faceFBO);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, atlasTexture, 0, index);
+        glViewport(0, 0, FACE_SIZE, FACE_SIZE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        return face.lightSpace;
+    }
+
+    const Frustum& PointShadows::getFaceFrustum(int index) {
+
+        return faces[index].frustum;
+    }
+
+    void PointShadows::bind(gps::Shader shader, int textureUnit) {
+
+        glActiveTexture(GL_TEXTURE0 + textureUnit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, atlasTexture);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "pointShadowMap"), textureUnit);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "pointShadowNear"), NEAR_PLANE);
+    }
+
+    int PointShadows::getStaleFaceCount() {
+
+        int count = 0;
+        for (size_t i = 0; i < faces.size(); i++) {
+            if (faces[i].stale) {
+                count++;
+            }
+        }
+        return count;
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef PointShadows_hpp
+#define PointShadows_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "Bounds.hpp"
+#include "Shader.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Omnidirectional shadows of the point lights: one depth cube per light in a cube map
+    // array (the atlas), face layer 6 * slot + face. The faces are cached and only redrawn
+    // once they go stale, a few per frame, the most important ones first
+    class PointShadows {
+
+    public:
+        static const int FACE_SIZE = 256;
+
+        PointShadows();
+
+        // Creates the atlas for lightCount lights, every face starts out unshadowed
+        void init(int lightCount);
+
+        // Places a light, its faces are redrawn when it moves. The radius is the far plane
+        void setLight(int slot, glm::vec3 position, float radius);
+
+        // A dynamic caster moved inside the box, the faces that see it go stale
+        void invalidate(const AABB& box);
+
+        // Picks up to budget stale faces of the lights that reach the frustum, ranked by
+        // closeness to the camera, staleness and whether a dynamic caster dirtied them
+        void schedule(glm::vec3 cameraPosition, const Frustum& cameraFrustum, int budget, std::vector<int>& faces);
+
+        // Binds and clears the face for the depth pass and sets the viewport to it, the face is
+        // up to date afterwards. Returns the face's projection * view matrix
+        glm::mat4 beginFace(int face);
+        const Frustum& getFaceFrustum(int face);
+
+        // Binds the atlas to textureUnit and sets the uniforms the shadow lookup needs, the
+        // shader must be in use
+        void bind(gps::Shader shader, int textureUnit);
+
+        int getStaleFaceCount();
+
+    private:
+        struct Face {
+            glm::mat4 lightSpace;
+            Frustum frustum;
+            bool stale;
+            bool dynamicStale;
+            // frames spent waiting for a redraw
+            int age;
+        };
+
+        GLuint atlasTexture;
+        GLuint faceFBO;
+        int lightCount;
+
+        std::vector<glm::vec3> positions;
+        std::vector<float> radii;
+        std::vector<Face> faces;
+
+        // scratch for schedule
+        std::vector<std::pair<float, int> > ranking;
+    };
+}
+
+#endif /* PointShadows_hpp */
@@ -0,0 +1,187 @@
+#include "ProgramBinaryCache.hpp"
+#include "Shader.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined (_WIN32)
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+#endif
+
+namespace gps {
+
+    namespace {
+        const char CACHE_MAGIC[4] = { 'P', 'B', 'I', 'N' };
+        const int CACHE_VERSION = 1;
+        // larger than any program of this project, a corrupt length can't make us allocate gigabytes
+        const int MAX_BINARY_LENGTH = 64 * 1024 * 1024;
+
+        struct CacheHeader {
+            char magic[4];
+            int version;
+            unsigned long long key;
+            GLenum format;
+            int length;
+        };
+
+        void makeDirectory(const std::string& path) {
+#if defined (_WIN32)
+            _mkdir(path.c_str());
+#else
+            mkdir(path.c_str(), 0755);
+#endif
+        }
+    }
+
+    ProgramBinaryCache::ProgramBinaryCache() : driverHash(0), enabled(false), hits(0), misses(0), rejected(0), bytes(0) {
+    }
+
+    void ProgramBinaryCache::open(const std::string& directory) {
+
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        enabled = formatCount > 0;
+        if (!enabled) {
+            fprintf(stdout, "Program binary cache: the driver has no binary formats, shaders are compiled from source\n");
+            return;
+        }
+
+        this->directory = directory;
+        makeDirectory(directory);
+        // a binary only fits the driver that produced it
+        const char* renderer = (const char*)glGetString(GL_RENDERER);
+        const char* version = (const char*)glGetString(GL_VERSION);
+        driverHash = Shader::hashString(renderer ? renderer : "");
+        driverHash = Shader::hashString(std::string(1, '\0') + (version ? version : ""), driverHash);
+    }
+
+    bool ProgramBinaryCache::isEnabled() {
+
+        return enabled;
+    }
+
+    GLuint ProgramBinaryCache::load(const std::string& vertexSource, const std::string& fragmentSource, bool separable) {
+
+        if (!enabled) {
+            misses++;
+            return 0;
+        }
+        unsigned long long key = computeKey(vertexSource, fragmentSource, separable);
+        FILE* file = fopen(getPath(key).c_str(), "rb");
+        if (!file) {
+            misses++;
+            return 0;
+        }
+
+        CacheHeader header;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1
+            && std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0
+            && header.version == CACHE_VERSION
+            && header.key == key
+            && header.length > 0 && header.length <= MAX_BINARY_LENGTH;
+        std::vector<char> binary;
+        if (valid) {
+            binary.resize(header.length);
+            valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+        }
+        fclose(file);
+        if (!valid) {
+            misses++;
+            return 0;
+        }
+
+        GLuint program = glCreateProgram();
+        if (separable) {
+            glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+        }
+        glProgramBinary(program, header.format, binary.data(), header.length);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            // the driver changed under the same version string, the caller compiles from source
+            glDeleteProgram(program);
+            rejected++;
+            return 0;
+        }
+        hits++;
+        bytes += header.length;
+        return program;
+    }
+
+    void ProgramBinaryCache::store(GLuint program, const std::string& vertexSource, const std::string& fragmentSource, bool separable) {
+
+        if (!enabled) {
+            return;
+        }
+        GLint linked = GL_FALSE;
+        GLint length = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (!linked || length <= 0 || length > MAX_BINARY_LENGTH) {
+            return;
+        }
+
+        CacheHeader header;
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+        header.version = CACHE_VERSION;
+        header.key = computeKey(vertexSource, fragmentSource, separable);
+        std::vector<char> binary(length);
+        GLsizei written = 0;
+        glGetProgramBinary(program, length, &written, &header.format, binary.data());
+        if (written <= 0) {
+            return;
+        }
+        header.length = written;
+
+        FILE* file = fopen(getPath(header.key).c_str(), "wb");
+        if (!file) {
+            return;
+        }
+        bool saved = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(binary.data(), 1, written, file) == (size_t)written;
+        fclose(file);
+        if (!saved) {
+            // a truncated file would only be rejected on every start
+            remove(getPath(header.key).c_str());
+            return;
+        }
+        bytes += written;
+    }
+
+    int ProgramBinaryCache::getHitCount() {
+
+        return hits;
+    }
+
+    int ProgramBinaryCache::getMissCount() {
+
+        return misses;
+    }
+
+    int ProgramBinaryCache::getRejectedCount() {
+
+        return rejected;
+    }
+
+    long long ProgramBinaryCache::getByteCount() {
+
+        return bytes;
+    }
+
+    unsigned long long ProgramBinaryCache::computeKey(const std::string& vertexSource, const std::string& fragmentSource, bool separable) {
+
+        // the separators keep "ab" + "c" and "a" + "bc" apart, a separable program links differently
+        unsigned long long key = Shader::hashString(vertexSource, driverHash ^ (separable ? 0xfe : 0xff));
+        return Shader::hashString(fragmentSource, key ^ 0xff);
+    }
+
+    std::string ProgramBinaryCache::getPath(unsigned long long key) {
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", key);
+        return directory + "/" + name;
+    }
+}
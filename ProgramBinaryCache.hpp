@@ -0,0 +1,59 @@
+#ifndef ProgramBinaryCache_hpp
+#define ProgramBinaryCache_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <string>
+
+namespace gps {
+
+    // Linked programs saved to disk with glGetProgramBinary, so later runs skip the GLSL
+    // compiler. A binary is keyed by the hash of both sources (defines included), the
+    // renderer and the driver version; a driver update or a shader edit misses the cache,
+    // and a binary the driver rejects is compiled from source again and replaced
+    class ProgramBinaryCache {
+
+    public:
+        ProgramBinaryCache();
+
+        // Files go in directory, created if missing. Needs a current context, a driver
+        // without program binary formats leaves the cache disabled
+        void open(const std::string& directory);
+        bool isEnabled();
+
+        // Program linked from the cached binary of these sources, 0 when there is none or
+        // the driver rejected it. A separable stage program has an empty source for the
+        // stage it doesn't have
+        GLuint load(const std::string& vertexSource, const std::string& fragmentSource, bool separable);
+
+        // Saves the binary of a program linked from these sources, it must have been linked
+        // with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+        void store(GLuint program, const std::string& vertexSource, const std::string& fragmentSource, bool separable);
+
+        int getHitCount();
+        int getMissCount();
+        int getRejectedCount();
+        // size of the binaries loaded and stored this run
+        long long getByteCount();
+
+    private:
+        std::string directory;
+        unsigned long long driverHash;
+        bool enabled;
+        int hits;
+        int misses;
+        int rejected;
+        long long bytes;
+
+        unsigned long long computeKey(const std::string& vertexSource, const std::string& fragmentSource, bool separable);
+        std::string getPath(unsigned long long key);
+    };
+}
+
+#endif /* ProgramBinaryCache_hpp */
@@ -0,0 +1,269 @@
+#include "RayTracer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define RAYTRACER_SSE
+    #include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    namespace {
+        // hits closer than this to the origin are ignored
+        const float MIN_T = 1e-5f;
+        const float MIN_DETERMINANT = 1e-12f;
+        const int MAX_STACK = 64;
+
+        // slab test, entry distance in tNear
+        bool hitBox(const AABB& box, glm::vec3 origin, glm::vec3 invDirection, float maxT, float& tNear) {
+            float tMin = 0.0f;
+            float tMax = maxT;
+            for (int axis = 0; axis < 3; axis++) {
+                float t0 = (box.min[axis] - origin[axis]) * invDirection[axis];
+                float t1 = (box.max[axis] - origin[axis]) * invDirection[axis];
+                if (t0 > t1) {
+                    std::swap(t0, t1);
+                }
+                tMin = t0 > tMin ? t0 : tMin;
+                tMax = t1 < tMax ? t1 : tMax;
+                if (tMax < tMin) {
+                    return false;
+                }
+            }
+            tNear = tMin;
+            return true;
+        }
+    }
+
+    RayTracer::RayTracer() : triangleCount(0) {
+    }
+
+    void RayTracer::build(const std::vector<glm::vec3>& triangleCorners) {
+
+        corners = triangleCorners;
+        triangleCount = (int)(corners.size() / 3);
+        nodes.clear();
+        groups.clear();
+        if (triangleCount == 0) {
+            return;
+        }
+
+        triangleBounds.resize(triangleCount);
+        centroids.resize(triangleCount);
+        order.resize(triangleCount);
+        for (int i = 0; i < triangleCount; i++) {
+            AABB box;
+            box.extend(corners[3 * i]);
+            box.extend(corners[3 * i + 1]);
+            box.extend(corners[3 * i + 2]);
+            triangleBounds[i] = box;
+            centroids[i] = box.center();
+            order[i] = i;
+        }
+
+        nodes.reserve(2 * (triangleCount / LEAF_SIZE + 1));
+        nodes.push_back(Node());
+        buildNode(0, 0, triangleCount);
+
+        // only the nodes and groups are kept
+        std::vector<glm::vec3>().swap(corners);
+        std::vector<AABB>().swap(triangleBounds);
+        std::vector<glm::vec3>().swap(centroids);
+        std::vector<int>().swap(order);
+    }
+
+    void RayTracer::buildNode(int nodeIndex, int first, int count) {
+
+        AABB bounds;
+        AABB centroidBounds;
+        for (int i = first; i < first + count; i++) {
+            bounds.extend(triangleBounds[order[i]]);
+            centroidBounds.extend(centroids[order[i]]);
+        }
+        nodes[nodeIndex].bounds = bounds;
+
+        if (count <= LEAF_SIZE) {
+            TriangleGroup group;
+            for (int lane = 0; lane < LEAF_SIZE; lane++) {
+                int triangle = lane < count ? order[first + lane] : -1;
+                glm::vec3 v0(0.0f), e1(0.0f), e2(0.0f);
+                if (triangle != -1) {
+                    v0 = corners[3 * triangle];
+                    e1 = corners[3 * triangle + 1] - v0;
+                    e2 = corners[3 * triangle + 2] - v0;
+                }
+                for (int axis = 0; axis < 3; axis++) {
+                    group.v0[axis][lane] = v0[axis];
+                    group.e1[axis][lane] = e1[axis];
+                    group.e2[axis][lane] = e2[axis];
+                }
+                group.ids[lane] = triangle;
+            }
+            nodes[nodeIndex].left = -1;
+            nodes[nodeIndex].group = (int)groups.size();
+            groups.push_back(group);
+            return;
+        }
+
+        // median split along the widest spread of the centroids
+        glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+        int axis = 0;
+        if (extent.y > extent[axis]) axis = 1;
+        if (extent.z > extent[axis]) axis = 2;
+        int middle = first + count / 2;
+        std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+            [this, axis](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+        int left = (int)nodes.size();
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        nodes[nodeIndex].left = left;
+        nodes[nodeIndex].group = -1;
+        buildNode(left, first, middle - first);
+        buildNode(left + 1, middle, first + count - middle);
+    }
+
+    bool RayTracer::occluded(glm::vec3 origin, glm::vec3 direction, float maxT) const {
+
+        float hitT;
+        int hitTriangle;
+        return traverse(origin, direction, maxT, true, hitT, hitTriangle);
+    }
+
+    bool RayTracer::intersect(glm::vec3 origin, glm::vec3 direction, float maxT, float& hitT, int& hitTriangle) const {
+
+        return traverse(origin, direction, maxT, false, hitT, hitTriangle);
+    }
+
+    int RayTracer::getTriangleCount() const {
+
+        return triangleCount;
+    }
+
+    bool RayTracer::traverse(glm::vec3 origin, glm::vec3 direction, float maxT, bool anyHit, float& hitT, int& hitTriangle) const {
+
+        hitTriangle = -1;
+        hitT = maxT;
+        if (nodes.empty()) {
+            return false;
+        }
+
+        glm::vec3 invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        float tNear;
+        if (!hitBox(nodes[0].bounds, origin, invDirection, hitT, tNear)) {
+            return false;
+        }
+
+        int stack[MAX_STACK];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            const Node& node = nodes[stack[--stackSize]];
+
+            if (node.left == -1) {
+                float t = hitT;
+                int lane = intersectGroup(groups[node.group], origin, direction, t);
+                if (lane != -1) {
+                    hitT = t;
+                    hitTriangle = groups[node.group].ids[lane];
+                    if (anyHit) {
+                        return true;
+                    }
+                }
+                continue;
+            }
+
+            // the nearer child is visited first, so the closest hit shrinks hitT early
+            float tLeft, tRight;
+            bool hitLeft = hitBox(nodes[node.left].bounds, origin, invDirection, hitT, tLeft);
+            bool hitRight = hitBox(nodes[node.left + 1].bounds, origin, invDirection, hitT, tRight);
+            if (hitLeft && hitRight) {
+                bool leftFirst = tLeft <= tRight;
+                stack[stackSize++] = leftFirst ? node.left + 1 : node.left;
+                stack[stackSize++] = leftFirst ? node.left : node.left + 1;
+            } else if (hitLeft) {
+                stack[stackSize++] = node.left;
+            } else if (hitRight) {
+                stack[stackSize++] = node.left + 1;
+            }
+        }
+        return hitTriangle != -1;
+    }
+
+    int RayTracer::intersectGroup(const TriangleGroup& group, glm::vec3 origin, glm::vec3 direction, float& t) const {
+
+        // Moller-Trumbore for the four lanes
+        float laneT[LEAF_SIZE];
+        bool laneHit[LEAF_SIZE];
+#ifdef RAYTRACER_SSE
+        __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+        __m128 e1x = _mm_loadu_ps(group.e1[0]), e1y = _mm_loadu_ps(group.e1[1]), e1z = _mm_loadu_ps(group.e1[2]);
+        __m128 e2x = _mm_loadu_ps(group.e2[0]), e2y = _mm_loadu_ps(group.e2[1]), e2z = _mm_loadu_ps(group.e2[2]);
+
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+        __m128 tx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(group.v0[0]));
+        __m128 ty = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(group.v0[1]));
+        __m128 tz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(group.v0[2]));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+        __m128 hitT = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+        // |det| through the sign bit, NaN lanes of degenerate triangles fail every compare
+        __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+        __m128 zero = _mm_setzero_ps();
+        __m128 mask = _mm_cmpgt_ps(absDet, _mm_set1_ps(MIN_DETERMINANT));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        mask = _mm_and_ps(mask, _mm_cmpgt_ps(hitT, _mm_set1_ps(MIN_T)));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(hitT, _mm_set1_ps(t)));
+
+        int bits = _mm_movemask_ps(mask);
+        if (bits == 0) {
+            return -1;
+        }
+        _mm_storeu_ps(laneT, hitT);
+        for (int lane = 0; lane < LEAF_SIZE; lane++) {
+            laneHit[lane] = (bits >> lane) & 1;
+        }
+#else
+        for (int lane = 0; lane < LEAF_SIZE; lane++) {
+            glm::vec3 e1(group.e1[0][lane], group.e1[1][lane], group.e1[2][lane]);
+            glm::vec3 e2(group.e2[0][lane], group.e2[1][lane], group.e2[2][lane]);
+            glm::vec3 p = glm::cross(direction, e2);
+            float det = glm::dot(e1, p);
+            laneHit[lane] = false;
+            if (std::fabs(det) <= MIN_DETERMINANT) {
+                continue;
+            }
+            float invDet = 1.0f / det;
+            glm::vec3 s = origin - glm::vec3(group.v0[0][lane], group.v0[1][lane], group.v0[2][lane]);
+            float u = glm::dot(s, p) * invDet;
+            glm::vec3 q = glm::cross(s, e1);
+            float v = glm::dot(direction, q) * invDet;
+            laneT[lane] = glm::dot(e2, q) * invDet;
+            laneHit[lane] = u >= 0.0f && v >= 0.0f && u + v <= 1.0f && laneT[lane] > MIN_T && laneT[lane] < t;
+        }
+#endif
+
+        int closest = -1;
+        for (int lane = 0; lane < LEAF_SIZE; lane++) {
+            if (laneHit[lane] && laneT[lane] < t) {
+                t = laneT[lane];
+                closest = lane;
+            }
+        }
+        return closest;
+    }
+}
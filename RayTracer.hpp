@@ -0,0 +1,65 @@
+#ifndef RayTracer_hpp
+#define RayTracer_hpp
+
+#include "Bounds.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Triangle BVH for the offline bakers. Leaves hold up to four triangles stored as
+    // structure of arrays, tested against a ray at once with SSE
+    class RayTracer {
+
+    public:
+        RayTracer();
+
+        // Builds the tree over the triangles, three world space corners each
+        void build(const std::vector<glm::vec3>& triangleCorners);
+
+        // True when any triangle is hit closer than maxT, the direction must be normalized
+        bool occluded(glm::vec3 origin, glm::vec3 direction, float maxT) const;
+
+        // Closest hit closer than maxT, returns false when nothing is hit
+        bool intersect(glm::vec3 origin, glm::vec3 direction, float maxT, float& hitT, int& hitTriangle) const;
+
+        int getTriangleCount() const;
+
+    private:
+        static const int LEAF_SIZE = 4;
+
+        struct Node {
+            AABB bounds;
+            // leaf: triangle group index, inner node: children are left and left + 1
+            int left;
+            int group;
+        };
+
+        // four triangles, corner v0 and the edges to the two other corners; unused lanes
+        // are degenerate and never hit
+        struct TriangleGroup {
+            float v0[3][LEAF_SIZE];
+            float e1[3][LEAF_SIZE];
+            float e2[3][LEAF_SIZE];
+            int ids[LEAF_SIZE];
+        };
+
+        std::vector<Node> nodes;
+        std::vector<TriangleGroup> groups;
+        int triangleCount;
+
+        // build scratch
+        std::vector<glm::vec3> corners;
+        std::vector<AABB> triangleBounds;
+        std::vector<glm::vec3> centroids;
+        std::vector<int> order;
+
+        void buildNode(int nodeIndex, int first, int count);
+        bool traverse(glm::vec3 origin, glm::vec3 direction, float maxT, bool anyHit, float& hitT, int& hitTriangle) const;
+        int intersectGroup(const TriangleGroup& group, glm::vec3 origin, glm::vec3 direction, float& t) const;
+    };
+}
+
+#endif /* RayTracer_hpp */
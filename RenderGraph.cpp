@@ -0,0 +1,335 @@
+#include "RenderGraph.hpp"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace gps {
+
+    namespace {
+        bool isDepthFormat(GLenum internalFormat) {
+            return internalFormat == GL_DEPTH_COMPONENT16 || internalFormat == GL_DEPTH_COMPONENT24
+                || internalFormat == GL_DEPTH_COMPONENT32F;
+        }
+
+        // format and type to allocate an internal format with, no data is uploaded
+        void uploadFormatOf(GLenum internalFormat, GLenum& format, GLenum& type) {
+            type = GL_FLOAT;
+            if (isDepthFormat(internalFormat)) {
+                format = GL_DEPTH_COMPONENT;
+            } else if (internalFormat == GL_R16F || internalFormat == GL_R32F) {
+                format = GL_RED;
+            } else if (internalFormat == GL_RG16F || internalFormat == GL_RG32F) {
+                format = GL_RG;
+            } else if (internalFormat == GL_RGBA16F || internalFormat == GL_RGBA32F) {
+                format = GL_RGBA;
+            } else {
+                format = GL_RGBA;
+                type = GL_UNSIGNED_BYTE;
+            }
+        }
+    }
+
+    RenderGraph::RenderGraph() {
+    }
+
+    RenderGraph::Resource RenderGraph::addResource(const std::string& name) {
+
+        ResourceInfo resource;
+        resource.name = name;
+        resource.target = false;
+        resource.transient = false;
+        resource.output = false;
+        resource.framebuffer = 0;
+        resource.width = 0;
+        resource.height = 0;
+        resource.internalFormat = GL_NONE;
+        resource.physical = -1;
+        resources.push_back(resource);
+        return (Resource)resources.size() - 1;
+    }
+
+    RenderGraph::Resource RenderGraph::importResource(const std::string& name) {
+
+        return addResource(name);
+    }
+
+    RenderGraph::Resource RenderGraph::importTarget(const std::string& name, GLuint framebuffer, int width, int height) {
+
+        Resource resource = addResource(name);
+        resources[resource].target = true;
+        resources[resource].framebuffer = framebuffer;
+        resources[resource].width = width;
+        resources[resource].height = height;
+        return resource;
+    }
+
+    RenderGraph::Resource RenderGraph::createTransient(const std::string& name, int width, int height, GLenum internalFormat) {
+
+        Resource resource = addResource(name);
+        resources[resource].target = true;
+        resources[resource].transient = true;
+        resources[resource].width = width;
+        resources[resource].height = height;
+        resources[resource].internalFormat = internalFormat;
+        return resource;
+    }
+
+    void RenderGraph::setTargetSize(Resource resource, int width, int height) {
+
+        resources[resource].width = width;
+        resources[resource].height = height;
+    }
+
+    void RenderGraph::markOutput(Resource resource) {
+
+        resources[resource].output = true;
+    }
+
+    RenderGraph::Pass RenderGraph::addPass(const std::string& name, const std::function<void()>& execute) {
+
+        PassInfo pass;
+        pass.name = name;
+        pass.execute = execute;
+        pass.enabled = true;
+        pass.live = false;
+        passes.push_back(pass);
+        return (Pass)passes.size() - 1;
+    }
+
+    void RenderGraph::read(Pass pass, Resource resource) {
+
+        passes[pass].reads.push_back(resource);
+    }
+
+    void RenderGraph::write(Pass pass, Resource resource, GLbitfield clearMask) {
+
+        passes[pass].writes.push_back(resource);
+        passes[pass].clearMasks.push_back(clearMask);
+    }
+
+    void RenderGraph::setEnabled(Pass pass, bool enabled) {
+
+        passes[pass].enabled = enabled;
+    }
+
+    bool RenderGraph::compile() {
+
+        // from the last pass back: a pass is live when it writes something the frame's
+        // outputs or a later live pass read, its own reads are then needed too
+        std::vector<bool> needed(resources.size(), false);
+        for (size_t r = 0; r < resources.size(); r++) {
+            needed[r] = resources[r].output;
+        }
+        for (int p = (int)passes.size() - 1; p >= 0; p--) {
+            PassInfo& pass = passes[p];
+            pass.live = false;
+            if (!pass.enabled) {
+                continue;
+            }
+            for (size_t w = 0; w < pass.writes.size() && !pass.live; w++) {
+                pass.live = needed[pass.writes[w]];
+            }
+            if (pass.live) {
+                for (size_t r = 0; r < pass.reads.size(); r++) {
+                    needed[pass.reads[r]] = true;
+                }
+            }
+        }
+
+        firstWriter.assign(resources.size(), -1);
+        for (size_t p = 0; p < passes.size(); p++) {
+            if (!passes[p].live) {
+                continue;
+            }
+            for (size_t w = 0; w < passes[p].writes.size(); w++) {
+                if (firstWriter[passes[p].writes[w]] == -1) {
+                    firstWriter[passes[p].writes[w]] = (int)p;
+                }
+            }
+        }
+
+        placeTransients();
+
+        bool changed = lastLive.size() != passes.size();
+        lastLive.resize(passes.size(), false);
+        for (size_t p = 0; p < passes.size(); p++) {
+            changed = changed || lastLive[p] != passes[p].live;
+            lastLive[p] = passes[p].live;
+        }
+        return changed;
+    }
+
+    void RenderGraph::placeTransients() {
+
+        // lifetime of every transient over the live passes
+        std::vector<int> firstUse(resources.size(), -1);
+        std::vector<int> lastUse(resources.size(), -1);
+        for (size_t p = 0; p < passes.size(); p++) {
+            if (!passes[p].live) {
+                continue;
+            }
+            for (int list = 0; list < 2; list++) {
+                const std::vector<Resource>& used = list == 0 ? passes[p].reads : passes[p].writes;
+                for (size_t u = 0; u < used.size(); u++) {
+                    if (firstUse[used[u]] == -1) {
+                        firstUse[used[u]] = (int)p;
+                    }
+                    lastUse[used[u]] = (int)p;
+                }
+            }
+        }
+
+        for (size_t t = 0; t < physicalTargets.size(); t++) {
+            physicalTargets[t].busyUntil = -1;
+        }
+        // in order of first use, so a texture is only handed on once its last user ran
+        std::vector<Resource> transients;
+        for (size_t r = 0; r < resources.size(); r++) {
+            resources[r].physical = -1;
+            if (resources[r].transient && firstUse[r] != -1) {
+                transients.push_back((Resource)r);
+            }
+        }
+        std::sort(transients.begin(), transients.end(), [&firstUse](Resource a, Resource b) {
+            return firstUse[a] < firstUse[b];
+        });
+        for (size_t i = 0; i < transients.size(); i++) {
+            Resource r = transients[i];
+            resources[r].physical = acquirePhysical(resources[r], firstUse[r], lastUse[r]);
+        }
+    }
+
+    int RenderGraph::acquirePhysical(const ResourceInfo& resource, int firstUse, int lastUse) {
+
+        for (size_t t = 0; t < physicalTargets.size(); t++) {
+            PhysicalTarget& target = physicalTargets[t];
+            if (target.busyUntil < firstUse && target.width == resource.width && target.height == resource.height
+                && target.internalFormat == resource.internalFormat) {
+                target.busyUntil = lastUse;
+                return (int)t;
+            }
+        }
+
+        PhysicalTarget target;
+        target.width = resource.width;
+        target.height = resource.height;
+        target.internalFormat = resource.internalFormat;
+        target.busyUntil = lastUse;
+
+        GLenum format, type;
+        uploadFormatOf(resource.internalFormat, format, type);
+        glGenTextures(1, &target.texture);
+        glBindTexture(GL_TEXTURE_2D, target.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, resource.internalFormat, resource.width, resource.height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &target.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, isDepthFormat(resource.internalFormat) ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0,
+            GL_TEXTURE_2D, target.texture, 0);
+        if (isDepthFormat(resource.internalFormat)) {
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        physicalTargets.push_back(target);
+        return (int)physicalTargets.size() - 1;
+    }
+
+    void RenderGraph::execute() {
+
+        for (size_t p = 0; p < passes.size(); p++) {
+            PassInfo& pass = passes[p];
+            if (!pass.live) {
+                continue;
+            }
+
+            // the first target the pass writes is bound for it
+            int target = -1;
+            for (size_t w = 0; w < pass.writes.size() && target == -1; w++) {
+                if (resources[pass.writes[w]].target) {
+                    target = pass.writes[w];
+                }
+            }
+
+            // clears of the resources this pass writes first, merged per framebuffer
+            std::vector<Resource> cleared;
+            std::vector<GLbitfield> masks;
+            for (size_t w = 0; w < pass.writes.size(); w++) {
+                Resource resource = pass.writes[w];
+                if (pass.clearMasks[w] == 0 || firstWriter[resource] != (int)p || !resources[resource].target) {
+                    continue;
+                }
+                size_t c = 0;
+                while (c < cleared.size() && getFramebuffer(cleared[c]) != getFramebuffer(resource)) {
+                    c++;
+                }
+                if (c == cleared.size()) {
+                    cleared.push_back(resource);
+                    masks.push_back(0);
+                }
+                masks[c] |= pass.clearMasks[w];
+            }
+            for (size_t c = 0; c < cleared.size(); c++) {
+                glBindFramebuffer(GL_FRAMEBUFFER, getFramebuffer(cleared[c]));
+                glViewport(0, 0, resources[cleared[c]].width, resources[cleared[c]].height);
+                glClear(masks[c]);
+            }
+
+            if (target != -1) {
+                glBindFramebuffer(GL_FRAMEBUFFER, getFramebuffer(target));
+                glViewport(0, 0, resources[target].width, resources[target].height);
+            }
+            pass.execute();
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    bool RenderGraph::isLive(Pass pass) {
+
+        return passes[pass].live;
+    }
+
+    GLuint RenderGraph::getTexture(Resource resource) {
+
+        int physical = resources[resource].physical;
+        return physical == -1 ? 0 : physicalTargets[physical].texture;
+    }
+
+    GLuint RenderGraph::getFramebuffer(Resource resource) {
+
+        if (!resources[resource].transient) {
+            return resources[resource].framebuffer;
+        }
+        int physical = resources[resource].physical;
+        return physical == -1 ? 0 : physicalTargets[physical].framebuffer;
+    }
+
+    void RenderGraph::printReport() {
+
+        std::string live, culled;
+        for (size_t p = 0; p < passes.size(); p++) {
+            std::string& list = passes[p].live ? live : culled;
+            if (!list.empty()) {
+                list += ", ";
+            }
+            list += passes[p].name;
+        }
+        int transientCount = 0;
+        int placedCount = 0;
+        for (size_t r = 0; r < resources.size(); r++) {
+            if (resources[r].transient) {
+                transientCount++;
+                placedCount += resources[r].physical != -1 ? 1 : 0;
+            }
+        }
+        fprintf(stdout, "Render graph: %s%s%s, %d of %d transient targets live in %d pooled textures\n",
+            live.c_str(), culled.empty() ? "" : " (culled: ", culled.empty() ? "" : (culled + ")").c_str(),
+            placedCount, transientCount, (int)physicalTargets.size());
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef RenderGraph_hpp
+#define RenderGraph_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // The passes of a frame with the resources they read and write. Passes run in the
+    // order they were added, so a read sees the writes of the passes added before it;
+    // each frame the passes whose writes nothing live reads (down to the frame's outputs)
+    // are culled. Transient targets get their texture from a pool for the passes that
+    // use them, targets whose lifetimes don't overlap share one, and a target is cleared
+    // only before its first live writer, when that writer asks for it
+    class RenderGraph {
+
+    public:
+        typedef int Resource;
+        typedef int Pass;
+
+        RenderGraph();
+
+        // Resource kept up to date by its passes themselves, like the shadow map arrays
+        Resource importResource(const std::string& name);
+        // Framebuffer the graph binds, with the viewport, before a pass writing it
+        Resource importTarget(const std::string& name, GLuint framebuffer, int width, int height);
+        // Single texture target owned by the graph, allocated only while a live pass uses it
+        Resource createTransient(const std::string& name, int width, int height, GLenum internalFormat);
+        void setTargetSize(Resource resource, int width, int height);
+        // Read after the frame, by the screen or by the next frame
+        void markOutput(Resource resource);
+
+        Pass addPass(const std::string& name, const std::function<void()>& execute);
+        void read(Pass pass, Resource resource);
+        // clearMask is what the pass needs cleared first, only applied when it is the
+        // first live writer of the frame
+        void write(Pass pass, Resource resource, GLbitfield clearMask = 0);
+        // a disabled pass is culled along with the passes only it was reading
+        void setEnabled(Pass pass, bool enabled);
+
+        // Culls the passes and places the transient targets, returns true when the live
+        // passes differ from the last frame's
+        bool compile();
+        // Runs the live passes, after compile
+        void execute();
+
+        bool isLive(Pass pass);
+        // texture and framebuffer of a transient target for this frame, 0 outside its passes
+        GLuint getTexture(Resource resource);
+        GLuint getFramebuffer(Resource resource);
+
+        // live and culled passes, transient targets and the textures behind them
+        void printReport();
+
+    private:
+        struct ResourceInfo {
+            std::string name;
+            bool target;
+            bool transient;
+            bool output;
+            GLuint framebuffer;
+            int width;
+            int height;
+            GLenum internalFormat;
+            // pool texture during this frame, -1 when no live pass uses it
+            int physical;
+        };
+
+        struct PassInfo {
+            std::string name;
+            std::function<void()> execute;
+            std::vector<Resource> reads;
+            std::vector<Resource> writes;
+            std::vector<GLbitfield> clearMasks;
+            bool enabled;
+            bool live;
+        };
+
+        struct PhysicalTarget {
+            GLuint texture;
+            GLuint framebuffer;
+            int width;
+            int height;
+            GLenum internalFormat;
+            // last pass of the frame using it, -1 while free
+            int busyUntil;
+        };
+
+        std::vector<ResourceInfo> resources;
+        std::vector<PassInfo> passes;
+        std::vector<PhysicalTarget> physicalTargets;
+        // first live pass writing each resource this frame, -1 when none
+        std::vector<int> firstWriter;
+        std::vector<bool> lastLive;
+
+        Resource addResource(const std::string& name);
+        void placeTransients();
+        int acquirePhysical(const ResourceInfo& resource, int firstUse, int lastUse);
+    };
+}
+
+#endif /* RenderGraph_hpp */
@@ -7,8 +7,24 @@
 //
 
 #include "Shader.hpp"
+#include "ProgramBinaryCache.hpp"
+
+#include <algorithm>
 
 namespace gps {
+    ProgramBinaryCache* Shader::binaryCache = NULL;
+    bool Shader::parallelCompile = false;
+    std::vector<Shader::PendingProgram> Shader::pendingPrograms;
+    std::vector<GLuint> Shader::pendingPipelines;
+
+    namespace {
+        // GL_COMPLETION_STATUS_KHR, the ARB extension uses the same value
+        const GLenum COMPLETION_STATUS = 0x91B1;
+    }
+
+    Shader::Shader() : shaderProgram(0), vertexProgram(0), pipeline(0) {
+    }
+
     std::string Shader::readShaderFile(std::string fileName) {
 
         std::ifstream shaderFile;
@@ -53,47 +69,255 @@ namespace gps {
         //check linking info
         glGetProgramiv(shaderProgramId, GL_LINK_STATUS, &success);
         if(!success) {
-            glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+            glGetProgramInfoLog(shaderProgramId, 512, NULL, infoLog);
             std::cout << "Shader linking error\n" << infoLog << std::endl;
         }
     }
     
+    unsigned long long Shader::hashString(const std::string& text, unsigned long long hash) {
+
+        for (size_t i = 0; i < text.size(); i++) {
+            hash ^= (unsigned char)text[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void Shader::setBinaryCache(ProgramBinaryCache* cache) {
+
+        binaryCache = cache;
+    }
+
+    bool Shader::enableParallelCompile() {
+
+#if defined(GL_KHR_parallel_shader_compile) && !defined(__APPLE__)
+        if (!parallelCompile && GLEW_KHR_parallel_shader_compile) {
+            // 0xFFFFFFFF leaves the number of threads to the driver
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            parallelCompile = true;
+        }
+#endif
+#if defined(GL_ARB_parallel_shader_compile) && !defined(__APPLE__)
+        if (!parallelCompile && GLEW_ARB_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+            parallelCompile = true;
+        }
+#endif
+        return parallelCompile;
+    }
+
+    std::string Shader::addDefines(const std::string& source, const std::vector<std::string>& defines) {
+
+        if (defines.empty()) {
+            return source;
+        }
+
+        //the defines go right after #version, which has to stay the first statement
+        std::string defineLines;
+        for (size_t i = 0; i < defines.size(); i++) {
+            defineLines += "#define " + defines[i] + "\n";
+        }
+        size_t version = source.find("#version");
+        if (version == std::string::npos) {
+            return defineLines + source;
+        }
+        size_t lineEnd = source.find('\n', version);
+        if (lineEnd == std::string::npos) {
+            return source + "\n" + defineLines;
+        }
+        return source.substr(0, lineEnd + 1) + defineLines + source.substr(lineEnd + 1);
+    }
+
     void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName) {
 
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
-        const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
-        
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
-        const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
-        //check compilation status
-        shaderCompileLog(fragmentShader);
+        loadShader(vertexShaderFileName, fragmentShaderFileName, std::vector<std::string>());
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+                            const std::vector<std::string>& defines) {
+
+        loadShaderSource(readShaderFile(vertexShaderFileName), readShaderFile(fragmentShaderFileName), defines);
+    }
+
+    GLuint Shader::compileShader(GLenum stage, const std::string& source) {
+
+        const GLchar* shaderString = source.c_str();
+        GLuint shader = glCreateShader(stage);
+        glShaderSource(shader, 1, &shaderString, NULL);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    void Shader::loadShaderSource(const std::string& vertexSource, const std::string& fragmentSource,
+                                  const std::vector<std::string>& defines) {
+
+        std::string v = addDefines(vertexSource, defines);
+        std::string f = addDefines(fragmentSource, defines);
+        this->pipeline = 0;
+        if (binaryCache != NULL) {
+            this->shaderProgram = binaryCache->load(v, f, false);
+            this->vertexProgram = this->shaderProgram;
+            if (this->shaderProgram != 0) {
+                return;
+            }
+        }
+
+        //read, parse and compile the vertex and fragment shaders
+        GLuint vertexShader = compileShader(GL_VERTEX_SHADER, v);
+        GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, f);
         
         //attach and link the shader programs
         this->shaderProgram = glCreateProgram();
+        this->vertexProgram = this->shaderProgram;
         glAttachShader(this->shaderProgram, vertexShader);
         glAttachShader(this->shaderProgram, fragmentShader);
+        if (binaryCache != NULL) {
+            glProgramParameteri(this->shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
         glLinkProgram(this->shaderProgram);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-        //check linking info
-        shaderLinkLog(this->shaderProgram);
+
+        //any status query would wait for the compiler, they are left for the first use
+        PendingProgram pending;
+        pending.program = this->shaderProgram;
+        pending.vertexShader = vertexShader;
+        pending.fragmentShader = fragmentShader;
+        pending.separable = false;
+        if (binaryCache != NULL) {
+            pending.vertexSource = v;
+            pending.fragmentSource = f;
+        }
+        pendingPrograms.push_back(pending);
+    }
+
+    GLuint Shader::createStageProgram(GLenum stage, const std::string& source, const std::vector<std::string>& defines) {
+
+        std::string code = addDefines(source, defines);
+        std::string v = stage == GL_VERTEX_SHADER ? code : std::string();
+        std::string f = stage == GL_FRAGMENT_SHADER ? code : std::string();
+        if (binaryCache != NULL) {
+            GLuint program = binaryCache->load(v, f, true);
+            if (program != 0) {
+                return program;
+            }
+        }
+
+        //glCreateShaderProgramv would do the same, but a binary must be asked for before linking
+        GLuint shader = compileShader(stage, code);
+        GLuint program = glCreateProgram();
+        glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+        if (binaryCache != NULL) {
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glAttachShader(program, shader);
+        glLinkProgram(program);
+
+        PendingProgram pending;
+        pending.program = program;
+        pending.vertexShader = stage == GL_VERTEX_SHADER ? shader : 0;
+        pending.fragmentShader = stage == GL_FRAGMENT_SHADER ? shader : 0;
+        pending.separable = true;
+        if (binaryCache != NULL) {
+            pending.vertexSource = v;
+            pending.fragmentSource = f;
+        }
+        pendingPrograms.push_back(pending);
+        return program;
+    }
+
+    void Shader::loadPipeline(GLuint vertexStageProgram, GLuint fragmentStageProgram) {
+
+        this->vertexProgram = vertexStageProgram;
+        this->shaderProgram = fragmentStageProgram;
+        glGenProgramPipelines(1, &this->pipeline);
+        pendingPipelines.push_back(this->pipeline);
+    }
+
+    void Shader::finishProgram(GLuint program) {
+
+        for (size_t i = 0; i < pendingPrograms.size(); i++) {
+            if (pendingPrograms[i].program != program) {
+                continue;
+            }
+            PendingProgram pending = pendingPrograms[i];
+            pendingPrograms.erase(pendingPrograms.begin() + i);
+
+            //check compilation status and linking info
+            if (pending.vertexShader != 0) {
+                shaderCompileLog(pending.vertexShader);
+                glDetachShader(pending.program, pending.vertexShader);
+                glDeleteShader(pending.vertexShader);
+            }
+            if (pending.fragmentShader != 0) {
+                shaderCompileLog(pending.fragmentShader);
+                glDetachShader(pending.program, pending.fragmentShader);
+                glDeleteShader(pending.fragmentShader);
+            }
+            shaderLinkLog(pending.program);
+            if (binaryCache != NULL) {
+                binaryCache->store(pending.program, pending.vertexSource, pending.fragmentSource, pending.separable);
+            }
+            return;
+        }
+    }
+
+    void Shader::finishCompletedPrograms() {
+
+        //finishProgram takes the entry out of the list, so it is walked from the back
+        for (size_t i = pendingPrograms.size(); i > 0; i--) {
+            GLuint program = pendingPrograms[i - 1].program;
+            GLint completed = GL_TRUE;
+            if (parallelCompile) {
+                glGetProgramiv(program, COMPLETION_STATUS, &completed);
+            }
+            if (completed == GL_TRUE) {
+                finishProgram(program);
+            }
+        }
+    }
+
+    bool Shader::isProgramReady(GLuint program) {
+
+        for (size_t i = 0; i < pendingPrograms.size(); i++) {
+            if (pendingPrograms[i].program == program) {
+                GLint completed = GL_FALSE;
+                glGetProgramiv(program, COMPLETION_STATUS, &completed);
+                return completed == GL_TRUE;
+            }
+        }
+        return true;
     }
     
     void Shader::useShaderProgram() {
 
-        glUseProgram(this->shaderProgram);
+        if (this->pipeline == 0) {
+            if (!pendingPrograms.empty()) {
+                finishProgram(this->shaderProgram);
+            }
+            glUseProgram(this->shaderProgram);
+            return;
+        }
+
+        std::vector<GLuint>::iterator pending = std::find(pendingPipelines.begin(), pendingPipelines.end(), this->pipeline);
+        if (pending != pendingPipelines.end()) {
+            finishProgram(this->vertexProgram);
+            finishProgram(this->shaderProgram);
+            glUseProgramStages(this->pipeline, GL_VERTEX_SHADER_BIT, this->vertexProgram);
+            glUseProgramStages(this->pipeline, GL_FRAGMENT_SHADER_BIT, this->shaderProgram);
+            pendingPipelines.erase(pending);
+        }
+        //a program in use would take precedence over the pipeline
+        glUseProgram(0);
+        glBindProgramPipeline(this->pipeline);
+        //glUniform goes to the fragment stage, like glGetUniformLocation(shaderProgram) expects
+        glActiveShaderProgram(this->pipeline, this->shaderProgram);
+    }
+
+    bool Shader::isReady() {
+
+        if (!parallelCompile) {
+            return true;
+        }
+        return isProgramReady(this->shaderProgram) && (this->vertexProgram == this->shaderProgram || isProgramReady(this->vertexProgram));
     }
 
 }
@@ -20,21 +20,95 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 namespace gps {
+
+    class ProgramBinaryCache;
     
     class Shader {
 
     public:
+        // the program uniforms are set on with glUniform while the shader is in use; for a
+        // pipeline that is its fragment stage
         GLuint shaderProgram;
+        // the program holding the vertex stage, shaderProgram unless this is a pipeline
+        GLuint vertexProgram;
+        // separable program pipeline, 0 for a plain program
+        GLuint pipeline;
+
+        Shader();
+
         void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+        // Same, with a #define line for each of defines put right after the #version line
+        // of both stages
+        void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+                        const std::vector<std::string>& defines);
+        void loadShaderSource(const std::string& vertexSource, const std::string& fragmentSource,
+                              const std::vector<std::string>& defines);
+
+        // Compiles and links one stage (GL_VERTEX_SHADER or GL_FRAGMENT_SHADER) as a separable
+        // program, to be combined with other stages by loadPipeline without linking again
+        static GLuint createStageProgram(GLenum stage, const std::string& source, const std::vector<std::string>& defines);
+        // Makes this shader a program pipeline of two stage programs, a stage program may be
+        // shared by any number of pipelines. Uniforms of the vertex stage are set with
+        // glProgramUniform on vertexProgram
+        void loadPipeline(GLuint vertexStageProgram, GLuint fragmentStageProgram);
+        // The first use waits for the compile and link started by loadShader and prints
+        // their logs, loading itself never waits for the driver
         void useShaderProgram();
+        // Whether the program is done compiling. Without parallel compile the driver can't be
+        // asked without waiting, so the program counts as ready and its first use waits
+        bool isReady();
+
+        // Finishes the pending programs the driver is done with, like their first use would,
+        // and every pending program without parallel compile. Called once a frame, so the
+        // programs no draw has used yet are still checked and cached
+        static void finishCompletedPrograms();
     
+        static std::string readShaderFile(std::string fileName);
+
+        // FNV-1a of text, continuing from hash
+        static const unsigned long long HASH_SEED = 14695981039346656037ull;
+        static unsigned long long hashString(const std::string& text, unsigned long long hash = HASH_SEED);
+
+        // Programs are looked up in cache before compiling and saved to it after, NULL
+        // (the default) always compiles from source
+        static void setBinaryCache(ProgramBinaryCache* cache);
+
+        // Lets the driver compile on its own threads (GL_KHR_parallel_shader_compile or the
+        // ARB one), false when neither is there
+        static bool enableParallelCompile();
+
     private:
-        std::string readShaderFile(std::string fileName);
-        void shaderCompileLog(GLuint shaderId);
-        void shaderLinkLog(GLuint shaderProgramId);
+        // a program linked by loadShader whose status nobody has asked for yet, a stage
+        // program has 0 for the shader it doesn't have
+        struct PendingProgram {
+            GLuint program;
+            GLuint vertexShader;
+            GLuint fragmentShader;
+            bool separable;
+            // kept for the binary cache, only a linked program has a binary
+            std::string vertexSource;
+            std::string fragmentSource;
+        };
+
+        static ProgramBinaryCache* binaryCache;
+        static bool parallelCompile;
+        // shared by every copy of a Shader, they all hold the same program name
+        static std::vector<PendingProgram> pendingPrograms;
+        // pipelines whose stages are attached on first use, attaching needs the links done
+        static std::vector<GLuint> pendingPipelines;
+
+        static void finishProgram(GLuint program);
+        static bool isProgramReady(GLuint program);
+        static GLuint compileShader(GLenum stage, const std::string& source);
+
+        static std::string addDefines(const std::string& source, const std::vector<std::string>& defines);
+        static void shaderCompileLog(GLuint shaderId);
+        static void shaderLinkLog(GLuint shaderProgramId);
     };
     
 }
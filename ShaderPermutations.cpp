@@ -0,0 +1,113 @@
+#include "ShaderPermutations.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace gps {
+
+    ShaderPermutations::ShaderPermutations() : sourceHash(Shader::HASH_SEED), vertexProgram(0) {
+    }
+
+    void ShaderPermutations::load(std::string vertexShaderFileName, std::string fragmentShaderFileName) {
+
+        vertexFileName = vertexShaderFileName;
+        fragmentFileName = fragmentShaderFileName;
+        vertexSource = Shader::readShaderFile(vertexShaderFileName);
+        fragmentSource = Shader::readShaderFile(fragmentShaderFileName);
+        // the separator keeps "ab" + "c" and "a" + "bc" apart
+        sourceHash = Shader::hashString(fragmentSource, Shader::hashString(vertexSource) ^ 0xff);
+        vertexProgram = Shader::createStageProgram(GL_VERTEX_SHADER, vertexSource, std::vector<std::string>());
+    }
+
+    GLuint ShaderPermutations::getVertexProgram() {
+
+        return vertexProgram;
+    }
+
+    int ShaderPermutations::getVariant(std::vector<std::string> defines) {
+
+        std::sort(defines.begin(), defines.end());
+        defines.erase(std::unique(defines.begin(), defines.end()), defines.end());
+        std::string joined;
+        for (size_t i = 0; i < defines.size(); i++) {
+            joined += (i > 0 ? " " : "") + defines[i];
+        }
+
+        unsigned long long key = Shader::hashString(joined, sourceHash);
+        std::unordered_map<unsigned long long, int>::iterator found = variantOfKey.find(key);
+        if (found != variantOfKey.end()) {
+            return found->second;
+        }
+
+        Variant variant;
+        variant.defines = joined;
+        variant.key = key;
+        variant.uses = 0;
+        variant.compileTime = -1.0;
+        variant.submitted = std::chrono::steady_clock::now();
+        variant.shader.loadPipeline(vertexProgram, Shader::createStageProgram(GL_FRAGMENT_SHADER, fragmentSource, defines));
+
+        variants.push_back(variant);
+        variantOfKey[key] = (int)variants.size() - 1;
+        return (int)variants.size() - 1;
+    }
+
+    bool ShaderPermutations::isReady(int variant) {
+
+        if (variants[variant].compileTime >= 0.0) {
+            return true;
+        }
+        if (!variants[variant].shader.isReady()) {
+            return false;
+        }
+        markReady(variants[variant]);
+        return true;
+    }
+
+    void ShaderPermutations::markReady(Variant& variant) {
+
+        if (variant.compileTime < 0.0) {
+            variant.compileTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - variant.submitted).count();
+        }
+    }
+
+    int ShaderPermutations::getVariantCount() {
+
+        return (int)variants.size();
+    }
+
+    gps::Shader& ShaderPermutations::getShader(int variant) {
+
+        return variants[variant].shader;
+    }
+
+    gps::Shader& ShaderPermutations::use(int variant) {
+
+        variants[variant].uses++;
+        variants[variant].shader.useShaderProgram();
+        markReady(variants[variant]);
+        return variants[variant].shader;
+    }
+
+    void ShaderPermutations::printReport() {
+
+        int used = 0;
+        for (size_t i = 0; i < variants.size(); i++) {
+            used += variants[i].uses > 0 ? 1 : 0;
+        }
+        // one shared vertex stage and a fragment stage per variant, instead of a full program each
+        fprintf(stdout, "Shader variants of %s / %s: %d compiled, %d used, vertex stage compiled once instead of %d times\n",
+            vertexFileName.c_str(), fragmentFileName.c_str(), (int)variants.size(), used, (int)variants.size());
+        for (size_t i = 0; i < variants.size(); i++) {
+            // the ready time of a variant that was never used or polled is unknown
+            char readyTime[32];
+            if (variants[i].compileTime >= 0.0) {
+                snprintf(readyTime, sizeof(readyTime), "%6.1f ms", variants[i].compileTime * 1000.0);
+            } else {
+                snprintf(readyTime, sizeof(readyTime), "%9s", "-");
+            }
+            fprintf(stdout, "  %016llx %10lld uses  ready in %s  %s\n", variants[i].key, variants[i].uses,
+                readyTime, variants[i].defines.empty() ? "(no defines)" : variants[i].defines.c_str());
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef ShaderPermutations_hpp
+#define ShaderPermutations_hpp
+
+#include "Shader.hpp"
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Variants of one vertex/fragment shader pair, each compiled with its own set of
+    // #defines. A variant is compiled the first time it is asked for and cached under the
+    // hash of the two sources and its sorted defines, so a set never compiles twice.
+    // The defines only select fragment features: the vertex stage is one separable program
+    // shared by the program pipelines of every variant, which only link their fragment stage
+    class ShaderPermutations {
+
+    public:
+        ShaderPermutations();
+
+        // Reads the two sources and starts the compile of the shared vertex stage, no
+        // variant is compiled yet
+        void load(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+
+        // The vertex stage of every variant, its uniforms (model, view, projection,
+        // normalMatrix) are set once with glProgramUniform for all of them
+        GLuint getVertexProgram();
+
+        // Index of the variant with these defines in any order. The first request starts
+        // its compile and returns without waiting for it
+        int getVariant(std::vector<std::string> defines);
+
+        // Whether the variant is done compiling, see Shader::isReady
+        bool isReady(int variant);
+
+        int getVariantCount();
+        gps::Shader& getShader(int variant);
+
+        // Makes the variant current and counts the use for the report, waits for the
+        // compile when it isn't done
+        gps::Shader& use(int variant);
+
+        // Prints every compiled variant with the time it took to get ready and its number of uses
+        void printReport();
+
+    private:
+        struct Variant {
+            std::string defines;
+            unsigned long long key;
+            gps::Shader shader;
+            std::chrono::steady_clock::time_point submitted;
+            // from the request to the compile being done, negative until then
+            double compileTime;
+            long long uses;
+        };
+
+        std::string vertexFileName;
+        std::string fragmentFileName;
+        std::string vertexSource;
+        std::string fragmentSource;
+        unsigned long long sourceHash;
+        GLuint vertexProgram;
+
+        std::vector<Variant> variants;
+        std::unordered_map<unsigned long long, int> variantOfKey;
+
+        void markReady(Variant& variant);
+    };
+}
+
+#endif /* ShaderPermutations_hpp */
@@ -0,0 +1,95 @@
+#include "ShadowProxy.hpp"
+#include "Bounds.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <unordered_map>
+
+namespace gps {
+
+    namespace {
+        // bits per axis of a packed cell key
+        const int CELL_BITS = 21;
+        const long long CELL_MAX = (1LL << CELL_BITS) - 1;
+
+        long long cellCoordinate(float value, float origin, float cellSize) {
+
+            long long cell = (long long)std::floor((value - origin) / cellSize);
+            return std::min(std::max(cell, 0LL), CELL_MAX);
+        }
+    }
+
+    ShadowProxy simplifyForShadow(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices,
+                                  float cellSize, const std::vector<float>& triangleOpacity, float minOpacity) {
+
+        AABB bounds;
+        for (size_t i = 0; i < positions.size(); i++) {
+            bounds.extend(positions[i]);
+        }
+
+        // cluster of every position, clusters are numbered in order of appearance
+        std::unordered_map<long long, GLuint> cellClusters;
+        std::vector<GLuint> clusterOf(positions.size());
+        std::vector<glm::vec3> clusterSums;
+        std::vector<int> clusterCounts;
+        for (size_t i = 0; i < positions.size(); i++) {
+            long long key = cellCoordinate(positions[i].x, bounds.min.x, cellSize) |
+                            cellCoordinate(positions[i].y, bounds.min.y, cellSize) << CELL_BITS |
+                            cellCoordinate(positions[i].z, bounds.min.z, cellSize) << (2 * CELL_BITS);
+
+            std::unordered_map<long long, GLuint>::iterator found = cellClusters.find(key);
+            if (found == cellClusters.end()) {
+                found = cellClusters.insert(std::make_pair(key, (GLuint)clusterSums.size())).first;
+                clusterSums.push_back(glm::vec3(0.0f));
+                clusterCounts.push_back(0);
+            }
+            clusterOf[i] = found->second;
+            clusterSums[found->second] += positions[i];
+            clusterCounts[found->second]++;
+        }
+
+        // triangles over clusters, rotated to start at their smallest index so copies match
+        // while the winding is kept
+        std::vector<std::array<GLuint, 3> > triangles;
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+            if (!triangleOpacity.empty() && triangleOpacity[t / 3] < minOpacity) {
+                continue;
+            }
+
+            GLuint a = clusterOf[indices[t]];
+            GLuint b = clusterOf[indices[t + 1]];
+            GLuint c = clusterOf[indices[t + 2]];
+            if (a == b || b == c || a == c) {
+                continue;
+            }
+
+            std::array<GLuint, 3> triangle = { { a, b, c } };
+            if (b < a && b < c) {
+                triangle[0] = b; triangle[1] = c; triangle[2] = a;
+            } else if (c < a && c < b) {
+                triangle[0] = c; triangle[1] = a; triangle[2] = b;
+            }
+            triangles.push_back(triangle);
+        }
+        std::sort(triangles.begin(), triangles.end());
+        triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+        // only the clusters still used by a triangle are kept
+        ShadowProxy proxy;
+        std::vector<GLuint> remap(clusterSums.size(), (GLuint)-1);
+        proxy.indices.reserve(triangles.size() * 3);
+        for (size_t t = 0; t < triangles.size(); t++) {
+            for (int v = 0; v < 3; v++) {
+                GLuint cluster = triangles[t][v];
+                if (remap[cluster] == (GLuint)-1) {
+                    remap[cluster] = (GLuint)proxy.positions.size();
+                    proxy.positions.push_back(clusterSums[cluster] / (float)clusterCounts[cluster]);
+                }
+                proxy.indices.push_back(remap[cluster]);
+            }
+        }
+
+        return proxy;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef ShadowProxy_hpp
+#define ShadowProxy_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Simplified, material agnostic copy of a mesh drawn by the shadow passes
+    struct ShadowProxy {
+
+        std::vector<glm::vec3> positions;
+        std::vector<GLuint> indices;
+    };
+
+    // Vertex clustering: the positions falling in the same cell of a grid of cellSize are
+    // merged into their average and the triangles that collapse are dropped.
+    // With triangleOpacity, triangles less opaque than minOpacity are dropped first
+    ShadowProxy simplifyForShadow(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices,
+                                  float cellSize, const std::vector<float>& triangleOpacity, float minOpacity);
+}
+
+#endif /* ShadowProxy_hpp */
@@ -0,0 +1,100 @@
+#include "ThreadPool.hpp"
+
+namespace gps {
+
+    ThreadPool::ThreadPool(int threadCount)
+        : currentJob(NULL), jobCount(0), nextIndex(0), finishedWorkers(0), generation(0), stopping(false) {
+
+        if (threadCount <= 0) {
+            threadCount = (int)std::thread::hardware_concurrency();
+        }
+        if (threadCount < 1) {
+            threadCount = 1;
+        }
+
+        // the calling thread also takes jobs
+        for (int i = 0; i < threadCount - 1; i++) {
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeCondition.notify_all();
+
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    int ThreadPool::getThreadCount() {
+        return (int)workers.size() + 1;
+    }
+
+    void ThreadPool::runJobs() {
+
+        for (int index = nextIndex.fetch_add(1); index < jobCount; index = nextIndex.fetch_add(1)) {
+            (*currentJob)(index);
+        }
+    }
+
+    void ThreadPool::workerLoop() {
+
+        int seenGeneration = 0;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                if (stopping) {
+                    return;
+                }
+                seenGeneration = generation;
+            }
+
+            runJobs();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finishedWorkers++;
+            }
+            doneCondition.notify_all();
+        }
+    }
+
+    void ThreadPool::parallelFor(int count, const std::function<void(int)>& job) {
+
+        if (count <= 0) {
+            return;
+        }
+
+        if (workers.empty() || count == 1) {
+            for (int i = 0; i < count; i++) {
+                job(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentJob = &job;
+            jobCount = count;
+            nextIndex = 0;
+            finishedWorkers = 0;
+            generation++;
+        }
+        wakeCondition.notify_all();
+
+        runJobs();
+
+        // once every worker has left runJobs all jobs are done and none of them
+        // can still be reading the job state when the next call replaces it
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [&] { return finishedWorkers == (int)workers.size(); });
+        currentJob = NULL;
+    }
+}
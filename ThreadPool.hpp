@@ -0,0 +1,48 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Fixed set of worker threads kept alive for the whole run, so per frame
+    // jobs don't pay for creating threads
+    class ThreadPool {
+
+    public:
+        // threadCount 0 uses every hardware thread
+        ThreadPool(int threadCount = 0);
+        ~ThreadPool();
+
+        // Runs job(0) .. job(count - 1) on the workers and the calling thread,
+        // returns when all of them are done
+        void parallelFor(int count, const std::function<void(int)>& job);
+
+        // workers plus the calling thread
+        int getThreadCount();
+
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wakeCondition;
+        std::condition_variable doneCondition;
+
+        const std::function<void(int)>* currentJob;
+        int jobCount;
+        std::atomic<int> nextIndex;
+        // every worker takes part in every call and reports here when it is done
+        int finishedWorkers;
+        int generation;
+        bool stopping;
+
+        void workerLoop();
+        void runJobs();
+    };
+}
+
+#endif /* ThreadPool_hpp */
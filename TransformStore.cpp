@@ -0,0 +1,225 @@
+#include "TransformStore.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define TRANSFORMS_SSE
+    #include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    namespace {
+#ifdef TRANSFORMS_SSE
+        inline __m128 broadcast(__m128 v, int lane) {
+            switch (lane) {
+            case 0: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+            case 1: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+            case 2: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+            default: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+            }
+        }
+
+        // xyz of a and b crossed, w ends up 0 when both w are equal
+        inline __m128 cross(__m128 a, __m128 b) {
+            __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+            __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+            __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+            return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+        }
+
+        inline float dot3(__m128 a, __m128 b) {
+            __m128 p = _mm_mul_ps(a, b);
+            __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+            __m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+            return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(p, y), z));
+        }
+#endif
+
+        // out = a * b, column major, out may not alias a or b
+        void multiply(const float* a, const float* b, float* out) {
+#ifdef TRANSFORMS_SSE
+            __m128 a0 = _mm_loadu_ps(a);
+            __m128 a1 = _mm_loadu_ps(a + 4);
+            __m128 a2 = _mm_loadu_ps(a + 8);
+            __m128 a3 = _mm_loadu_ps(a + 12);
+            for (int column = 0; column < 4; column++) {
+                __m128 b0 = _mm_loadu_ps(b + 4 * column);
+                __m128 r = _mm_mul_ps(a0, broadcast(b0, 0));
+                r = _mm_add_ps(r, _mm_mul_ps(a1, broadcast(b0, 1)));
+                r = _mm_add_ps(r, _mm_mul_ps(a2, broadcast(b0, 2)));
+                r = _mm_add_ps(r, _mm_mul_ps(a3, broadcast(b0, 3)));
+                _mm_storeu_ps(out + 4 * column, r);
+            }
+#else
+            for (int column = 0; column < 4; column++) {
+                for (int row = 0; row < 4; row++) {
+                    out[4 * column + row] = a[row] * b[4 * column] + a[4 + row] * b[4 * column + 1]
+                        + a[8 + row] * b[4 * column + 2] + a[12 + row] * b[4 * column + 3];
+                }
+            }
+#endif
+        }
+
+        // inverse transpose of the upper 3x3 of m: with columns a, b, c it is
+        // (b x c, c x a, a x b) / det, det = a . (b x c)
+        void normalMatrix(const float* m, float* out) {
+#ifdef TRANSFORMS_SSE
+            // the w of the first three columns of an affine matrix is 0
+            __m128 a = _mm_loadu_ps(m);
+            __m128 b = _mm_loadu_ps(m + 4);
+            __m128 c = _mm_loadu_ps(m + 8);
+            __m128 n0 = cross(b, c);
+            __m128 n1 = cross(c, a);
+            __m128 n2 = cross(a, b);
+            float det = dot3(a, n0);
+            __m128 invDet = _mm_set1_ps(det != 0.0f ? 1.0f / det : 0.0f);
+            _mm_storeu_ps(out, _mm_mul_ps(n0, invDet));
+            _mm_storeu_ps(out + 4, _mm_mul_ps(n1, invDet));
+            _mm_storeu_ps(out + 8, _mm_mul_ps(n2, invDet));
+#else
+            glm::vec3 a(m[0], m[1], m[2]);
+            glm::vec3 b(m[4], m[5], m[6]);
+            glm::vec3 c(m[8], m[9], m[10]);
+            glm::vec3 n[3] = { glm::cross(b, c), glm::cross(c, a), glm::cross(a, b) };
+            float det = glm::dot(a, n[0]);
+            float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+            for (int column = 0; column < 3; column++) {
+                out[4 * column] = n[column].x * invDet;
+                out[4 * column + 1] = n[column].y * invDet;
+                out[4 * column + 2] = n[column].z * invDet;
+                out[4 * column + 3] = 0.0f;
+            }
+#endif
+        }
+    }
+
+    TransformStore::TransformStore() : updatedCount(0) {
+    }
+
+    TransformStore::Handle TransformStore::create(Handle parent) {
+
+        translations.push_back(glm::vec3(0.0f));
+        rotations.push_back(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        scales.push_back(glm::vec3(1.0f));
+        pivots.push_back(glm::vec3(0.0f));
+        parents.push_back(parent);
+        dirty.push_back(1);
+        world.push_back(glm::mat4(1.0f));
+        worldView.push_back(glm::mat4(1.0f));
+        for (int column = 0; column < 3; column++) {
+            normalMatrices.push_back(glm::vec4(0.0f));
+        }
+        return (Handle)parents.size() - 1;
+    }
+
+    void TransformStore::setTranslation(Handle entity, glm::vec3 translation) {
+
+        if (translations[entity] != translation) {
+            translations[entity] = translation;
+            dirty[entity] = 1;
+        }
+    }
+
+    void TransformStore::setRotation(Handle entity, float angle, glm::vec3 axis) {
+
+        float length = glm::length(axis);
+        glm::vec3 unitAxis = length > 0.0f ? axis / length : glm::vec3(0.0f, 1.0f, 0.0f);
+        float s = std::sin(angle * 0.5f);
+        glm::vec4 rotation(unitAxis * s, std::cos(angle * 0.5f));
+        if (rotations[entity] != rotation) {
+            rotations[entity] = rotation;
+            dirty[entity] = 1;
+        }
+    }
+
+    void TransformStore::setScale(Handle entity, glm::vec3 scale) {
+
+        if (scales[entity] != scale) {
+            scales[entity] = scale;
+            dirty[entity] = 1;
+        }
+    }
+
+    void TransformStore::setPivot(Handle entity, glm::vec3 pivot) {
+
+        if (pivots[entity] != pivot) {
+            pivots[entity] = pivot;
+            dirty[entity] = 1;
+        }
+    }
+
+    glm::mat4 TransformStore::computeLocal(Handle entity) {
+
+        const glm::vec4& q = rotations[entity];
+        const glm::vec3& s = scales[entity];
+        const glm::vec3& p = pivots[entity];
+
+        // rotation times scale, then the pivot is moved to the origin and back
+        glm::mat4 local(1.0f);
+        local[0] = glm::vec4(1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y + q.z * q.w), 2.0f * (q.x * q.z - q.y * q.w), 0.0f) * s.x;
+        local[1] = glm::vec4(2.0f * (q.x * q.y - q.z * q.w), 1.0f - 2.0f * (q.x * q.x + q.z * q.z), 2.0f * (q.y * q.z + q.x * q.w), 0.0f) * s.y;
+        local[2] = glm::vec4(2.0f * (q.x * q.z + q.y * q.w), 2.0f * (q.y * q.z - q.x * q.w), 1.0f - 2.0f * (q.x * q.x + q.y * q.y), 0.0f) * s.z;
+        glm::vec3 rotatedPivot = glm::vec3(local[0]) * p.x + glm::vec3(local[1]) * p.y + glm::vec3(local[2]) * p.z;
+        local[3] = glm::vec4(translations[entity] + p - rotatedPivot, 1.0f);
+        return local;
+    }
+
+    void TransformStore::updateWorld() {
+
+        // parents come before their children, so a parent is final when its children are reached
+        for (size_t i = 0; i < parents.size(); i++) {
+            int parent = parents[i];
+            if (parent >= 0 && dirty[parent]) {
+                dirty[i] = 1;
+            }
+            if (!dirty[i]) {
+                continue;
+            }
+            glm::mat4 local = computeLocal((Handle)i);
+            if (parent >= 0) {
+                multiply(&world[parent][0][0], &local[0][0], &world[i][0][0]);
+            } else {
+                world[i] = local;
+            }
+            updatedCount++;
+        }
+        std::memset(dirty.data(), 0, dirty.size());
+    }
+
+    void TransformStore::updateView(const glm::mat4& view) {
+
+        for (size_t i = 0; i < world.size(); i++) {
+            multiply(&view[0][0], &world[i][0][0], &worldView[i][0][0]);
+            normalMatrix(&worldView[i][0][0], &normalMatrices[3 * i][0]);
+        }
+    }
+
+    const glm::mat4& TransformStore::getWorld(Handle entity) {
+
+        return world[entity];
+    }
+
+    const glm::mat4& TransformStore::getWorldView(Handle entity) {
+
+        return worldView[entity];
+    }
+
+    const glm::vec4* TransformStore::getNormalMatrix(Handle entity) {
+
+        return &normalMatrices[3 * entity];
+    }
+
+    int TransformStore::getCount() {
+
+        return (int)parents.size();
+    }
+
+    int TransformStore::takeUpdatedCount() {
+
+        int count = updatedCount;
+        updatedCount = 0;
+        return count;
+    }
+}
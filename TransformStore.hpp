@@ -0,0 +1,68 @@
+#ifndef TransformStore_hpp
+#define TransformStore_hpp
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Transforms of the scene's objects, one slot per entity in flat arrays: the local
+    // translation, rotation and scale about a pivot, the parent, a dirty flag and the
+    // matrices computed from them. Animations only write the local parts; updateWorld
+    // recomputes the world matrix of every dirty entity and its children, updateView the
+    // world-view and normal matrices of all of them, four floats at a time with SSE
+    class TransformStore {
+
+    public:
+        typedef int Handle;
+
+        TransformStore();
+
+        // parent must have been created before the child, -1 for a root
+        Handle create(Handle parent = -1);
+
+        // the setters only mark the entity dirty when the value changes, so the animations
+        // can set every frame what only moves now and then
+        void setTranslation(Handle entity, glm::vec3 translation);
+        // angle in radians about axis
+        void setRotation(Handle entity, float angle, glm::vec3 axis);
+        void setScale(Handle entity, glm::vec3 scale);
+        // point the rotation and the scale are about, in the entity's own space
+        void setPivot(Handle entity, glm::vec3 pivot);
+
+        // world = parent world * translate(translation + pivot) * rotation * scale * translate(-pivot)
+        void updateWorld();
+        void updateView(const glm::mat4& view);
+
+        const glm::mat4& getWorld(Handle entity);
+        const glm::mat4& getWorldView(Handle entity);
+        // inverse transpose of the world-view matrix's upper 3x3, its three columns padded to
+        // vec4 like a std140 mat3
+        const glm::vec4* getNormalMatrix(Handle entity);
+
+        int getCount();
+        // world matrices recomputed since the last call
+        int takeUpdatedCount();
+
+    private:
+        std::vector<glm::vec3> translations;
+        // unit quaternions, xyz the axis part and w the angle part
+        std::vector<glm::vec4> rotations;
+        std::vector<glm::vec3> scales;
+        std::vector<glm::vec3> pivots;
+        std::vector<int> parents;
+        std::vector<unsigned char> dirty;
+
+        std::vector<glm::mat4> world;
+        std::vector<glm::mat4> worldView;
+        // three columns per entity
+        std::vector<glm::vec4> normalMatrices;
+
+        int updatedCount;
+
+        glm::mat4 computeLocal(Handle entity);
+    };
+}
+
+#endif /* TransformStore_hpp */
@@ -18,10 +18,31 @@
 #include "Camera.hpp"
 #include "Model3D.hpp"
 #include "SkyBox.hpp"
+#include "BVH.hpp"
+#include "OcclusionCuller.hpp"
+#include "OcclusionQueries.hpp"
+#include "ThreadPool.hpp"
+#include "GpuTimer.hpp"
+#include "LightManager.hpp"
+#include "LightClusters.hpp"
+#include "DeferredShading.hpp"
+#include "PointShadows.hpp"
+#include "RayTracer.hpp"
+#include "Lightmap.hpp"
+#include "IrradianceProbes.hpp"
+#include "ShaderPermutations.hpp"
+#include "ProgramBinaryCache.hpp"
+#include "ConstantRing.hpp"
+#include "TransformStore.hpp"
+#include "MaterialTable.hpp"
+#include "CommandBuffer.hpp"
+#include "RenderGraph.hpp"
 #include <iostream>
 #include <irrKlang.h>
 #include <string.h>
+#include <algorithm>
 #include <stdio.h>
+#include <stdlib.h>
 #pragma comment(lib, "irrKlang.lib") // link with irrKlang.dll
 
 // window
@@ -83,6 +104,161 @@ gps::Model3D pole_light2;
 gps::Model3D pole_light3;
 GLfloat angle;
 
+// scene objects - every object is drawn with a single model matrix
+enum SceneObject { OBJ_CAT, OBJ_SCENE, OBJ_GROUND, OBJ_BROOM, OBJ_TEAPOT, OBJ_SPOON, OBJ_BIG_GRASS, OBJ_COUNT };
+gps::Model3D* objectModels[OBJ_COUNT] = { &cat, &scene, &ground, &broom, &teapot, &spoon, &big_grass };
+bool objectAnimated[OBJ_COUNT] = { true, false, false, true, true, true, false };
+// the objects' transforms, the static ones are children of the scene root
+gps::TransformStore transforms;
+gps::TransformStore::Handle sceneRoot;
+gps::TransformStore::Handle objectTransforms[OBJ_COUNT];
+
+// scene BVH - one primitive for every mesh of every object
+struct MeshInstance {
+    int object;
+    int mesh;
+};
+std::vector<MeshInstance> meshInstances;
+std::vector<gps::AABB> instanceBounds;
+int objectFirstInstance[OBJ_COUNT];
+std::vector<int> animatedInstances;
+std::vector<bool> instanceVisible;
+std::vector<int> queryResult;
+gps::BVH sceneBVH;
+
+// worker threads shared by the per frame CPU jobs
+gps::ThreadPool workerPool;
+
+// occlusion culling, switched at runtime
+enum OcclusionMode { OCCLUSION_OFF, OCCLUSION_SOFTWARE, OCCLUSION_GPU, OCCLUSION_MODE_COUNT };
+const char* occlusionModeNames[OCCLUSION_MODE_COUNT] = { "off", "software", "GPU queries" };
+OcclusionMode occlusionMode = OCCLUSION_SOFTWARE;
+gps::Frustum cameraFrustum;
+
+// software occlusion culling
+const int MAX_OCCLUDERS = 16;
+const size_t MAX_OCCLUDER_TRIANGLES = 8192;
+// the chosen occluders are rasterized as proxies clustered on a grid of this many world units
+const float OCCLUDER_PROXY_CELL_SIZE = 0.02f;
+gps::OcclusionCuller occlusionCuller(&workerPool);
+// occluder mesh id of every instance, -1 for the ones that only get tested
+std::vector<int> instanceOccluder;
+
+// GPU occlusion queries, used for the heavy meshes and the light glow meshes
+const size_t HEAVY_MESH_TRIANGLES = 1000;
+gps::OcclusionQueries occlusionQueries;
+std::vector<int> instanceQuerySlot;
+gps::Model3D* glowModels[] = { &house_light, &pole_light1, &pole_light2, &pole_light3, &candle1, &candle2, &candle3 };
+const int GLOW_MODEL_COUNT = sizeof(glowModels) / sizeof(glowModels[0]);
+int glowFirstSlot[GLOW_MODEL_COUNT];
+
+// point lights: the lanterns and candles, then the fireflies. Each frame they are range
+// culled against the visible meshes, then binned into froxels
+gps::LightManager lightManager;
+const int FIREFLY_COUNT = 256;
+const glm::vec3 FIREFLY_COLOR = glm::vec3(0.12f, 0.16f, 0.02f);
+struct Firefly {
+    glm::vec3 home;
+    glm::vec3 phase;
+    float speed;
+};
+std::vector<Firefly> fireflies;
+int firstFireflyLight = 0;
+gps::LightClusters lightClusters(&workerPool);
+bool showClusterHeatmap = false;
+
+// main pass lighting, switched at runtime to compare the two on frame time
+enum RenderPath { RENDER_FORWARD, RENDER_DEFERRED, RENDER_PATH_COUNT };
+const char* renderPathNames[RENDER_PATH_COUNT] = { "clustered forward", "deferred" };
+RenderPath renderPath = RENDER_FORWARD;
+gps::DeferredShading deferredShading;
+
+// shadows of the lanterns and candles: cached cube faces, at most this many redrawn per frame
+const int POINT_SHADOW_FACE_BUDGET = 6;
+gps::PointShadows pointShadows;
+std::vector<int> pointShadowFaces;
+std::vector<bool> pointCasterVisible;
+// boxes of the animated meshes when the faces were last checked against them
+std::vector<gps::AABB> pointShadowCasterBounds;
+
+// baked lighting: the moon, the lanterns and candles and ambient occlusion baked offline
+// (run with --bake), into lightmaps for the static objects and into irradiance probes for
+// the moving ones. The fireflies stay dynamic
+const glm::vec3 MOON_COLOR = glm::vec3(0.1f, 0.15f, 0.25f);
+const float LIGHTMAP_TEXELS_PER_UNIT = 64.0f;
+const int LIGHTMAP_MAX_SIZE = 2048;
+const int LIGHTMAP_AO_SAMPLES = 32;
+const float LIGHTMAP_AO_DISTANCE = 0.5f;
+// triangles of transparent textures below this opacity let the bake rays through
+const float LIGHTMAP_MIN_OCCLUDER_OPACITY = 0.5f;
+const char* objectLightmapFiles[OBJ_COUNT] = { NULL, "models/main_scene/main_scene.lmap", "models/ground/ground.lmap",
+                                               NULL, NULL, NULL, "models/main_scene/big_grass.lmap" };
+GLuint objectLightmaps[OBJ_COUNT];
+const float PROBE_SPACING = 0.25f;
+const char* PROBES_FILE = "models/main_scene/irradiance.probes";
+gps::IrradianceProbes irradianceProbes;
+bool bakedLightingMode = false;
+
+// shadow proxies: casters are simplified on a grid of this many world units, meshes with
+// transparent textures (foliage) on a coarser one
+const float SHADOW_PROXY_CELL_SIZE = 0.01f;
+const float FOLIAGE_PROXY_CELL_SIZE = 0.04f;
+
+// cascaded shadow map: the camera frustum up to SHADOW_DISTANCE is split in slices,
+// each one covered by its own light matrix and layer of the depth texture array
+const int CASCADE_COUNT = 4;
+const unsigned int CASCADE_SIZE = 1024;
+const float SHADOW_DISTANCE = 12.0f;
+// blend between uniform (0) and logarithmic (1) split distances
+const float CASCADE_SPLIT_LAMBDA = 0.75f;
+glm::mat4 lightSpaceTrMatrices[CASCADE_COUNT];
+// the light matrix of each cascade centered on the light space origin, and the snapped
+// center it is moved to in whole texels: only the center follows the camera
+glm::mat4 cascadeCenteredMatrices[CASCADE_COUNT];
+glm::ivec2 cascadeOrigins[CASCADE_COUNT];
+// view space depth where each cascade ends
+float cascadeSplits[CASCADE_COUNT];
+// camera frustum slice of each cascade
+gps::Frustum cascadeFrustums[CASCADE_COUNT];
+// cascade drawn by the shadow passes
+int currentCascade = 0;
+
+// shadow caster culling, per cascade
+gps::Frustum casterVolumes[CASCADE_COUNT];
+std::vector<bool> casterVisible[CASCADE_COUNT];
+std::vector<bool> staticCasterVisible[CASCADE_COUNT];
+// casters are swept this far along the light to find where their shadow lands
+float shadowSweepLength = 0.0f;
+gps::AABB sceneBounds;
+
+// statistics, averaged and printed every few seconds
+enum RenderPass { PASS_STATIC_SHADOW, PASS_SHADOW, PASS_POINT_SHADOW, PASS_MAIN, PASS_COUNT };
+const char* renderPassNames[PASS_COUNT] = { "static shadow", "shadow", "point shadow", "main" };
+struct FrameStats {
+    int frames;
+    int draws[PASS_COUNT];
+    double triangles[PASS_COUNT];
+    int occlusionTested;
+    int occlusionCulled;
+    double occlusionTime;
+    double lightCullTime;
+    double activeLights;
+    double lightListEntries;
+    double clusterTime;
+    double clusterIndices;
+    double occupiedClusters;
+    double lightVolumes;
+    int pointShadowFaces;
+    int fallbackDraws;
+    double recordedCommands;
+    double recordTime;
+    double replayTime;
+};
+FrameStats frameStats;
+double statsStart = 0.0;
+gps::GpuTimer shadowPassTimer;
+gps::GpuTimer mainPassTimer;
+
 //cat roation
 GLfloat catRotaition = 0.0f;
 
@@ -98,19 +274,135 @@ gps::Shader lightShader;
 gps::Shader screenQuadShader;
 gps::Shader depthMapShader;
 gps::Shader skyboxShader;
+gps::Shader boundingBoxShader;
+gps::Shader evsmMomentsShader;
+gps::Shader evsmBlurShader;
+gps::Shader deferredMoonShader;
+gps::Shader deferredLightShader;
+
+// variants of shaderStart, each draw uses the one with only the features it needs
+enum ShaderFeature {
+    FEATURE_TEXTURED = 1 << 0,
+    FEATURE_SPECULAR_MAP = 1 << 1,
+    FEATURE_ALPHA_TEST = 1 << 2,
+    FEATURE_SHADOWED = 1 << 3,
+    FEATURE_POINT_LIGHTS = 1 << 4,
+    FEATURE_FOG = 1 << 5,
+    FEATURE_GBUFFER = 1 << 6,
+    FEATURE_LIGHTMAP = 1 << 7,
+    FEATURE_PROBES = 1 << 8
+};
+const int SHADER_FEATURE_COUNT = 9;
+// the #define of every feature, in bit order
+const char* SHADER_FEATURE_DEFINES[SHADER_FEATURE_COUNT] = {
+    "TEXTURED", "SPECULAR_MAP", "ALPHA_TEST", "SHADOWED", "POINT_LIGHTS", "FOG", "GBUFFER", "LIGHTMAP", "PROBES"
+};
+gps::ShaderPermutations basicShaderVariants;
+// variant of every feature mask, -1 until a draw first needs it
+std::vector<int> basicVariantOfFeatures(1 << SHADER_FEATURE_COUNT, -1);
+// frame each variant last got the frame uniforms in, they are set on its first draw of a frame
+std::vector<long long> variantUniformFrame;
+long long frameIndex = 0;
+// plain forward and G-buffer variants, ready from the start, that draw in place of a variant
+// still compiling on the driver's threads
+int fallbackForwardVariant = -1;
+int fallbackGBufferVariant = -1;
+// TEXTURED, SPECULAR_MAP and ALPHA_TEST of every mesh instance's material
+std::vector<int> instanceMaterialFeatures;
+
+// linked programs kept between runs, a warm start skips the GLSL compiler
+const char* PROGRAM_CACHE_DIRECTORY = "shaders/cache";
+gps::ProgramBinaryCache programBinaryCache;
+// loading the shaders and the startup variants, reported once both are done
+double shaderInitTime = 0.0;
+
+// per-draw constants of the DrawConstants block in shaderStart.vert and depthMapShader.vert,
+// laid out std140
+struct DrawConstants {
+    glm::mat4 model;
+    // a std140 mat3 pads every column to a vec4
+    glm::vec4 normalMatrix[3];
+};
+const GLuint DRAW_CONSTANTS_BINDING = 0;
+// written once per frame for every object, all the passes read the same ones
+gps::ConstantRing drawConstantRing;
+GLintptr objectConstantOffsets[OBJ_COUNT];
+
+// the materials of all the models merged by value, a draw only passes its entry's index
+gps::MaterialTable materialTable;
+const GLuint MATERIAL_ATTRIBUTE = 4;
+const int MATERIAL_TEXTURE_UNIT = 15;
+
+// the draws are recorded as commands, the shadow casters of each cascade and the objects
+// of the main pass on the workers, and replayed on the GL thread
+enum DrawCommandType { CMD_BIND_CONSTANTS, CMD_BIND_LIGHTMAP, CMD_DRAW_SHADOW, CMD_DRAW_SHADOW_OVERRIDE, CMD_DRAW_MAIN };
+gps::CommandBuffer cascadeCommands[CASCADE_COUNT];
+gps::CommandBuffer mainPassCommands[OBJ_COUNT];
+// passes whose culling happens between their draws record and replay on the GL thread
+gps::CommandBuffer immediateCommands;
+const int mainPassOrder[OBJ_COUNT] = { OBJ_SCENE, OBJ_GROUND, OBJ_BROOM, OBJ_TEAPOT, OBJ_SPOON, OBJ_CAT, OBJ_BIG_GRASS };
+const int dynamicCasters[] = { OBJ_CAT, OBJ_BROOM, OBJ_TEAPOT, OBJ_SPOON };
+const int DYNAMIC_CASTER_COUNT = 4;
+bool parallelRecording = true;
+
+// the passes of a frame and what they read and write, see initRenderGraph
+gps::RenderGraph frameGraph;
+gps::RenderGraph::Resource shadowDepthResource;
+gps::RenderGraph::Resource shadowMomentsResource;
+// moments blurred only horizontally, between the two blur passes
+gps::RenderGraph::Resource shadowBlurResource;
+gps::RenderGraph::Resource pointShadowResource;
+gps::RenderGraph::Resource sceneColorResource;
+gps::RenderGraph::Resource sceneDepthResource;
+gps::RenderGraph::Resource occlusionResultsResource;
+gps::RenderGraph::Pass momentsPass;
+gps::RenderGraph::Pass mainPass;
+gps::RenderGraph::Pass lightGlowPass;
+gps::RenderGraph::Pass occlusionQueryPass;
+gps::RenderGraph::Pass skyboxPass;
+gps::RenderGraph::Pass depthMapPass;
 
 // skybox
 gps::SkyBox mySkyBox;
 
-// depthTexture
-const unsigned int SHADOW_WIDTH = 4096;  //4096
-const unsigned int SHADOW_HEIGHT = 4096;
-
-GLuint shadowMapFBO;
+// depthTexture, one layer and FBO per cascade
+GLuint shadowMapFBOs[CASCADE_COUNT];
 GLuint depthMapTexture;
+
+// static casters are rendered into their own maps, which are redrawn only when the light,
+// the depth range or the cascade's size changes. When the cascade follows the camera the
+// cached depth is scrolled by as many texels, and only the uncovered strips are drawn.
+// Each frame the maps are copied back under the moving casters
+GLuint staticShadowMapFBOs[CASCADE_COUNT];
+GLuint staticDepthMapTexture;
+bool shadowCaching = true;
+bool staticShadowDirty = true;
+glm::mat4 cachedCenteredMatrices[CASCADE_COUNT];
+glm::ivec2 cachedOrigins[CASCADE_COUNT];
+
+// texel rectangle of the shadow map, x1 and y1 exclusive
+struct ShadowRect {
+    int x0, y0, x1, y1;
+    bool isEmpty() const { return x0 >= x1 || y0 >= y1; }
+};
+ShadowRect previousDynamicRects[CASCADE_COUNT];
+// the cascade's depth layer was redrawn this frame
+bool cascadeDepthChanged[CASCADE_COUNT];
+
+// shadow filtering, switched at runtime
+enum ShadowFilter { SHADOW_HARD, SHADOW_PCF, SHADOW_EVSM, SHADOW_FILTER_COUNT };
+const char* shadowFilterNames[SHADOW_FILTER_COUNT] = { "hard", "hardware PCF", "EVSM" };
+ShadowFilter shadowFilter = SHADOW_EVSM;
+// depth comparison sampler for hardware PCF, the depth array itself stays unfiltered
+GLuint shadowCompareSampler;
+// exponential variance shadow map: warped depth moments of each cascade, blurred and mipmapped
+const float EVSM_EXPONENT = 40.0f;
+GLuint shadowMomentsTexture;
+GLuint shadowMomentsFBOs[CASCADE_COUNT];
 GLuint textureID;
 
 bool showDepthMap;
+GLenum polygonMode = GL_FILL;
 
 // mouse data
 //initial mouse positions
@@ -178,7 +470,7 @@ void windowResizeCallback(GLFWwindow* window, int width, int height) {
 
     //send the updated mtrix to the shader
     myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glProgramUniformMatrix4fv(myBasicShader.vertexProgram, glGetUniformLocation(myBasicShader.vertexProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
 
     skyboxShader.useShaderProgram();
     glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
@@ -190,8 +482,60 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
 
-    if (key == GLFW_KEY_M && action == GLFW_PRESS)
+    if (key == GLFW_KEY_M && action == GLFW_PRESS) {
         showDepthMap = !showDepthMap;
+        // the moments aren't filtered while the depth map is shown, they are redone on the way back
+        staticShadowDirty = true;
+    }
+
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        shadowCaching = !shadowCaching;
+        staticShadowDirty = true;
+        fprintf(stdout, "Static shadow map caching %s\n", shadowCaching ? "on" : "off");
+    }
+
+    if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+        shadowFilter = (ShadowFilter)((shadowFilter + 1) % SHADOW_FILTER_COUNT);
+        // the moments are only kept up to date while EVSM is on
+        staticShadowDirty = true;
+        fprintf(stdout, "Shadow filtering: %s\n", shadowFilterNames[shadowFilter]);
+        frameStats = FrameStats();
+        statsStart = glfwGetTime();
+    }
+
+    if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+        showClusterHeatmap = !showClusterHeatmap;
+    }
+
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        renderPath = (RenderPath)((renderPath + 1) % RENDER_PATH_COUNT);
+        fprintf(stdout, "Render path: %s\n", renderPathNames[renderPath]);
+        frameStats = FrameStats();
+        statsStart = glfwGetTime();
+        mainPassTimer.reset();
+    }
+
+    if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        bakedLightingMode = !bakedLightingMode;
+        fprintf(stdout, "Baked lighting %s%s\n", bakedLightingMode ? "on" : "off",
+            renderPath == RENDER_FORWARD ? "" : " (used by the clustered forward path only)");
+        frameStats = FrameStats();
+        statsStart = glfwGetTime();
+    }
+
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        occlusionMode = (OcclusionMode)((occlusionMode + 1) % OCCLUSION_MODE_COUNT);
+        fprintf(stdout, "Occlusion culling: %s\n", occlusionModeNames[occlusionMode]);
+        frameStats = FrameStats();
+        statsStart = glfwGetTime();
+    }
+
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        parallelRecording = !parallelRecording;
+        fprintf(stdout, "Command recording on %d threads\n", parallelRecording ? workerPool.getThreadCount() : 1);
+        frameStats = FrameStats();
+        statsStart = glfwGetTime();
+    }
 
     if (key == GLFW_KEY_LEFT_SHIFT && action == GLFW_PRESS) {
         mouseCaptured = !mouseCaptured;
@@ -212,17 +556,20 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
     }
 
     if (key == GLFW_KEY_0 && action == GLFW_PRESS) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        polygonMode = GL_FILL;
+        glPolygonMode(GL_FRONT_AND_BACK, polygonMode);
     }
     
     //wireframe
     if (key == GLFW_KEY_1 && action == GLFW_PRESS) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        polygonMode = GL_LINE;
+        glPolygonMode(GL_FRONT_AND_BACK, polygonMode);
     }
     
     //points
     if (key == GLFW_KEY_2 && action == GLFW_PRESS) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
+        polygonMode = GL_POINT;
+        glPolygonMode(GL_FRONT_AND_BACK, polygonMode);
     }
 
 	if (key >= 0 && key < 1024) {
@@ -434,21 +781,65 @@ void initModels() {
     house_light.LoadModel("models/main_scene/light_pole1.obj");
     house_light.LoadModel("models/main_scene/light_pole2.obj");
     house_light.LoadModel("models/main_scene/light_pole3.obj");
-   
+
+    // vertex data fetched by the depth passes, full vertices against the position only stream
+    size_t fullBytes = 0, depthBytes = 0;
+    for (int obj = 0; obj < OBJ_COUNT; obj++) {
+        for (int i = 0; i < objectModels[obj]->getMeshCount(); i++) {
+            gps::Mesh& mesh = objectModels[obj]->getMesh(i);
+            fullBytes += mesh.vertices.size() * sizeof(gps::Vertex);
+            depthBytes += mesh.positions.size() * sizeof(glm::vec3);
+        }
+    }
+    fprintf(stdout, "Depth pass vertex data: %.2f MB position only, %.2f MB interleaved (%.1fx less)\n",
+        depthBytes / (1024.0 * 1024.0), fullBytes / (1024.0 * 1024.0), depthBytes > 0 ? (double)fullBytes / depthBytes : 0.0);
+}
+
+// variant index of a feature mask, compiled the first time it is asked for
+int getBasicShaderVariant(int features) {
+    if (basicVariantOfFeatures[features] == -1) {
+        std::vector<std::string> defines;
+        for (int bit = 0; bit < SHADER_FEATURE_COUNT; bit++) {
+            if (features & (1 << bit)) {
+                defines.push_back(SHADER_FEATURE_DEFINES[bit]);
+            }
+        }
+        basicVariantOfFeatures[features] = basicShaderVariants.getVariant(defines);
+    }
+    return basicVariantOfFeatures[features];
 }
 
+// every program is only submitted here, none is waited for until its first use, so the driver
+// can work on all of them at once
 void initShaders() {
-    myBasicShader.loadShader("shaders/shaderStart.vert", "shaders/shaderStart.frag");
-    myBasicShader.useShaderProgram();
+    double start = glfwGetTime();
+    bool parallelCompile = gps::Shader::enableParallelCompile();
+    fprintf(stdout, "Shader compile: %s\n", parallelCompile ? "parallel on the driver's threads" : "serial, no parallel compile extension");
+    programBinaryCache.open(PROGRAM_CACHE_DIRECTORY);
+    gps::Shader::setBinaryCache(&programBinaryCache);
+
+    basicShaderVariants.load("shaders/shaderStart.vert", "shaders/shaderStart.frag");
+    fallbackForwardVariant = getBasicShaderVariant(FEATURE_FOG);
+    fallbackGBufferVariant = getBasicShaderVariant(FEATURE_GBUFFER);
+    // the old single shader is the textured forward variant, for the code that sets up uniforms once
+    myBasicShader = basicShaderVariants.getShader(getBasicShaderVariant(FEATURE_TEXTURED | FEATURE_SHADOWED | FEATURE_POINT_LIGHTS | FEATURE_FOG));
     lightShader.loadShader("shaders/lightSource.vert", "shaders/lightSource.frag");
-    lightShader.useShaderProgram();
     screenQuadShader.loadShader("shaders/screenQuad.vert", "shaders/screenQuad.frag");
-    screenQuadShader.useShaderProgram();
     depthMapShader.loadShader("shaders/depthMapShader.vert", "shaders/depthMapShader.frag");
-    depthMapShader.useShaderProgram();
     skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
-    skyboxShader.useShaderProgram();
+    boundingBoxShader.loadShader("shaders/boundingBox.vert", "shaders/boundingBox.frag");
+    evsmMomentsShader.loadShader("shaders/screenQuad.vert", "shaders/evsmMoments.frag");
+    evsmBlurShader.loadShader("shaders/screenQuad.vert", "shaders/evsmBlur.frag");
+    deferredMoonShader.loadShader("shaders/screenQuad.vert", "shaders/deferredMoon.frag");
+    deferredLightShader.loadShader("shaders/deferredLight.vert", "shaders/deferredLight.frag");
+    shaderInitTime += glfwGetTime() - start;
+}
 
+void bindDrawConstantsBlock(GLuint program) {
+    GLuint block = glGetUniformBlockIndex(program, "DrawConstants");
+    if (block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, block, DRAW_CONSTANTS_BINDING);
+    }
 }
 
 void initUniforms() {
@@ -500,160 +891,1112 @@ void initUniforms() {
     lightShader.useShaderProgram();
     glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
 
+    // model and normalMatrix come from the ring, in the variants' shared vertex stage and the depth shader
+    bindDrawConstantsBlock(basicShaderVariants.getVertexProgram());
+    bindDrawConstantsBlock(depthMapShader.shaderProgram);
+    drawConstantRing.init(OBJ_COUNT * sizeof(DrawConstants));
+}
+
+// creates a depth texture array with a layer per cascade and a depth only FBO for each layer
+void createShadowMapFBOs(GLuint fbos[], GLuint* texture) {
+    glGenTextures(1, texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, *texture);
+    // sized format, both maps must match exactly for glBlitFramebuffer
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, CASCADE_SIZE, CASCADE_SIZE, CASCADE_COUNT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+    glGenFramebuffers(CASCADE_COUNT, fbos);
+    for (int cascade = 0; cascade < CASCADE_COUNT; cascade++) {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbos[cascade]);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, *texture, 0, cascade);
+
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// creates the comparison sampler for PCF and the moment maps for EVSM
+void initShadowFiltering() {
+    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+    glGenSamplers(1, &shadowCompareSampler);
+    glSamplerParameteri(shadowCompareSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadowCompareSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadowCompareSampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glSamplerParameteri(shadowCompareSampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glSamplerParameterfv(shadowCompareSampler, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glSamplerParameteri(shadowCompareSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glSamplerParameteri(shadowCompareSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+    // 32 bit floats, the squared moment of the warped depth reaches e^80
+    glGenTextures(1, &shadowMomentsTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMomentsTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG32F, CASCADE_SIZE, CASCADE_SIZE, CASCADE_COUNT, 0, GL_RG, GL_FLOAT, NULL);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenFramebuffers(CASCADE_COUNT, shadowMomentsFBOs);
+    for (int cascade = 0; cascade < CASCADE_COUNT; cascade++) {
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMomentsFBOs[cascade]);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadowMomentsTexture, 0, cascade);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    evsmMomentsShader.useShaderProgram();
+    glUniform1f(glGetUniformLocation(evsmMomentsShader.shaderProgram, "evsmExponent"), EVSM_EXPONENT);
 }
 
 void initFBO() {
     //TODO - Create the FBO, the depth texture and attach the depth texture to the FBO
-    glGenFramebuffers(1, &shadowMapFBO);
+    createShadowMapFBOs(shadowMapFBOs, &depthMapTexture);
+    createShadowMapFBOs(staticShadowMapFBOs, &staticDepthMapTexture);
 
-    glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    // GL_DEPTH_COMPONENT24 is stored in 4 bytes per texel by the drivers
+    fprintf(stdout, "Shadow maps: %d cascades of %ux%u, %.1f MB with the static cache\n",
+        CASCADE_COUNT, CASCADE_SIZE, CASCADE_SIZE, 2.0 * CASCADE_COUNT * CASCADE_SIZE * CASCADE_SIZE * 4 / (1024.0 * 1024.0));
 
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture, 0);
+    initShadowFiltering();
 
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
+    shadowPassTimer.init();
+    mainPassTimer.init();
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+// splits the camera frustum up to SHADOW_DISTANCE and fits a light matrix around each slice
+void computeCascades() {
+    // near and far planes of the camera projection
+    float cameraNear = projection[3][2] / (projection[2][2] - 1.0f);
+    float cameraFar = projection[3][2] / (projection[2][2] + 1.0f);
+    float shadowFar = std::min(SHADOW_DISTANCE, cameraFar);
+
+    // the rotation never depends on the camera, so the snapping below keeps the texels in place
+    glm::vec3 lightDirN = glm::normalize(lightDir);
+    glm::vec3 up = std::abs(lightDirN.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -lightDirN, up);
+
+    // depth range of the whole scene, casters that leave it are flattened by the depth clamp
+    gps::AABB sceneLightSpace = sceneBounds.transformed(lightView);
+    float nearPlane = -sceneLightSpace.max.z - 1.0f;
+    float farPlane = -sceneLightSpace.min.z + 1.0f;
+
+    float sliceNear = cameraNear;
+    for (int cascade = 0; cascade < CASCADE_COUNT; cascade++) {
+        float t = (float)(cascade + 1) / CASCADE_COUNT;
+        float logSplit = cameraNear * std::pow(shadowFar / cameraNear, t);
+        float uniformSplit = cameraNear + (shadowFar - cameraNear) * t;
+        float sliceFar = CASCADE_SPLIT_LAMBDA * logSplit + (1.0f - CASCADE_SPLIT_LAMBDA) * uniformSplit;
+        cascadeSplits[cascade] = sliceFar;
+
+        // the camera projection with its depth range moved to the slice
+        glm::mat4 sliceProjection = projection;
+        sliceProjection[2][2] = -(sliceFar + sliceNear) / (sliceFar - sliceNear);
+        sliceProjection[3][2] = -2.0f * sliceFar * sliceNear / (sliceFar - sliceNear);
+        glm::mat4 sliceViewProjection = sliceProjection * view;
+        cascadeFrustums[cascade] = gps::Frustum::fromMatrix(sliceViewProjection);
+
+        glm::mat4 inverseSlice = glm::inverse(sliceViewProjection);
+        glm::vec3 corners[8];
+        glm::vec3 center = glm::vec3(0.0f);
+        for (int i = 0; i < 8; i++) {
+            glm::vec4 corner = inverseSlice * glm::vec4(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f, 1.0f);
+            corners[i] = glm::vec3(corner) / corner.w;
+            center += corners[i] / 8.0f;
+        }
 
+        // a sphere around the slice keeps the size of the map fixed while the camera turns
+        float radius = 0.0f;
+        for (int i = 0; i < 8; i++) {
+            radius = std::max(radius, glm::length(corners[i] - center));
+        }
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        // moves the map only in whole texels so the edges of the shadows don't shimmer
+        float texelSize = 2.0f * radius / CASCADE_SIZE;
+        glm::vec3 centerLightSpace = glm::vec3(lightView * glm::vec4(center, 1.0f));
+        cascadeOrigins[cascade] = glm::ivec2((int)std::floor(centerLightSpace.x / texelSize),
+                                             (int)std::floor(centerLightSpace.y / texelSize));
+        centerLightSpace.x = cascadeOrigins[cascade].x * texelSize;
+        centerLightSpace.y = cascadeOrigins[cascade].y * texelSize;
+
+        glm::mat4 lightProjection = glm::ortho(centerLightSpace.x - radius, centerLightSpace.x + radius,
+                                               centerLightSpace.y - radius, centerLightSpace.y + radius,
+                                               nearPlane, farPlane);
+        lightSpaceTrMatrices[cascade] = lightProjection * lightView;
+        cascadeCenteredMatrices[cascade] = glm::ortho(-radius, radius, -radius, radius, nearPlane, farPlane) * lightView;
+
+        sliceNear = sliceFar;
+    }
 }
 
-glm::mat4 computeLightSpaceTrMatrix() {
-    //TODO - Return the light-space transformation matrix
-    glm::mat4 lightView = glm::lookAt(lightDir * 50.0f, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    const GLfloat near_plane = 1.0f, far_plane = 100;
-    glm::mat4 lightProjection = glm::ortho(-4.5f, 4.5f, -4.5f, 4.5f, near_plane, far_plane);
-    glm::mat4 lightSpaceTrMatrix = lightProjection * lightView;
 
-    return lightSpaceTrMatrix;
+void initTransforms() {
+    sceneRoot = transforms.create();
+    transforms.setRotation(sceneRoot, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+    objectTransforms[OBJ_SCENE] = transforms.create(sceneRoot);
+    objectTransforms[OBJ_GROUND] = transforms.create(sceneRoot);
+    objectTransforms[OBJ_BIG_GRASS] = transforms.create(sceneRoot);
+
+    // the animated objects turn about a point of their own
+    objectTransforms[OBJ_CAT] = transforms.create();
+    transforms.setPivot(objectTransforms[OBJ_CAT], glm::vec3(1.00869f, 0.06932f, -2.18939f));
+    objectTransforms[OBJ_BROOM] = transforms.create();
+    objectTransforms[OBJ_TEAPOT] = transforms.create();
+    transforms.setPivot(objectTransforms[OBJ_TEAPOT], glm::vec3(0.118652f, 0.128433f, -1.67852f));
+    objectTransforms[OBJ_SPOON] = transforms.create();
+    transforms.setPivot(objectTransforms[OBJ_SPOON], glm::vec3(0.59f, 0.08f, -2.67f));
 }
 
+// the animations only write the local transforms, the world matrices of what changed
+// are recomputed in one pass
+void animateTransforms() {
+    float time = (float)glfwGetTime();
+
+    transforms.setRotation(objectTransforms[OBJ_CAT], glm::radians(catRotaition), glm::vec3(0.0f, 1.0f, 0.0f));
+    //the broom will move up and down to simulate levitation effect
+    transforms.setTranslation(objectTransforms[OBJ_BROOM], glm::vec3(0.0f, sin(time * 0.8f) / 22, 0.0f));
+    transforms.setRotation(objectTransforms[OBJ_SPOON], glm::radians(100 * time), glm::vec3(0.0f, 1.0f, 0.0f));
+    transforms.setRotation(objectTransforms[OBJ_TEAPOT], crtAngle, glm::vec3(0.0f, 0.0f, 1.0f));
 
-void renderCat(gps::Shader shader, bool depthPass) {
-    shader.useShaderProgram();
+    transforms.updateWorld();
+}
 
-    glm::mat4 modelMatrix = glm::mat4(1.0f);
-    
-    glm::vec3 pivot = glm::vec3(1.00869f, 0.06932f, -2.18939f);
+void initSceneBVH() {
+    animateTransforms();
+
+    meshInstances.clear();
+    instanceBounds.clear();
+    animatedInstances.clear();
+
+    for (int obj = 0; obj < OBJ_COUNT; obj++) {
+        objectFirstInstance[obj] = (int)meshInstances.size();
+        for (int i = 0; i < objectModels[obj]->getMeshCount(); i++) {
+            MeshInstance instance;
+            instance.object = obj;
+            instance.mesh = i;
+            if (objectAnimated[obj]) {
+                animatedInstances.push_back((int)meshInstances.size());
+            }
+            meshInstances.push_back(instance);
+            instanceBounds.push_back(objectModels[obj]->getMeshBounds(i).transformed(transforms.getWorld(objectTransforms[obj])));
+        }
+    }
 
-    // PASUL 3: put it back in the scene
-    modelMatrix = glm::translate(modelMatrix, pivot);
+    instanceVisible.assign(meshInstances.size(), true);
+    for (int cascade = 0; cascade < CASCADE_COUNT; cascade++) {
+        casterVisible[cascade].assign(meshInstances.size(), true);
+        staticCasterVisible[cascade].assign(meshInstances.size(), true);
+    }
+
+    for (size_t i = 0; i < instanceBounds.size(); i++) {
+        sceneBounds.extend(instanceBounds[i]);
+    }
+    shadowSweepLength = glm::length(sceneBounds.max - sceneBounds.min);
 
-    // PASUL 2: rotate
-    modelMatrix = glm::rotate(modelMatrix, glm::radians(catRotaition), glm::vec3(0.0f, 1.0f, 0.0f));
+    double start = glfwGetTime();
+    sceneBVH.build(instanceBounds);
+    fprintf(stdout, "Scene BVH: %d mesh instances, %d nodes, built in %.2f ms\n",
+        sceneBVH.getPrimCount(), sceneBVH.getNodeCount(), (glfwGetTime() - start) * 1000.0);
+}
 
-    // PASUL 1: bring it to origin (0,0,0)            
-    modelMatrix = glm::translate(modelMatrix, -pivot);
+// merges the materials of all the models, equal colors and texture contents make one
+// entry whatever the .mtl names, and points every mesh at its entry
+void initMaterials() {
+    int declaredMaterials = 0;
+    for (int obj = 0; obj < OBJ_COUNT; obj++) {
+        declaredMaterials += objectModels[obj]->getMaterialCount();
+        for (int i = 0; i < objectModels[obj]->getMeshCount(); i++) {
+            gps::Mesh& mesh = objectModels[obj]->getMesh(i);
+            mesh.materialId = materialTable.add(mesh.material, mesh.textures);
+        }
+    }
+    materialTable.upload();
+    fprintf(stdout, "Materials: %d declared in the .mtl files, %d meshes use %d distinct materials\n",
+        declaredMaterials, materialTable.getAddedCount(), materialTable.getCount());
+    fprintf(stdout, "Textures: %d files read, %d distinct images once identical copies are merged\n",
+        gps::Model3D::getTextureFileCount(), gps::Model3D::getUniqueTextureCount());
+    fprintf(stdout, "Draw buckets: %d sets of textures, the materials of one set only differ by their table entry\n",
+        materialTable.getTextureSetCount());
+}
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+// finds the material features of every mesh instance and compiles the forward variants
+// they will need, so the first frames don't stall on the compiler
+void initShaderVariants() {
+    double start = glfwGetTime();
+    instanceMaterialFeatures.assign(meshInstances.size(), 0);
+    std::vector<bool> materialSeen(1 << SHADER_FEATURE_COUNT, false);
+    for (size_t i = 0; i < meshInstances.size(); i++) {
+        const gps::Mesh& mesh = objectModels[meshInstances[i].object]->getMesh(meshInstances[i].mesh);
+        int features = 0;
+        for (size_t t = 0; t < mesh.textures.size(); t++) {
+            if (mesh.textures[t].type == "diffuseTexture") {
+                features |= FEATURE_TEXTURED;
+                if (!mesh.textures[t].alphaCoverage.empty()) {
+                    features |= FEATURE_ALPHA_TEST;
+                }
+            } else if (mesh.textures[t].type == "specularTexture") {
+                features |= FEATURE_SPECULAR_MAP;
+            }
+        }
+        instanceMaterialFeatures[i] = features;
 
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * modelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        if (!materialSeen[features]) {
+            materialSeen[features] = true;
+            getBasicShaderVariant(features | FEATURE_SHADOWED | FEATURE_FOG);
+            getBasicShaderVariant(features | FEATURE_SHADOWED | FEATURE_POINT_LIGHTS | FEATURE_FOG);
+        }
     }
-    cat.Draw(shader);
+    // only the fallbacks have to be there for the first frame
+    basicShaderVariants.getShader(fallbackForwardVariant).useShaderProgram();
+    basicShaderVariants.getShader(fallbackGBufferVariant).useShaderProgram();
+    basicShaderVariants.isReady(fallbackForwardVariant);
+    basicShaderVariants.isReady(fallbackGBufferVariant);
+    fprintf(stdout, "Shader variants: %d submitted at load, fallbacks ready in %.2f ms\n",
+        basicShaderVariants.getVariantCount(), (glfwGetTime() - start) * 1000.0);
+
+    shaderInitTime += glfwGetTime() - start;
+    int hits = programBinaryCache.getHitCount();
+    int compiled = programBinaryCache.getMissCount() + programBinaryCache.getRejectedCount();
+    fprintf(stdout, "Shader init: %.1f ms, %s start (%d programs from the binary cache, %d compiled, %d binaries rejected)\n",
+        shaderInitTime * 1000.0, compiled == 0 && hits > 0 ? "warm" : "cold", hits, compiled, programBinaryCache.getRejectedCount());
 }
 
-void renderMScene(gps::Shader shader, bool depthPass) {
-    shader.useShaderProgram();
+// largest scale of an object's world matrix, brings world sizes to the object's space
+float objectScale(int obj) {
+    const glm::mat4& objectMatrix = transforms.getWorld(objectTransforms[obj]);
+    float scale = std::max(glm::length(glm::vec3(objectMatrix[0])),
+                  std::max(glm::length(glm::vec3(objectMatrix[1])), glm::length(glm::vec3(objectMatrix[2]))));
+    return scale > 0.0f ? scale : 1.0f;
+}
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+// generates the simplified shadow casters, the cell size is brought to each object's space
+void initShadowProxies() {
+    size_t fullTriangles = 0, shadowTriangles = 0;
+    double start = glfwGetTime();
 
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    for (int obj = 0; obj < OBJ_COUNT; obj++) {
+        float scale = objectScale(obj);
+        objectModels[obj]->BuildShadowProxies(SHADOW_PROXY_CELL_SIZE / scale, FOLIAGE_PROXY_CELL_SIZE / scale);
+
+        for (int i = 0; i < objectModels[obj]->getMeshCount(); i++) {
+            fullTriangles += objectModels[obj]->getMesh(i).indices.size() / 3;
+            if (!objectModels[obj]->hasShadowOverride()) {
+                shadowTriangles += objectModels[obj]->getMesh(i).getShadowTriangleCount();
+            }
+        }
+        shadowTriangles += objectModels[obj]->getShadowOverrideTriangleCount();
     }
- 
-    scene.Draw(shader);
+
+    fprintf(stdout, "Shadow proxies: %zu casting triangles instead of %zu, built in %.2f ms\n",
+        shadowTriangles, fullTriangles, (glfwGetTime() - start) * 1000.0);
 }
 
-void renderGround(gps::Shader shader, bool depthPass) {
-    shader.useShaderProgram();
+// the fixed lights, plus fireflies scattered over the scene bounds close to the ground
+void initLights() {
+    glm::vec3 lightPositions[] = {
+        glm::vec3(0.633715f, 0.178798f, -3.02519f),  // candle1
+        glm::vec3(0.636248f, 0.113232f, -3.00641f),  // candle2
+        glm::vec3(0.044475f, 0.391092f, -1.6515f),  // candle3
+        glm::vec3(1.45561f, 0.340656f, -1.99858f),  // house_light
+        glm::vec3(0.620615f, 0.297354f, 0.01794f),  // pole_light1
+        glm::vec3(1.08481f, 0.230449f, 1.26476f), // pole_light2
+        glm::vec3(-2.15379f, 0.259114f, 0.928646f)   // pole_light3
+    };
+    glm::vec3 lightColors[] = {
+        glm::vec3(0.5f, 0.4f, 0.1f),  // warm candle glow
+        glm::vec3(0.5f, 0.4f, 0.1f),  // warm candle glow
+        glm::vec3(0.5f, 0.4f, 0.1f),  // warm candle glow
+        glm::vec3(0.1f, 0.1f, 0.5f),  // house light
+        glm::vec3(0.5f, 0.4f, 0.1f),  // pole light
+        glm::vec3(0.5f, 0.4f, 0.1f),   // pole light
+        glm::vec3(0.5f, 0.4f, 0.1f)   // pole light
+    };
+
+    // the fixed lights cast shadows, one cube each in the atlas
+    int shadowedLights = sizeof(lightPositions) / sizeof(lightPositions[0]);
+    pointShadows.init(shadowedLights);
+    for (int i = 0; i < shadowedLights; i++) {
+        gps::PointLight& light = lightManager.getLight(lightManager.addLight(lightPositions[i], lightColors[i]));
+        light.shadowSlot = i;
+        // they never move, the baked lighting holds them
+        light.baked = true;
+        pointShadows.setLight(i, light.position, light.radius);
+    }
+
+    // fixed seed, the garden looks the same every run
+    srand(7);
+    firstFireflyLight = lightManager.getLightCount();
+    for (int i = 0; i < FIREFLY_COUNT; i++) {
+        Firefly firefly;
+        firefly.home = glm::vec3(
+            sceneBounds.min.x + (sceneBounds.max.x - sceneBounds.min.x) * (rand() / (float)RAND_MAX),
+            sceneBounds.min.y + 0.05f + 0.5f * (rand() / (float)RAND_MAX),
+            sceneBounds.min.z + (sceneBounds.max.z - sceneBounds.min.z) * (rand() / (float)RAND_MAX));
+        firefly.phase = glm::vec3(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX) * 6.2832f;
+        firefly.speed = 0.5f + rand() / (float)RAND_MAX;
+        fireflies.push_back(firefly);
+        lightManager.addLight(firefly.home, FIREFLY_COLOR);
+    }
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    lightClusters.init();
+    deferredShading.init();
+}
 
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+// world space copy of an object's meshes, for the lightmap unwrap and bake
+std::vector<gps::BakeMesh> buildBakeMeshes(int obj) {
+    std::vector<gps::BakeMesh> bakeMeshes(objectModels[obj]->getMeshCount());
+    const glm::mat4& objectMatrix = transforms.getWorld(objectTransforms[obj]);
+    glm::mat3 normalTransform = glm::mat3(glm::inverseTranspose(objectMatrix));
+    for (int i = 0; i < objectModels[obj]->getMeshCount(); i++) {
+        gps::Mesh& mesh = objectModels[obj]->getMesh(i);
+        gps::BakeMesh& bakeMesh = bakeMeshes[i];
+        for (size_t v = 0; v < mesh.vertices.size(); v++) {
+            bakeMesh.positions.push_back(glm::vec3(objectMatrix * glm::vec4(mesh.vertices[v].Position, 1.0f)));
+            glm::vec3 normal = normalTransform * mesh.vertices[v].Normal;
+            float length = glm::length(normal);
+            bakeMesh.normals.push_back(length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f));
+        }
+        bakeMesh.indices = mesh.indices;
     }
-    ground.Draw(shader);
+    return bakeMeshes;
 }
 
-void renderBroom(gps::Shader shader, bool depthPass) {
-    shader.useShaderProgram();
+// bakes and writes the lightmap of every static object and the probe grid, on all the
+// worker threads
+void bakeStaticLighting() {
+    double start = glfwGetTime();
 
-    //the broom will move up and down to simulate levitation effect
+    // the static objects shadow each other, the moving ones are left out of the bake
+    std::vector<glm::vec3> corners;
+    for (int obj = 0; obj < OBJ_COUNT; obj++) {
+        if (objectAnimated[obj]) {
+            continue;
+        }
+        std::vector<gps::BakeMesh> bakeMeshes = buildBakeMeshes(obj);
+        for (size_t i = 0; i < bakeMeshes.size(); i++) {
+            std::vector<float> opacity = objectModels[obj]->getMesh((int)i).computeTriangleOpacity();
+            const gps::BakeMesh& bakeMesh = bakeMeshes[i];
+            for (size_t t = 0; t + 2 < bakeMesh.indices.size(); t += 3) {
+                if (!opacity.empty() && opacity[t / 3] < LIGHTMAP_MIN_OCCLUDER_OPACITY) {
+                    continue;
+                }
+                corners.push_back(bakeMesh.positions[bakeMesh.indices[t]]);
+                corners.push_back(bakeMesh.positions[bakeMesh.indices[t + 1]]);
+                corners.push_back(bakeMesh.positions[bakeMesh.indices[t + 2]]);
+            }
+        }
+    }
+    gps::RayTracer rayTracer;
+    rayTracer.build(corners);
+    fprintf(stdout, "Lightmap bake: %d occluding triangles, built in %.2f ms, %d threads\n",
+        rayTracer.getTriangleCount(), (glfwGetTime() - start) * 1000.0, workerPool.getThreadCount());
+
+    gps::BakeSettings settings;
+    settings.moonDirection = lightDir;
+    settings.moonColor = MOON_COLOR;
+    for (int i = 0; i < lightManager.getLightCount(); i++) {
+        if (lightManager.getLight(i).baked) {
+            settings.lights.push_back(lightManager.getLight(i));
+        }
+    }
+    settings.aoSamples = LIGHTMAP_AO_SAMPLES;
+    settings.aoDistance = LIGHTMAP_AO_DISTANCE;
+
+    for (int obj = 0; obj < OBJ_COUNT; obj++) {
+        if (objectLightmapFiles[obj] == NULL) {
+            continue;
+        }
+        double objectStart = glfwGetTime();
+        std::vector<gps::BakeMesh> bakeMeshes = buildBakeMeshes(obj);
+        gps::LightmapUnwrap unwrap = gps::unwrapLightmap(bakeMeshes, LIGHTMAP_TEXELS_PER_UNIT, LIGHTMAP_MAX_SIZE);
+        std::vector<glm::vec4> texels = gps::bakeLightmap(unwrap, bakeMeshes, rayTracer, settings, workerPool);
+        bool saved = gps::saveLightmap(objectLightmapFiles[obj], unwrap, texels);
+        fprintf(stdout, "Lightmap %s: %dx%d, %d charts, baked in %.2f s%s\n", objectLightmapFiles[obj],
+            unwrap.width, unwrap.height, unwrap.chartCount, glfwGetTime() - objectStart, saved ? "" : ", could not be written");
+    }
+
+    double probeStart = glfwGetTime();
+    irradianceProbes.bake(sceneBounds, PROBE_SPACING, rayTracer, corners, settings, workerPool);
+    bool saved = irradianceProbes.save(PROBES_FILE);
+    glm::vec3 probeSpacing = irradianceProbes.getSpacing();
+    fprintf(stdout, "Irradiance probes %s: %d probes, spaced %.2f x %.2f x %.2f, baked in %.2f s%s\n", PROBES_FILE,
+        irradianceProbes.getProbeCount(), probeSpacing.x, probeSpacing.y, probeSpacing.z, glfwGetTime() - probeStart,
+        saved ? "" : ", could not be written");
+    if (irradianceProbes.isClamped()) {
+        fprintf(stdout, "Irradiance probes: the scene needs more than %d probes along an axis at %.2f spacing, "
+            "they were spread farther apart\n", gps::IrradianceProbes::MAX_RESOLUTION, PROBE_SPACING);
+    }
+    fprintf(stdout, "Static lighting baked in %.2f s\n", glfwGetTime() - start);
+}
+
+// loads the baked lightmaps and probes, the unwrap is redone to get the UVs the bake used
+void initBakedLighting() {
+    double start = glfwGetTime();
+    int wanted = 0, loaded = 0;
+    for (int obj = 0; obj < OBJ_COUNT; obj++) {
+        objectLightmaps[obj] = 0;
+        if (objectLightmapFiles[obj] == NULL) {
+            continue;
+        }
+        wanted++;
+        std::vector<gps::BakeMesh> bakeMeshes = buildBakeMeshes(obj);
+        gps::LightmapUnwrap unwrap = gps::unwrapLightmap(bakeMeshes, LIGHTMAP_TEXELS_PER_UNIT, LIGHTMAP_MAX_SIZE);
+        objectLightmaps[obj] = gps::loadLightmap(objectLightmapFiles[obj], unwrap);
+        if (objectLightmaps[obj] == 0) {
+            continue;
+        }
+        for (int i = 0; i < objectModels[obj]->getMeshCount(); i++) {
+            objectModels[obj]->getMesh(i).setLightmapUVs(unwrap.sourceVertices[i], unwrap.coords[i], unwrap.indices[i]);
+        }
+        loaded++;
+    }
+    fprintf(stdout, "Lightmaps: %d of %d loaded in %.2f ms%s\n", loaded, wanted, (glfwGetTime() - start) * 1000.0,
+        loaded < wanted ? ", run with --bake to bake the missing ones" : "");
+
+    if (irradianceProbes.load(PROBES_FILE)) {
+        glm::vec3 probeSpacing = irradianceProbes.getSpacing();
+        fprintf(stdout, "Irradiance probes: %d loaded, spaced %.2f x %.2f x %.2f\n", irradianceProbes.getProbeCount(),
+            probeSpacing.x, probeSpacing.y, probeSpacing.z);
+    } else {
+        fprintf(stdout, "Irradiance probes: none, run with --bake to bake them\n");
+    }
+}
 
+// fireflies wander around their home point and blink
+void updateFireflies() {
     float time = (float)glfwGetTime();
-    float deltaY = sin(time * 0.8f) / 22;  //(sin(time * 0.8f) * 0.7) / 20;
-    glm::mat4 modelMatrix = glm::mat4(1.0f);
-    modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, deltaY, 0.0f));
+    for (size_t i = 0; i < fireflies.size(); i++) {
+        const Firefly& firefly = fireflies[i];
+        float t = time * firefly.speed;
+        gps::PointLight& light = lightManager.getLight(firstFireflyLight + i);
+        light.position = firefly.home + glm::vec3(
+            0.15f * std::sin(t + firefly.phase.x),
+            0.05f * std::sin(1.7f * t + firefly.phase.y),
+            0.15f * std::cos(0.8f * t + firefly.phase.z));
+        // the radius stays the one of the full color
+        light.color = FIREFLY_COLOR * (0.6f + 0.4f * std::sin(3.0f * t + firefly.phase.x));
+    }
+}
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+// animates the objects and refits the BVH only above the meshes that moved
+void updateSceneObjects() {
+    animateTransforms();
 
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * modelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    for (size_t i = 0; i < animatedInstances.size(); i++) {
+        const MeshInstance& instance = meshInstances[animatedInstances[i]];
+        instanceBounds[animatedInstances[i]] = objectModels[instance.object]->getMeshBounds(instance.mesh).transformed(transforms.getWorld(objectTransforms[instance.object]));
     }
-    broom.Draw(shader);
+    sceneBVH.refit(animatedInstances, instanceBounds);
 }
 
-void renderSpoon(gps::Shader shader, bool depthPass) {
-    shader.useShaderProgram();
+// picks the occluders among the opaque static meshes: the ones named "occluder" in the
+// .obj files as they are, then the largest others as clustered proxies cheap enough to
+// rasterize on the CPU. Alpha tested meshes would hide what shows through their holes
+void initOccluders() {
+    instanceOccluder.assign(meshInstances.size(), -1);
+
+    int occluderCount = 0;
+    std::vector<int> candidates;
+    for (size_t i = 0; i < meshInstances.size(); i++) {
+        const MeshInstance& instance = meshInstances[i];
+        if (objectAnimated[instance.object] || instance.object == OBJ_BIG_GRASS
+            || (instanceMaterialFeatures[i] & FEATURE_ALPHA_TEST)) {
+            continue;
+        }
+        gps::Mesh& mesh = objectModels[instance.object]->getMesh(instance.mesh);
+        if (mesh.name.find("occluder") != std::string::npos) {
+            instanceOccluder[i] = occlusionCuller.addOccluderMesh(mesh.positions, mesh.positionIndices);
+            occluderCount++;
+        } else {
+            candidates.push_back((int)i);
+        }
+    }
 
-    glm::mat4 modelMatrix = glm::mat4(1.0f);
-    glm::vec3 pivot = glm::vec3(0.59f, 0.08f, -2.67f);
+    std::sort(candidates.begin(), candidates.end(), [](int a, int b) {
+        return instanceBounds[a].halfArea() > instanceBounds[b].halfArea();
+    });
+    size_t fullTriangles = 0, proxyTriangles = 0;
+    for (size_t i = 0; i < candidates.size() && occluderCount < MAX_OCCLUDERS; i++) {
+        const MeshInstance& instance = meshInstances[candidates[i]];
+        gps::Mesh& mesh = objectModels[instance.object]->getMesh(instance.mesh);
+
+        gps::ShadowProxy proxy = gps::simplifyForShadow(mesh.positions, mesh.positionIndices,
+            OCCLUDER_PROXY_CELL_SIZE / objectScale(instance.object), std::vector<float>(), 0.0f);
+        if (proxy.indices.empty() || proxy.indices.size() / 3 > MAX_OCCLUDER_TRIANGLES) {
+            continue;
+        }
+        instanceOccluder[candidates[i]] = occlusionCuller.addOccluderMesh(proxy.positions, proxy.indices);
+        occluderCount++;
+        fullTriangles += mesh.positionIndices.size() / 3;
+        proxyTriangles += proxy.indices.size() / 3;
+    }
 
-    modelMatrix = glm::translate(modelMatrix, pivot);
-    modelMatrix = glm::rotate(modelMatrix, glm::radians(100 * (float)glfwGetTime()), glm::vec3(0.0f, 1.0f, 0.0f));
-    modelMatrix = glm::translate(modelMatrix, -pivot);
+    fprintf(stdout, "Occlusion culling: %d occluder meshes (proxies of %zu triangles instead of %zu), %d worker threads\n",
+        occluderCount, proxyTriangles, fullTriangles, workerPool.getThreadCount());
+}
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+// rasterizes the visible occluders and hides the meshes behind them
+void occlusionCull(const glm::mat4& viewProjection) {
+    double start = glfwGetTime();
 
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * modelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    occlusionCuller.beginFrame(viewProjection);
+    for (size_t i = 0; i < meshInstances.size(); i++) {
+        if (instanceVisible[i] && instanceOccluder[i] != -1) {
+            occlusionCuller.drawOccluder(instanceOccluder[i], transforms.getWorld(objectTransforms[meshInstances[i].object]));
+        }
     }
-    spoon.Draw(shader);
+    occlusionCuller.rasterize();
+
+    for (size_t i = 0; i < meshInstances.size(); i++) {
+        if (!instanceVisible[i] || instanceOccluder[i] != -1) {
+            continue;
+        }
+        frameStats.occlusionTested++;
+        if (!occlusionCuller.isVisible(instanceBounds[i])) {
+            instanceVisible[i] = false;
+            frameStats.occlusionCulled++;
+        }
+    }
+
+    frameStats.occlusionTime += glfwGetTime() - start;
 }
 
-void renderTeapot(gps::Shader shader, bool depthPass) {
-    shader.useShaderProgram();
+// one query slot for every heavy mesh and every light glow mesh
+void initOcclusionQueries() {
+    int slotCount = 0;
+
+    instanceQuerySlot.assign(meshInstances.size(), -1);
+    for (size_t i = 0; i < meshInstances.size(); i++) {
+        const MeshInstance& instance = meshInstances[i];
+        if (objectModels[instance.object]->getMesh(instance.mesh).indices.size() / 3 >= HEAVY_MESH_TRIANGLES) {
+            instanceQuerySlot[i] = slotCount++;
+        }
+    }
+
+    for (int i = 0; i < GLOW_MODEL_COUNT; i++) {
+        glowFirstSlot[i] = slotCount;
+        slotCount += glowModels[i]->getMeshCount();
+    }
 
-    glm::mat4 modelMatrix = glm::mat4(1.0f);
-    glm::vec3 pivot = glm::vec3(0.118652f, 0.128433f, -1.67852f);
+    occlusionQueries.init(slotCount);
+    fprintf(stdout, "Occlusion queries: %d query slots\n", slotCount);
+}
 
-    modelMatrix = glm::translate(modelMatrix, pivot);
-    modelMatrix = glm::rotate(modelMatrix, crtAngle, glm::vec3(0.0f, 0.0f, 1.0f));
-    modelMatrix = glm::translate(modelMatrix, -pivot);
+// tests the boxes of the queried meshes against this frame's depth buffer, the
+// results decide which of them the GPU draws in the next frame
+void issueOcclusionQueries() {
+    for (size_t i = 0; i < meshInstances.size(); i++) {
+        int slot = instanceQuerySlot[i];
+        if (slot == -1) {
+            continue;
+        }
+        if (instanceVisible[i]) {
+            occlusionQueries.setBox(slot, instanceBounds[i]);
+        } else {
+            occlusionQueries.skipSlot(slot);
+        }
+    }
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+    for (int i = 0; i < GLOW_MODEL_COUNT; i++) {
+        for (int j = 0; j < glowModels[i]->getMeshCount(); j++) {
+            gps::AABB box = glowModels[i]->getMeshBounds(j);
+            if (cameraFrustum.intersects(box)) {
+                occlusionQueries.setBox(glowFirstSlot[i] + j, box);
+            } else {
+                occlusionQueries.skipSlot(glowFirstSlot[i] + j);
+            }
+        }
+    }
 
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    if (polygonMode != GL_FILL) {
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    }
+    occlusionQueries.issueQueries(boundingBoxShader, projection * view, myCamera.getCameraPosition());
+    if (polygonMode != GL_FILL) {
+        glPolygonMode(GL_FRONT_AND_BACK, polygonMode);
+    }
+
+    frameStats.occlusionTested += occlusionQueries.takeConditionalCount();
+    frameStats.occlusionCulled += occlusionQueries.takeSkippedCount();
+}
+
+// marks the meshes inside the camera frustum and not hidden by the occluders
+void cullScene(const glm::mat4& viewProjection) {
+    cameraFrustum = gps::Frustum::fromMatrix(viewProjection);
+
+    queryResult.clear();
+    sceneBVH.queryFrustum(cameraFrustum, queryResult);
+
+    instanceVisible.assign(meshInstances.size(), false);
+    for (size_t i = 0; i < queryResult.size(); i++) {
+        instanceVisible[queryResult[i]] = true;
+    }
+
+    if (occlusionMode == OCCLUSION_SOFTWARE) {
+        occlusionCull(viewProjection);
     }
-    teapot.Draw(shader);
 }
 
-void renderBigGrass(gps::Shader shader, bool depthPass) {
+// keeps the shadow casters inside each cascade's light volume, extended toward the light,
+// whose shadow can land inside the cascade's slice of the camera frustum
+void cullShadowCasters() {
+    glm::vec3 sweep = -glm::normalize(lightDir) * shadowSweepLength;
+
+    for (int cascade = 0; cascade < CASCADE_COUNT; cascade++) {
+        casterVolumes[cascade] = gps::Frustum::fromMatrix(lightSpaceTrMatrices[cascade]);
+        // casters between the light and its near plane still throw shadows into the map
+        casterVolumes[cascade].planes[gps::Frustum::NEAR_PLANE].d = 1e30f;
+
+        queryResult.clear();
+        sceneBVH.queryFrustum(casterVolumes[cascade], queryResult);
+
+        casterVisible[cascade].assign(meshInstances.size(), false);
+        for (size_t i = 0; i < queryResult.size(); i++) {
+            // receiver test: the box swept along the light must reach the slice
+            const gps::AABB& box = instanceBounds[queryResult[i]];
+            gps::AABB swept = box;
+            swept.extend(gps::AABB(box.min + sweep, box.max + sweep));
+            if (cascadeFrustums[cascade].intersects(swept)) {
+                casterVisible[cascade][queryResult[i]] = true;
+            }
+        }
+    }
+}
+
+// light space texel rectangle covered by the moving casters of this frame in a cascade
+ShadowRect dynamicCasterRect(int cascade) {
+    gps::AABB lightBounds;
+    for (size_t i = 0; i < animatedInstances.size(); i++) {
+        if (casterVisible[cascade][animatedInstances[i]]) {
+            lightBounds.extend(instanceBounds[animatedInstances[i]].transformed(lightSpaceTrMatrices[cascade]));
+        }
+    }
+
+    ShadowRect rect = { 0, 0, 0, 0 };
+    if (lightBounds.isEmpty()) {
+        return rect;
+    }
+
+    // one texel of padding for the rasterization rules
+    rect.x0 = std::max(0, (int)std::floor((lightBounds.min.x * 0.5f + 0.5f) * CASCADE_SIZE) - 1);
+    rect.y0 = std::max(0, (int)std::floor((lightBounds.min.y * 0.5f + 0.5f) * CASCADE_SIZE) - 1);
+    rect.x1 = std::min((int)CASCADE_SIZE, (int)std::ceil((lightBounds.max.x * 0.5f + 0.5f) * CASCADE_SIZE) + 1);
+    rect.y1 = std::min((int)CASCADE_SIZE, (int)std::ceil((lightBounds.max.y * 0.5f + 0.5f) * CASCADE_SIZE) + 1);
+    return rect;
+}
+
+// prints the averaged statistics every 5 seconds
+void updateFrameStats() {
+    frameStats.frames++;
+
+    double elapsed = glfwGetTime() - statsStart;
+    if (elapsed < 5.0) {
+        return;
+    }
+
+    float frames = (float)frameStats.frames;
+    fprintf(stdout, "Frame stats: %.1f fps", frames / elapsed);
+    for (int pass = 0; pass < PASS_COUNT; pass++) {
+        fprintf(stdout, ", %s pass %.1f draws / %.0f triangles", renderPassNames[pass],
+            frameStats.draws[pass] / frames, frameStats.triangles[pass] / frames);
+    }
+    fprintf(stdout, ", shadow pass GPU %.3f ms, main pass GPU %.3f ms (%s)\n",
+        shadowPassTimer.getAverageMs(), mainPassTimer.getAverageMs(), renderPathNames[renderPath]);
+    shadowPassTimer.reset();
+    mainPassTimer.reset();
+
+    if (occlusionMode == OCCLUSION_SOFTWARE) {
+        fprintf(stdout, "Occlusion culling: %.1f of %.1f tested meshes culled per frame (%.1f%%), %d occluder triangles, %.3f ms\n",
+            frameStats.occlusionCulled / frames,
+            frameStats.occlusionTested / frames,
+            frameStats.occlusionTested > 0 ? 100.0f * frameStats.occlusionCulled / frameStats.occlusionTested : 0.0f,
+            occlusionCuller.getTriangleCount(),
+            frameStats.occlusionTime * 1000.0 / frames);
+    } else if (occlusionMode == OCCLUSION_GPU) {
+        fprintf(stdout, "Occlusion queries: %.1f of %.1f conditional draws skipped per frame (%.1f%%)\n",
+            frameStats.occlusionCulled / frames,
+            frameStats.occlusionTested / frames,
+            frameStats.occlusionTested > 0 ? 100.0f * frameStats.occlusionCulled / frameStats.occlusionTested : 0.0f);
+    }
+
+    fprintf(stdout, "Point lights: %.1f of %d in range of a visible mesh, %.1f mesh light list entries, culled in %.3f ms\n",
+        frameStats.activeLights / frames,
+        lightManager.getLightCount(),
+        frameStats.lightListEntries / frames,
+        frameStats.lightCullTime * 1000.0 / frames);
+    if (renderPath == RENDER_FORWARD) {
+        fprintf(stdout, "Clustered lighting: %.0f of %d clusters lit, %.0f light indices, binned in %.3f ms\n",
+            frameStats.occupiedClusters / frames,
+            gps::LightClusters::CLUSTER_COUNT,
+            frameStats.clusterIndices / frames,
+            frameStats.clusterTime * 1000.0 / frames);
+    } else {
+        fprintf(stdout, "Deferred lighting: %.1f light volumes drawn per frame\n", frameStats.lightVolumes / frames);
+    }
+    fprintf(stdout, "Point shadows: %.1f cube faces redrawn per frame (budget %d), %d stale\n",
+        frameStats.pointShadowFaces / frames, POINT_SHADOW_FACE_BUDGET, pointShadows.getStaleFaceCount());
+    fprintf(stdout, "Transforms: %.1f of %d world matrices recomputed per frame\n",
+        transforms.takeUpdatedCount() / frames, transforms.getCount());
+    int orphans = drawConstantRing.takeOrphanCount();
+    if (orphans > 0) {
+        fprintf(stdout, "Draw constants: the ring was orphaned %d times, the GPU was still reading a region %d frames later\n",
+            orphans, gps::ConstantRing::FRAME_COUNT);
+    }
+    fprintf(stdout, "Command recording: %.1f commands per frame on %d threads, recorded in %.3f ms, replayed in %.3f ms\n",
+        frameStats.recordedCommands / frames,
+        parallelRecording ? workerPool.getThreadCount() : 1,
+        frameStats.recordTime * 1000.0 / frames,
+        frameStats.replayTime * 1000.0 / frames);
+    if (frameStats.fallbackDraws > 0) {
+        fprintf(stdout, "Shader variants: %.1f draws per frame used a fallback while their variant compiled\n",
+            frameStats.fallbackDraws / frames);
+    }
+
+    frameStats = FrameStats();
+    statsStart = glfwGetTime();
+}
+
+// lights the G-buffer into the window: moon, shadows and fog in one fullscreen pass, then
+// the point lights as volumes on top
+void applyDeferredLighting(glm::vec3 moonColor) {
+    // already cleared by the render graph before the pass
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // only the G-buffer is drawn in the wireframe mode, the lighting covers whole pixels
+    if (polygonMode != GL_FILL) {
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    }
+
+    // the fullscreen pass also writes the G-buffer depth, the volumes, the light models
+    // and the skybox are depth tested against it
+    deferredMoonShader.useShaderProgram();
+    deferredShading.bindGBuffer(deferredMoonShader, 0, projection);
+    glUniform3fv(glGetUniformLocation(deferredMoonShader.shaderProgram, "lightDir"), 1, glm::value_ptr(lightDir));
+    glUniform3fv(glGetUniformLocation(deferredMoonShader.shaderProgram, "lightColor"), 1, glm::value_ptr(moonColor));
+    glDepthFunc(GL_ALWAYS);
+    screenQuad.Draw(deferredMoonShader);
+    glDepthFunc(GL_LESS);
+
+    deferredLightShader.useShaderProgram();
+    deferredShading.bindGBuffer(deferredLightShader, 0, projection);
+    pointShadows.bind(deferredLightShader, 4);
+    glUniformMatrix4fv(glGetUniformLocation(deferredLightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    deferredShading.drawLightVolumes(deferredLightShader, lightManager.getEyeLights());
+    frameStats.lightVolumes += deferredShading.getLightVolumeCount();
+
+    if (polygonMode != GL_FILL) {
+        glPolygonMode(GL_FRONT_AND_BACK, polygonMode);
+    }
+}
+
+// the frame's uniforms of the main pass, set on the fragment stage of every variant of shaderStart
+void setMainPassUniforms(gps::Shader shader) {
     shader.useShaderProgram();
+    pointShadows.bind(shader, 9);
+    irradianceProbes.bind(shader, 11);
+    materialTable.bind(shader, MATERIAL_TEXTURE_UNIT);
+    if (renderPath == RENDER_FORWARD) {
+        lightClusters.bind(shader, 6, retina_width, retina_height);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "showClusterHeatmap"), showClusterHeatmap);
+    }
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniform3fv(glGetUniformLocation(shader.shaderProgram, "lightColor"), 1, glm::value_ptr(MOON_COLOR));
+    glUniform3fv(glGetUniformLocation(shader.shaderProgram, "lightDir"), 1, glm::value_ptr(lightDir));
+
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "shadowMap"), 3);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "shadowMapCompare"), 4);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "shadowMoments"), 5);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "shadowFilter"), shadowFilter);
+    glUniform1f(glGetUniformLocation(shader.shaderProgram, "evsmExponent"), EVSM_EXPONENT);
+    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "lightSpaceTrMatrices"),
+        CASCADE_COUNT,
+        GL_FALSE,
+        glm::value_ptr(lightSpaceTrMatrices[0]));
+    glUniform1fv(glGetUniformLocation(shader.shaderProgram, "cascadeSplits"), CASCADE_COUNT, cascadeSplits);
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "lightmap"), 10);
+}
 
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+// whether a point light the variant would add reaches the instance, the baked ones are
+// already in the lightmap and the probes
+bool instanceHasPointLights(int instance, bool skipBaked) {
+    int count = lightManager.getInstanceLightCount(instance);
+    if (!skipBaked) {
+        return count > 0;
+    }
+    const std::vector<gps::PointLight>& eyeLights = lightManager.getEyeLights();
+    const int* lights = lightManager.getInstanceLights(instance);
+    for (int k = 0; k < count; k++) {
+        if (!eyeLights[lights[k]].baked) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the features of the shaderStart variant a visible mesh instance is drawn with in the main
+// pass, only reads the frame's state so the recording workers can call it
+int selectBasicShaderFeatures(int instance, bool lightmapped, bool probeLit) {
+    int features = instanceMaterialFeatures[instance];
+    // past the last cascade nothing is shadowed
+    bool inShadowRange = -instanceBounds[instance].transformed(view).max.z <= cascadeSplits[CASCADE_COUNT - 1];
+
+    if (renderPath == RENDER_DEFERRED) {
+        features |= FEATURE_GBUFFER;
+        if (inShadowRange) {
+            features |= FEATURE_SHADOWED;
+        }
+    } else {
+        features |= FEATURE_FOG;
+        if (lightmapped) {
+            features |= FEATURE_LIGHTMAP;
+        } else if (probeLit) {
+            features |= FEATURE_PROBES;
+        } else if (inShadowRange) {
+            features |= FEATURE_SHADOWED;
+        }
+        if (showClusterHeatmap || instanceHasPointLights(instance, lightmapped || probeLit)) {
+            features |= FEATURE_POINT_LIGHTS;
+        }
+    }
+    return features;
+}
+
+// the model and normal matrices of every object for this frame's view, the draws of all
+// passes pick theirs from the ring
+void writeDrawConstants() {
+    transforms.updateView(view);
+    drawConstantRing.beginFrame();
+    for (int obj = 0; obj < OBJ_COUNT; obj++) {
+        DrawConstants constants;
+        constants.model = transforms.getWorld(objectTransforms[obj]);
+        const glm::vec4* objectNormalMatrix = transforms.getNormalMatrix(objectTransforms[obj]);
+        for (int column = 0; column < 3; column++) {
+            constants.normalMatrix[column] = objectNormalMatrix[column];
+        }
+        objectConstantOffsets[obj] = drawConstantRing.push(&constants, sizeof(constants));
     }
-    big_grass.Draw(shader);
+    drawConstantRing.upload();
+}
+
+// records the draws of the meshes of an object that survived the culling of the given pass,
+// no GL calls so it can run on a worker
+void recordObject(gps::CommandBuffer& commands, int obj, RenderPass pass, int cascade) {
+    int first = objectFirstInstance[obj];
+    commands.record(CMD_BIND_CONSTANTS, obj);
+    bool overrideRecorded = false;
+
+    // the G-buffer has no room for the baked lighting, the deferred path keeps it dynamic
+    bool lightmapped = pass == PASS_MAIN && bakedLightingMode && renderPath == RENDER_FORWARD && objectLightmaps[obj] != 0;
+    // the moving objects read the probes instead
+    bool probeLit = pass == PASS_MAIN && bakedLightingMode && renderPath == RENDER_FORWARD && objectAnimated[obj]
+        && irradianceProbes.isLoaded();
+    if (lightmapped) {
+        commands.record(CMD_BIND_LIGHTMAP, obj);
+    }
+    for (int i = 0; i < objectModels[obj]->getMeshCount(); i++) {
+        bool visible;
+        if (pass == PASS_STATIC_SHADOW) {
+            visible = staticCasterVisible[cascade][first + i];
+        } else if (pass == PASS_SHADOW) {
+            visible = casterVisible[cascade][first + i];
+        } else if (pass == PASS_POINT_SHADOW) {
+            visible = pointCasterVisible[first + i];
+        } else {
+            visible = instanceVisible[first + i];
+        }
+        if (!visible) {
+            continue;
+        }
+
+        if (pass != PASS_MAIN) {
+            // a *_shadow.obj override replaces the whole model, drawn once if any mesh casts
+            if (objectModels[obj]->hasShadowOverride()) {
+                if (!overrideRecorded) {
+                    commands.record(CMD_DRAW_SHADOW_OVERRIDE, obj);
+                    overrideRecorded = true;
+                }
+            } else if (objectModels[obj]->getMesh(i).castsShadow()) {
+                commands.record(CMD_DRAW_SHADOW, obj, i);
+            }
+            continue;
+        }
+
+        commands.record(CMD_DRAW_MAIN, obj, i, selectBasicShaderFeatures(first + i, lightmapped, probeLit));
+    }
+}
+
+// issues the recorded commands of a pass, shader is the one of the shadow passes
+void replayCommands(const gps::CommandBuffer& commands, gps::Shader shader, RenderPass pass) {
+    double start = glfwGetTime();
+    if (pass != PASS_MAIN) {
+        shader.useShaderProgram();
+    }
+    for (int c = 0; c < commands.getCount(); c++) {
+        const gps::Command& command = commands.getCommand(c);
+        int obj = command.object;
+        int i = command.mesh;
+
+        if (command.type == CMD_BIND_CONSTANTS) {
+            drawConstantRing.bind(DRAW_CONSTANTS_BINDING, objectConstantOffsets[obj], sizeof(DrawConstants));
+        } else if (command.type == CMD_BIND_LIGHTMAP) {
+            glActiveTexture(GL_TEXTURE10);
+            glBindTexture(GL_TEXTURE_2D, objectLightmaps[obj]);
+            glActiveTexture(GL_TEXTURE0);
+        } else if (command.type == CMD_DRAW_SHADOW_OVERRIDE) {
+            frameStats.draws[pass]++;
+            frameStats.triangles[pass] += objectModels[obj]->getShadowOverrideTriangleCount();
+            objectModels[obj]->DrawShadowOverride(shader);
+        } else if (command.type == CMD_DRAW_SHADOW) {
+            frameStats.draws[pass]++;
+            frameStats.triangles[pass] += objectModels[obj]->getMesh(i).getShadowTriangleCount();
+            objectModels[obj]->DrawMeshShadow(shader, i);
+        } else if (command.type == CMD_DRAW_MAIN) {
+            frameStats.draws[pass]++;
+            frameStats.triangles[pass] += objectModels[obj]->getMesh(i).indices.size() / 3;
+
+            // compiling and the completion polls need the context, so the variant is only
+            // picked here
+            int variant = getBasicShaderVariant(command.argument);
+            if (!basicShaderVariants.isReady(variant)) {
+                variant = renderPath == RENDER_DEFERRED ? fallbackGBufferVariant : fallbackForwardVariant;
+                frameStats.fallbackDraws++;
+            }
+            if ((int)variantUniformFrame.size() <= variant) {
+                variantUniformFrame.resize(basicShaderVariants.getVariantCount(), -1);
+            }
+            if (variantUniformFrame[variant] != frameIndex) {
+                setMainPassUniforms(basicShaderVariants.getShader(variant));
+                variantUniformFrame[variant] = frameIndex;
+            }
+            // the vertex stage is shared and the matrices are in the ring, switching variants
+            // only swaps the fragment stage
+            gps::Shader& variantShader = basicShaderVariants.use(variant);
+            // the material is a vertex attribute, not program state
+            glVertexAttribI1i(MATERIAL_ATTRIBUTE, objectModels[obj]->getMesh(i).materialId);
+
+            int slot = instanceQuerySlot[objectFirstInstance[obj] + i];
+            if (occlusionMode == OCCLUSION_GPU && slot != -1) {
+                occlusionQueries.beginConditional(slot);
+            }
+            if (command.argument & FEATURE_LIGHTMAP) {
+                objectModels[obj]->DrawMeshLightmapped(variantShader, i);
+            } else {
+                objectModels[obj]->DrawMesh(variantShader, i);
+            }
+            if (occlusionMode == OCCLUSION_GPU && slot != -1) {
+                occlusionQueries.endConditional(slot);
+            }
+        }
+    }
+    frameStats.replayTime += glfwGetTime() - start;
+}
+
+// draws the meshes of an object that survived the culling of the given pass, recorded and
+// replayed right away on the GL thread
+void drawObject(gps::Shader shader, int obj, RenderPass pass) {
+    immediateCommands.reset();
+    recordObject(immediateCommands, obj, pass, currentCascade);
+    replayCommands(immediateCommands, shader, pass);
+}
+
+// records the cascade shadow passes and the main pass, one job per cascade and one per
+// main pass object, each into its own buffer. Needs the frame's culling and light lists
+void recordFrameCommands() {
+    double start = glfwGetTime();
+    bool recordMainPass = !showDepthMap;
+    int jobCount = CASCADE_COUNT + (recordMainPass ? OBJ_COUNT : 0);
+    std::function<void(int)> job = [](int index) {
+        if (index < CASCADE_COUNT) {
+            gps::CommandBuffer& commands = cascadeCommands[index];
+            commands.reset();
+            // with caching only the moving casters are drawn every frame
+            if (shadowCaching) {
+                for (int k = 0; k < DYNAMIC_CASTER_COUNT; k++) {
+                    recordObject(commands, dynamicCasters[k], PASS_SHADOW, index);
+                }
+            } else {
+                for (int obj = 0; obj < OBJ_COUNT; obj++) {
+                    recordObject(commands, obj, PASS_SHADOW, index);
+                }
+            }
+        } else {
+            int obj = mainPassOrder[index - CASCADE_COUNT];
+            mainPassCommands[obj].reset();
+            recordObject(mainPassCommands[obj], obj, PASS_MAIN, 0);
+        }
+    };
+    if (parallelRecording) {
+        workerPool.parallelFor(jobCount, job);
+    } else {
+        for (int index = 0; index < jobCount; index++) {
+            job(index);
+        }
+    }
+    frameStats.recordTime += glfwGetTime() - start;
+
+    for (int cascade = 0; cascade < CASCADE_COUNT; cascade++) {
+        frameStats.recordedCommands += cascadeCommands[cascade].getCount();
+    }
+    for (int obj = 0; obj < OBJ_COUNT && recordMainPass; obj++) {
+        frameStats.recordedCommands += mainPassCommands[obj].getCount();
+    }
+}
+
+// draws a light glow model, each mesh wrapped in its query when GPU occlusion is on
+void drawGlowModel(gps::Shader shader, int glowModel) {
+    for (int i = 0; i < glowModels[glowModel]->getMeshCount(); i++) {
+        int slot = glowFirstSlot[glowModel] + i;
+        if (occlusionMode == OCCLUSION_GPU) {
+            occlusionQueries.beginConditional(slot);
+            glowModels[glowModel]->DrawMesh(shader, i);
+            occlusionQueries.endConditional(slot);
+        } else {
+            glowModels[glowModel]->DrawMesh(shader, i);
+        }
+    }
+}
+
+void renderCat(gps::Shader shader, RenderPass pass) {
+    shader.useShaderProgram();
+    drawObject(shader, OBJ_CAT, pass);
+}
+
+void renderMScene(gps::Shader shader, RenderPass pass) {
+    shader.useShaderProgram();
+    drawObject(shader, OBJ_SCENE, pass);
+}
+
+void renderGround(gps::Shader shader, RenderPass pass) {
+    shader.useShaderProgram();
+    drawObject(shader, OBJ_GROUND, pass);
+}
+
+void renderBroom(gps::Shader shader, RenderPass pass) {
+    shader.useShaderProgram();
+    drawObject(shader, OBJ_BROOM, pass);
+}
+
+void renderSpoon(gps::Shader shader, RenderPass pass) {
+    shader.useShaderProgram();
+    drawObject(shader, OBJ_SPOON, pass);
+}
+
+void renderTeapot(gps::Shader shader, RenderPass pass) {
+    shader.useShaderProgram();
+    drawObject(shader, OBJ_TEAPOT, pass);
+}
+
+void renderBigGrass(gps::Shader shader, RenderPass pass) {
+    shader.useShaderProgram();
+    drawObject(shader, OBJ_BIG_GRASS, pass);
 }
 
 void renderLights(gps::Shader shader) {
@@ -675,13 +2018,9 @@ void renderLights(gps::Shader shader) {
     }
     glDisable(GL_CULL_FACE);
 
-    house_light.Draw(shader);
-    pole_light1.Draw(shader);
-    pole_light2.Draw(shader);
-    pole_light3.Draw(shader);
-    candle1.Draw(shader);
-    candle2.Draw(shader);
-    candle3.Draw(shader);
+    for (int i = 0; i < GLOW_MODEL_COUNT; i++) {
+        drawGlowModel(shader, i);
+    }
 
     glDepthMask(GL_TRUE);
     glDisable(GL_BLEND);
@@ -689,127 +2028,411 @@ void renderLights(gps::Shader shader) {
 }
 
 
-void renderScene() {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// draws the static casters into area of the bound depth map, culled by the part of the
+// cascade's light volume above the area. The cached maps can't depend on the camera, so
+// only the light volume culls them
+void renderStaticCasters(int cascade, const ShadowRect& area) {
+    // scales the area's x and y up to the whole clip space
+    float x0 = 2.0f * area.x0 / CASCADE_SIZE - 1.0f, x1 = 2.0f * area.x1 / CASCADE_SIZE - 1.0f;
+    float y0 = 2.0f * area.y0 / CASCADE_SIZE - 1.0f, y1 = 2.0f * area.y1 / CASCADE_SIZE - 1.0f;
+    glm::mat4 areaMatrix = glm::mat4(1.0f);
+    areaMatrix[0][0] = 2.0f / (x1 - x0);
+    areaMatrix[1][1] = 2.0f / (y1 - y0);
+    areaMatrix[3][0] = -(x1 + x0) / (x1 - x0);
+    areaMatrix[3][1] = -(y1 + y0) / (y1 - y0);
+    gps::Frustum areaVolume = gps::Frustum::fromMatrix(areaMatrix * lightSpaceTrMatrices[cascade]);
+    areaVolume.planes[gps::Frustum::NEAR_PLANE].d = 1e30f;
+
+    staticCasterVisible[cascade].assign(meshInstances.size(), false);
+    queryResult.clear();
+    sceneBVH.queryFrustum(areaVolume, queryResult);
+    for (size_t i = 0; i < queryResult.size(); i++) {
+        staticCasterVisible[cascade][queryResult[i]] = true;
+    }
 
-	//render the scene
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(area.x0, area.y0, area.x1 - area.x0, area.y1 - area.y0);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    renderMScene(depthMapShader, PASS_STATIC_SHADOW);
+    renderGround(depthMapShader, PASS_STATIC_SHADOW);
+    renderBigGrass(depthMapShader, PASS_STATIC_SHADOW);
+    glDisable(GL_SCISSOR_TEST);
+}
 
-    // shadow pass (depth map)
-     depthMapShader.useShaderProgram();
-     glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
-     glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-     glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-     glClear(GL_DEPTH_BUFFER_BIT);
+// brings the cascade's map to the static casters alone, returns false when the cached map
+// could be used as it is and only needs copying where the moving casters were
+bool updateStaticShadowMap(int cascade) {
+    const int size = (int)CASCADE_SIZE;
+    const ShadowRect full = { 0, 0, size, size };
+    glm::ivec2 shift = cascadeOrigins[cascade] - cachedOrigins[cascade];
+
+    if (staticShadowDirty || cascadeCenteredMatrices[cascade] != cachedCenteredMatrices[cascade]
+        || std::abs(shift.x) >= size || std::abs(shift.y) >= size) {
+        glBindFramebuffer(GL_FRAMEBUFFER, staticShadowMapFBOs[cascade]);
+        renderStaticCasters(cascade, full);
+        cachedCenteredMatrices[cascade] = cascadeCenteredMatrices[cascade];
+        cachedOrigins[cascade] = cascadeOrigins[cascade];
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, staticShadowMapFBOs[cascade]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapFBOs[cascade]);
+        glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        return true;
+    }
 
-	// render the teapot
-	 //renderTeapot(myBasicShader, true);
-     renderCat(depthMapShader, true);
-     renderMScene(depthMapShader, true);
-     renderGround(depthMapShader, true);
-     renderBroom(depthMapShader, true);
-     renderTeapot(depthMapShader, true);
-     renderSpoon(depthMapShader, true);
-     renderBigGrass(depthMapShader, true);
-     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (shift.x == 0 && shift.y == 0) {
+        return false;
+    }
 
-     // main pass
-     if (showDepthMap) {
-		glViewport(0, 0, retina_width, retina_height);
+    // the cascade moved by shift texels: a texel of the cache lands shift texels lower in
+    // the cascade's map, the strips along the edges it uncovers are drawn, and the map
+    // goes back to the cache (a blit can't overlap itself)
+    ShadowRect kept = { std::max(0, -shift.x), std::max(0, -shift.y), std::min(size, size - shift.x), std::min(size, size - shift.y) };
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, staticShadowMapFBOs[cascade]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapFBOs[cascade]);
+    glBlitFramebuffer(kept.x0 + shift.x, kept.y0 + shift.y, kept.x1 + shift.x, kept.y1 + shift.y,
+                      kept.x0, kept.y0, kept.x1, kept.y1, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBOs[cascade]);
+    if (shift.x != 0) {
+        ShadowRect strip = { shift.x > 0 ? kept.x1 : 0, 0, shift.x > 0 ? size : kept.x0, size };
+        renderStaticCasters(cascade, strip);
+    }
+    if (shift.y != 0) {
+        ShadowRect strip = { kept.x0, shift.y > 0 ? kept.y1 : 0, kept.x1, shift.y > 0 ? size : kept.y0 };
+        renderStaticCasters(cascade, strip);
+    }
+    cachedOrigins[cascade] = cascadeOrigins[cascade];
 
-		glClear(GL_COLOR_BUFFER_BIT);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, shadowMapFBOs[cascade]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, staticShadowMapFBOs[cascade]);
+    glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    return true;
+}
 
-		screenQuadShader.useShaderProgram();
+// static casters come from the cascade's cached map, see updateStaticShadowMap. Each frame
+// the area the moving casters covered last frame and cover now is copied back from it,
+// then the moving casters are drawn scissored to their own area
+void renderCachedShadowMap(int cascade) {
+    bool refreshed = updateStaticShadowMap(cascade);
+
+    ShadowRect rect = dynamicCasterRect(cascade);
+    ShadowRect restore = { 0, 0, 0, 0 };
+    const ShadowRect& previous = previousDynamicRects[cascade];
+    if (!refreshed) {
+        restore = rect;
+        if (restore.isEmpty()) {
+            restore = previous;
+        } else if (!previous.isEmpty()) {
+            restore.x0 = std::min(restore.x0, previous.x0);
+            restore.y0 = std::min(restore.y0, previous.y0);
+            restore.x1 = std::max(restore.x1, previous.x1);
+            restore.y1 = std::max(restore.y1, previous.y1);
+        }
+    }
 
-		//bind the depth map
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-		glUniform1i(glGetUniformLocation(screenQuadShader.shaderProgram, "depthMap"), 0);
+    cascadeDepthChanged[cascade] = refreshed || !restore.isEmpty();
+    if (!restore.isEmpty()) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, staticShadowMapFBOs[cascade]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapFBOs[cascade]);
+        glBlitFramebuffer(restore.x0, restore.y0, restore.x1, restore.y1,
+                          restore.x0, restore.y0, restore.x1, restore.y1,
+                          GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    }
 
-		glDisable(GL_DEPTH_TEST);
-		screenQuad.Draw(screenQuadShader);
-		glEnable(GL_DEPTH_TEST);
-	 }
-	 else {
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBOs[cascade]);
+    if (!rect.isEmpty()) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+        replayCommands(cascadeCommands[cascade], depthMapShader, PASS_SHADOW);
+        glDisable(GL_SCISSOR_TEST);
+    }
 
-		// final scene rendering pass (with shadows)
-		glViewport(0, 0, retina_width, retina_height);
+    previousDynamicRects[cascade] = rect;
+}
 
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// redraws the most important stale faces of the point light cubes, within the budget
+void renderPointShadows() {
+    // faces that saw an animated mesh before or after it moved go stale
+    if (pointShadowCasterBounds.size() != animatedInstances.size()) {
+        pointShadowCasterBounds.resize(animatedInstances.size());
+        for (size_t i = 0; i < animatedInstances.size(); i++) {
+            pointShadowCasterBounds[i] = instanceBounds[animatedInstances[i]];
+        }
+    }
+    for (size_t i = 0; i < animatedInstances.size(); i++) {
+        const gps::AABB& box = instanceBounds[animatedInstances[i]];
+        gps::AABB& previous = pointShadowCasterBounds[i];
+        if (box.min != previous.min || box.max != previous.max) {
+            gps::AABB swept = box;
+            swept.extend(previous);
+            pointShadows.invalidate(swept);
+            previous = box;
+        }
+    }
 
-		myBasicShader.useShaderProgram();
+    pointShadowFaces.clear();
+    pointShadows.schedule(myCamera.getCameraPosition(), cameraFrustum, POINT_SHADOW_FACE_BUDGET, pointShadowFaces);
+    frameStats.pointShadowFaces += (int)pointShadowFaces.size();
 
-        glm::vec3 pointLightPositions[7] = {
-        glm::vec3(0.633715f, 0.178798f, -3.02519f),  // candle1
-        glm::vec3(0.636248f, 0.113232f, -3.00641f),  // candle2
-        glm::vec3(0.044475f, 0.391092f, -1.6515f),  // candle3
-        glm::vec3(1.45561f, 0.340656f, -1.99858f),  // house_light
-        glm::vec3(0.620615f, 0.297354f,         0.01794f),  // pole_light1
-        glm::vec3(1.08481f, 0.230449f, 1.26476), // pole_light2
-        glm::vec3(-2.15379f, 0.259114f, 0.928646f)   // pole_light3
-        };
+    depthMapShader.useShaderProgram();
+    GLint depthLightSpaceLoc = glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix");
+    for (size_t i = 0; i < pointShadowFaces.size(); i++) {
+        int face = pointShadowFaces[i];
+        glm::mat4 faceLightSpace = pointShadows.beginFace(face);
+        glUniformMatrix4fv(depthLightSpaceLoc, 1, GL_FALSE, glm::value_ptr(faceLightSpace));
+
+        pointCasterVisible.assign(meshInstances.size(), false);
+        queryResult.clear();
+        sceneBVH.queryFrustum(pointShadows.getFaceFrustum(face), queryResult);
+        for (size_t j = 0; j < queryResult.size(); j++) {
+            pointCasterVisible[queryResult[j]] = true;
+        }
 
-        glm::vec3 pointLightColors[7] = {
-            glm::vec3(0.5f, 0.4f, 0.1f),  // warm candle glow
-            glm::vec3(0.5f, 0.4f, 0.1f),  // warm candle glow
-            glm::vec3(0.5f, 0.4f, 0.1f),  // warm candle glow
-            glm::vec3(0.1f, 0.1f, 0.5f),  // house light
-            glm::vec3(0.5f, 0.4f, 0.1f),  // pole light
-            glm::vec3(0.5f, 0.4f, 0.1f),   // pole light
-            glm::vec3(0.5f, 0.4f, 0.1f)   // pole light
-        };
+        renderCat(depthMapShader, PASS_POINT_SHADOW);
+        renderMScene(depthMapShader, PASS_POINT_SHADOW);
+        renderGround(depthMapShader, PASS_POINT_SHADOW);
+        renderBroom(depthMapShader, PASS_POINT_SHADOW);
+        renderTeapot(depthMapShader, PASS_POINT_SHADOW);
+        renderSpoon(depthMapShader, PASS_POINT_SHADOW);
+        renderBigGrass(depthMapShader, PASS_POINT_SHADOW);
+    }
+}
 
-        for (int i = 0; i < 7; i++)
-        {
-            std::string posName = "pointLightPositions[" + std::to_string(i) + "]";
-            std::string colName = "pointLightColors[" + std::to_string(i) + "]";
+// turns the depth of the cascades redrawn this frame into blurred EVSM moments: the
+// first pass warps the depth and blurs it along x, the second blurs along y into the layer
+void filterShadowMoments() {
+    bool anyChanged = false;
+    glDisable(GL_DEPTH_TEST);
+    // the quads must cover every texel whatever the wireframe mode
+    if (polygonMode != GL_FILL) {
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    }
 
-            GLint posLoc = glGetUniformLocation(myBasicShader.shaderProgram, posName.c_str());
-            GLint colLoc = glGetUniformLocation(myBasicShader.shaderProgram, colName.c_str());
+    for (int cascade = 0; cascade < CASCADE_COUNT; cascade++) {
+        if (!cascadeDepthChanged[cascade]) {
+            continue;
+        }
+        anyChanged = true;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, frameGraph.getFramebuffer(shadowBlurResource));
+        evsmMomentsShader.useShaderProgram();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthMapTexture);
+        glUniform1i(glGetUniformLocation(evsmMomentsShader.shaderProgram, "depthMap"), 0);
+        glUniform1i(glGetUniformLocation(evsmMomentsShader.shaderProgram, "layer"), cascade);
+        screenQuad.Draw(evsmMomentsShader);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMomentsFBOs[cascade]);
+        evsmBlurShader.useShaderProgram();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, frameGraph.getTexture(shadowBlurResource));
+        glUniform1i(glGetUniformLocation(evsmBlurShader.shaderProgram, "moments"), 0);
+        screenQuad.Draw(evsmBlurShader);
+    }
+
+    if (anyChanged) {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMomentsTexture);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+
+    if (polygonMode != GL_FILL) {
+        glPolygonMode(GL_FRONT_AND_BACK, polygonMode);
+    }
+    glEnable(GL_DEPTH_TEST);
+}
+
+// depth of the cascades, static casters from the cache when it is on
+void renderShadowPass() {
+    depthMapShader.useShaderProgram();
+    GLint depthLightSpaceLoc = glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix");
+    glViewport(0, 0, CASCADE_SIZE, CASCADE_SIZE);
+    // casters in front of the light's near plane are flattened onto it instead of clipped
+    glEnable(GL_DEPTH_CLAMP);
+    shadowPassTimer.begin();
+
+    for (currentCascade = 0; currentCascade < CASCADE_COUNT; currentCascade++) {
+        glUniformMatrix4fv(depthLightSpaceLoc, 1, GL_FALSE, glm::value_ptr(lightSpaceTrMatrices[currentCascade]));
 
-            glUniform3fv(posLoc, 1, glm::value_ptr(pointLightPositions[i]));
-            glUniform3fv(colLoc, 1, glm::value_ptr(pointLightColors[i]));
+        if (shadowCaching) {
+            renderCachedShadowMap(currentCascade);
+        } else {
+            glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBOs[currentCascade]);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            cascadeDepthChanged[currentCascade] = true;
+
+            replayCommands(cascadeCommands[currentCascade], depthMapShader, PASS_SHADOW);
         }
+    }
+    staticShadowDirty = false;
+    glDisable(GL_DEPTH_CLAMP);
+}
 
-		view = myCamera.getViewMatrix();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+// final scene rendering pass (with shadows), into the G-buffer and then lit on the deferred path
+void renderMainPass() {
+    shadowPassTimer.end();
+    mainPassTimer.begin();
 
-        glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    if (renderPath == RENDER_DEFERRED) {
+        deferredShading.resize(retina_width, retina_height);
+        deferredShading.beginGeometryPass();
+    }
 
-        glm::vec3 moonColor = glm::vec3(0.1f, 0.15f, 0.25f);
-        glUniform3fv(lightColorLoc, 1, glm::value_ptr(moonColor));
+    if (renderPath == RENDER_FORWARD) {
+        // lights are binned for this frame's camera, the shader reads them in view space
+        double clusterStart = glfwGetTime();
+        lightClusters.update(lightManager.getEyeLights(), projection);
+        frameStats.clusterTime += glfwGetTime() - clusterStart;
+        frameStats.clusterIndices += lightClusters.getIndexCount();
+        frameStats.occupiedClusters += lightClusters.getOccupiedClusterCount();
+    }
 
-		//lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-		glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
+    glm::vec3 moonColor = MOON_COLOR;
+
+    //lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    //bind the shadow map
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthMapTexture);
+    // the same depth array again, read through the comparison sampler
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthMapTexture);
+    glBindSampler(4, shadowCompareSampler);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMomentsTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    // the variants get this frame's uniforms on their first draw
+    frameIndex++;
+    // except the vertex stage ones, set once on the stage all of them share
+    GLuint basicVertexProgram = basicShaderVariants.getVertexProgram();
+    glProgramUniformMatrix4fv(basicVertexProgram, glGetUniformLocation(basicVertexProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glProgramUniformMatrix4fv(basicVertexProgram, glGetUniformLocation(basicVertexProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+
+    //render objects, in the order they were recorded
+    for (int k = 0; k < OBJ_COUNT; k++) {
+        replayCommands(mainPassCommands[mainPassOrder[k]], myBasicShader, PASS_MAIN);
+    }
 
-		//bind the shadow map
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-		glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
+    if (renderPath == RENDER_DEFERRED) {
+        applyDeferredLighting(moonColor);
+    }
+}
 
-		glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"),
-			1,
-			GL_FALSE,
-			glm::value_ptr(computeLightSpaceTrMatrix()));
+void renderLightGlowPass() {
+    lightShader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
 
-        //render objects
-		//renderTeapot(myBasicShader, false);
-        renderMScene(myBasicShader, false);
-        renderGround(myBasicShader, false);
-        renderBroom(myBasicShader, false);
-        renderTeapot(myBasicShader, false);
-        renderSpoon(myBasicShader, false);
-        renderCat(myBasicShader, false);
-        renderBigGrass(myBasicShader, false);
+    renderLights(lightShader);
+}
 
-        lightShader.useShaderProgram();
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+void renderSkyboxPass() {
+    mySkyBox.Draw(skyboxShader, view, projection);
+    mainPassTimer.end();
+}
 
-      
-        renderLights(lightShader);
+// the cascades of the shadow map on screen instead of the scene
+void renderDepthMapPass() {
+    shadowPassTimer.end();
 
-		mySkyBox.Draw(skyboxShader, view, projection);
-	}
+    screenQuadShader.useShaderProgram();
+
+    //bind the depth map
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthMapTexture);
+    glUniform1i(glGetUniformLocation(screenQuadShader.shaderProgram, "depthMap"), 0);
+
+    glDisable(GL_DEPTH_TEST);
+    screenQuad.Draw(screenQuadShader);
+    glEnable(GL_DEPTH_TEST);
+}
+
+// declares the passes of a frame in the order they run and what each reads and writes. The
+// shadow maps are kept by their passes, the screen is bound and cleared by the graph
+void initRenderGraph() {
+    shadowDepthResource = frameGraph.importResource("shadow depth");
+    shadowMomentsResource = frameGraph.importResource("shadow moments");
+    shadowBlurResource = frameGraph.createTransient("shadow blur", CASCADE_SIZE, CASCADE_SIZE, GL_RG32F);
+    pointShadowResource = frameGraph.importResource("point shadows");
+    sceneColorResource = frameGraph.importTarget("scene color", 0, retina_width, retina_height);
+    sceneDepthResource = frameGraph.importTarget("scene depth", 0, retina_width, retina_height);
+    // read back by the next frame's draws
+    occlusionResultsResource = frameGraph.importResource("occlusion results");
+    frameGraph.markOutput(sceneColorResource);
+    frameGraph.markOutput(occlusionResultsResource);
+
+    gps::RenderGraph::Pass shadowPass = frameGraph.addPass("shadow", renderShadowPass);
+    frameGraph.write(shadowPass, shadowDepthResource);
+
+    momentsPass = frameGraph.addPass("shadow moments", filterShadowMoments);
+    frameGraph.read(momentsPass, shadowDepthResource);
+    frameGraph.write(momentsPass, shadowBlurResource);
+    frameGraph.read(momentsPass, shadowBlurResource);
+    frameGraph.write(momentsPass, shadowMomentsResource);
+
+    gps::RenderGraph::Pass pointShadowPass = frameGraph.addPass("point shadows", renderPointShadows);
+    frameGraph.write(pointShadowPass, pointShadowResource);
+
+    mainPass = frameGraph.addPass("main", renderMainPass);
+    frameGraph.read(mainPass, shadowDepthResource);
+    frameGraph.read(mainPass, shadowMomentsResource);
+    frameGraph.read(mainPass, pointShadowResource);
+    frameGraph.write(mainPass, sceneColorResource, GL_COLOR_BUFFER_BIT);
+    frameGraph.write(mainPass, sceneDepthResource, GL_DEPTH_BUFFER_BIT);
+
+    lightGlowPass = frameGraph.addPass("light glow", renderLightGlowPass);
+    frameGraph.read(lightGlowPass, sceneDepthResource);
+    frameGraph.write(lightGlowPass, sceneColorResource);
+
+    occlusionQueryPass = frameGraph.addPass("occlusion queries", issueOcclusionQueries);
+    frameGraph.read(occlusionQueryPass, sceneDepthResource);
+    frameGraph.write(occlusionQueryPass, occlusionResultsResource);
+
+    skyboxPass = frameGraph.addPass("skybox", renderSkyboxPass);
+    frameGraph.read(skyboxPass, sceneDepthResource);
+    frameGraph.write(skyboxPass, sceneColorResource);
+
+    depthMapPass = frameGraph.addPass("depth map", renderDepthMapPass);
+    frameGraph.read(depthMapPass, shadowDepthResource);
+    frameGraph.write(depthMapPass, sceneColorResource, GL_COLOR_BUFFER_BIT);
+}
+
+void renderScene() {
+    view = myCamera.getViewMatrix();
+    computeCascades();
+    writeDrawConstants();
+
+    cullScene(projection * view);
+    cullShadowCasters();
+
+    // only the lights reaching a visible mesh are kept, already moved to eye space
+    double lightCullStart = glfwGetTime();
+    lightManager.update(view, sceneBVH, instanceVisible);
+    frameStats.lightCullTime += glfwGetTime() - lightCullStart;
+    frameStats.activeLights += lightManager.getEyeLights().size();
+    frameStats.lightListEntries += lightManager.getListEntryCount();
+
+    recordFrameCommands();
+
+	//render the scene, the graph skips the passes nothing on screen reads
+    frameGraph.setEnabled(momentsPass, shadowFilter == SHADOW_EVSM);
+    frameGraph.setEnabled(mainPass, !showDepthMap);
+    frameGraph.setEnabled(lightGlowPass, !showDepthMap);
+    frameGraph.setEnabled(occlusionQueryPass, !showDepthMap && occlusionMode == OCCLUSION_GPU);
+    frameGraph.setEnabled(skyboxPass, !showDepthMap);
+    frameGraph.setEnabled(depthMapPass, showDepthMap);
+    frameGraph.setTargetSize(sceneColorResource, retina_width, retina_height);
+    frameGraph.setTargetSize(sceneDepthResource, retina_width, retina_height);
+    if (frameGraph.compile()) {
+        frameGraph.printReport();
+    }
+    frameGraph.execute();
+
+    // the startup variants no draw picked yet still get their logs checked and cached
+    gps::Shader::finishCompletedPrograms();
+
+    drawConstantRing.endFrame();
+    updateFrameStats();
 }
 
 
@@ -846,6 +2469,24 @@ int main(int argc, const char * argv[]) {
 	initUniforms();
     initFBO();
     initSkybox();
+    initRenderGraph();
+    initTransforms();
+    initSceneBVH();
+    initMaterials();
+    initShaderVariants();
+    initShadowProxies();
+    initLights();
+
+    if (argc > 1 && strcmp(argv[1], "--bake") == 0) {
+        bakeStaticLighting();
+        cleanup();
+        return EXIT_SUCCESS;
+    }
+    initBakedLighting();
+
+    initOccluders();
+    initOcclusionQueries();
+    statsStart = glfwGetTime();
     setWindowCallbacks();
 
     if (!SoundEngine) {
@@ -860,6 +2501,8 @@ int main(int argc, const char * argv[]) {
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
         processMovement();
+        updateSceneObjects();
+        updateFireflies();
 	    renderScene();
 
 		glfwPollEvents();
@@ -868,6 +2511,10 @@ int main(int argc, const char * argv[]) {
 		glCheckError();
 	}
 
+	basicShaderVariants.printReport();
+	if (programBinaryCache.isEnabled()) {
+		fprintf(stdout, "Program binary cache: %.1f KB of binaries loaded or stored\n", programBinaryCache.getByteCount() / 1024.0);
+	}
 	cleanup();
     SoundEngine->drop();
     return EXIT_SUCCESS;
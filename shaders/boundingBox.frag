@@ -0,0 +1,8 @@
+#version 410 core
+
+out vec4 fColor;
+
+void main()
+{
+	fColor = vec4(1.0f);
+}
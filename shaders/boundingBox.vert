@@ -0,0 +1,13 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+
+uniform mat4 viewProjection;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+void main()
+{
+	//the unit cube is stretched over the box
+	gl_Position = viewProjection * vec4(mix(boxMin, boxMax, vPosition), 1.0f);
+}
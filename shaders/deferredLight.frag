@@ -0,0 +1,81 @@
+#version 410 core
+
+flat in vec4 fLightPositionRadius;
+flat in vec3 fLightColor;
+flat in float fShadowSlot;
+
+out vec4 fColor;
+
+//G-buffer of the deferred path
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseProjection;
+uniform vec2 screenSize;
+uniform mat4 view;
+
+//point light shadows, one depth cube per shadowed light
+uniform samplerCubeArrayShadow pointShadowMap;
+uniform float pointShadowNear;
+
+float specularStrength = 0.5f;
+float shininess = 32.0f;
+
+float computeFog(vec3 posEye){
+	float fogDensity = 0.4f;
+	float fragmentDistance = length(vec4(posEye, 1.0f));
+	float fogFactor = exp(-pow(fragmentDistance * fogDensity, 2));
+
+	return clamp(fogFactor, 0.0f, 1.0f);
+}
+
+//same lookup as computePointShadow in shaderStart.frag
+float computePointShadow(vec3 posEye, vec3 lightPosEye, float radius, float slot){
+	vec3 toFragment = transpose(mat3(view)) * (posEye - lightPosEye);
+	vec3 axisDistances = abs(toFragment);
+	float axisDistance = max(axisDistances.x, max(axisDistances.y, axisDistances.z)) * 0.98f;
+	float near = pointShadowNear;
+	float far = radius;
+	float depth = (far + near) / (far - near) - 2.0f * far * near / ((far - near) * axisDistance);
+	return texture(pointShadowMap, vec4(toFragment, slot), depth * 0.5f + 0.5f);
+}
+
+void main()
+{
+	vec2 texCoords = gl_FragCoord.xy / screenSize;
+	float depth = texture(gDepth, texCoords).r;
+	if (depth == 1.0f)
+		discard;
+
+	vec4 posEye = inverseProjection * vec4(vec3(texCoords, depth) * 2.0f - 1.0f, 1.0f);
+	posEye /= posEye.w;
+
+	//the depth test only rejects pixels behind the volume, these are in front of it
+	vec3 lightPosEye = fLightPositionRadius.xyz;
+	float radius = fLightPositionRadius.w;
+	float distance = length(lightPosEye - posEye.xyz);
+	if (distance >= radius)
+		discard;
+
+	vec3 diffColor = texture(gAlbedo, texCoords).rgb;
+	vec3 normalEye = normalize(texture(gNormal, texCoords).xyz);
+
+	//same point light as computePointLights in shaderStart.frag
+	vec3 lightDir = normalize(lightPosEye - posEye.xyz);
+	float diff = max(dot(normalEye, lightDir), 0.0f);
+
+	vec3 viewDir = normalize(-posEye.xyz);
+	vec3 reflection = reflect(-lightDir, normalEye);
+	float spec = pow(max(dot(viewDir, reflection), 0.0f), shininess);
+
+	float atten = 1.0f / (1.0f + 1.5f * distance + 3.0f * (distance * distance));
+	float falloff = clamp(1.0f - pow(distance / radius, 4.0f), 0.0f, 1.0f);
+	atten *= falloff * falloff;
+
+	vec3 pointLight = (diff + spec * specularStrength) * fLightColor * atten;
+	if (fShadowSlot >= 0.0f)
+		pointLight *= computePointShadow(posEye.xyz, lightPosEye, radius, fShadowSlot);
+
+	//blended on top of the fogged moon pass, so the fog is applied here too
+	fColor = vec4(pointLight * diffColor * computeFog(posEye.xyz), 1.0f);
+}
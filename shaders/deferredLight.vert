@@ -0,0 +1,21 @@
+#version 410 core
+
+//unit sphere, one instance per point light
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec4 lightPositionRadius;
+layout(location=2) in vec4 lightColor;
+
+flat out vec4 fLightPositionRadius;
+flat out vec3 fLightColor;
+flat out float fShadowSlot;
+
+uniform mat4 projection;
+
+void main()
+{
+	//light positions are already in eye space
+	fLightPositionRadius = lightPositionRadius;
+	fLightColor = lightColor.rgb;
+	fShadowSlot = lightColor.a;
+	gl_Position = projection * vec4(lightPositionRadius.xyz + vPosition * lightPositionRadius.w, 1.0f);
+}
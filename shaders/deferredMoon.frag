@@ -0,0 +1,66 @@
+#version 410 core
+
+in vec2 fTexCoords;
+
+out vec4 fColor;
+
+//G-buffer of the deferred path
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
+uniform mat4 inverseProjection;
+
+//lighting
+uniform vec3 lightDir;
+uniform vec3 lightColor;
+
+float ambientStrength = 0.05f;
+float specularStrength = 0.5f;
+float shininess = 32.0f;
+
+float computeFog(vec3 posEye){
+	float fogDensity = 0.4f;
+	//same distance as the forward path, measured on the homogeneous eye position
+	float fragmentDistance = length(vec4(posEye, 1.0f));
+	float fogFactor = exp(-pow(fragmentDistance * fogDensity, 2));
+
+	return clamp(fogFactor, 0.0f, 1.0f);
+}
+
+void main()
+{
+	//the depth goes to the window's depth buffer for the light volumes and the skybox
+	float depth = texture(gDepth, fTexCoords).r;
+	gl_FragDepth = depth;
+	if (depth == 1.0f) {
+		//no geometry, left to the skybox
+		fColor = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		return;
+	}
+
+	vec4 posEye = inverseProjection * vec4(vec3(fTexCoords, depth) * 2.0f - 1.0f, 1.0f);
+	posEye /= posEye.w;
+
+	vec4 albedo = texture(gAlbedo, fTexCoords);
+	vec3 diffColor = albedo.rgb;
+	//moon visibility, 1 - shadow
+	float lit = albedo.a;
+	vec3 normalEye = normalize(texture(gNormal, fTexCoords).xyz);
+	vec3 specColor = texture(gSpecular, fTexCoords).rgb;
+
+	vec3 lightDirN = normalize(lightDir);
+	vec3 viewDirN = normalize(-posEye.xyz);
+
+	vec3 ambient = ambientStrength * lightColor * diffColor;
+	vec3 diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor * diffColor;
+	vec3 reflection = reflect(-lightDirN, normalEye);
+	float specCoeff = pow(max(dot(viewDirN, reflection), 0.0f), shininess);
+	vec3 specular = specularStrength * specCoeff * lightColor * specColor;
+
+	vec3 color = min(ambient + lit * diffuse + lit * specular, 1.0f);
+
+	float fogFactor = computeFog(posEye.xyz);
+	vec4 fogColor = vec4(0.01f, 0.01f, 0.05f, 1.0f);
+	fColor = fogColor * (1 - fogFactor) + vec4(color * fogFactor, 1.0f);
+}
@@ -1,7 +1,11 @@
 #version 410 core
 layout(location=0) in vec3 vPosition;
 uniform mat4 lightSpaceTrMatrix;
-uniform mat4 model;
+//per-draw constants, the object's range of the frame's constant ring
+layout(std140) uniform DrawConstants {
+	mat4 model;
+	mat3 normalMatrix;
+};
 
 
 void main()
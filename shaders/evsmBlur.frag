@@ -0,0 +1,22 @@
+#version 410 core
+
+out vec4 fColor;
+
+uniform sampler2D moments;
+
+//9 tap gaussian, from the center outwards
+const float weights[5] = float[](0.227027f, 0.1945946f, 0.1216216f, 0.054054f, 0.016216f);
+
+//second pass of the moment blur, along y
+void main() 
+{    
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    int lastTexel = textureSize(moments, 0).y - 1;
+
+    vec2 blurred = vec2(0.0f);
+    for (int i = -4; i <= 4; i++) {
+        blurred += weights[abs(i)] * texelFetch(moments, ivec2(texel.x, clamp(texel.y + i, 0, lastTexel)), 0).rg;
+    }
+
+    fColor = vec4(blurred, 0.0f, 1.0f);
+}
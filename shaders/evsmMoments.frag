@@ -0,0 +1,26 @@
+#version 410 core
+
+out vec4 fColor;
+
+uniform sampler2DArray depthMap;
+uniform int layer;
+uniform float evsmExponent;
+
+//9 tap gaussian, from the center outwards
+const float weights[5] = float[](0.227027f, 0.1945946f, 0.1216216f, 0.054054f, 0.016216f);
+
+//warps the depth of a cascade into exponential moments, blurred along x
+void main() 
+{    
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    int lastTexel = textureSize(depthMap, 0).x - 1;
+
+    vec2 moments = vec2(0.0f);
+    for (int i = -4; i <= 4; i++) {
+        float depth = texelFetch(depthMap, ivec3(clamp(texel.x + i, 0, lastTexel), texel.y, layer), 0).r;
+        float warpedDepth = exp(evsmExponent * (depth * 2.0f - 1.0f));
+        moments += weights[abs(i)] * vec2(warpedDepth, warpedDepth * warpedDepth);
+    }
+
+    fColor = vec4(moments, 0.0f, 1.0f);
+}
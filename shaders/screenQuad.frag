@@ -4,10 +4,13 @@ in vec2 fTexCoords;
 
 out vec4 fColor;
 
-uniform sampler2D depthMap;
+uniform sampler2DArray depthMap;
 
 void main() 
 {    
-    fColor = vec4(vec3(texture(depthMap, fTexCoords).r), 1.0f);
+    //the cascades in a 2 x 2 grid, the first one top left
+    vec2 cell = min(floor(fTexCoords * 2.0f), vec2(1.0f));
+    float cascade = cell.x + 2.0f * (1.0f - cell.y);
+    fColor = vec4(vec3(texture(depthMap, vec3(fTexCoords * 2.0f - cell, cascade)).r), 1.0f);
     //fColor = vec4(fTexCoords, 0.0f, 1.0f);
 }
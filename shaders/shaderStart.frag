@@ -1,33 +1,84 @@
 #version 410 core
 
-in vec3 fNormal;
-in vec4 fPosEye;
-in vec2 fTexCoords;
-in vec4 fragPosLightSpace;
-in vec3 fPosition;
-
-out vec4 fColor;
+//variants, compiled by ShaderPermutations with a set of these defined:
+//TEXTURED      diffuse color from diffuseTexture instead of the material table
+//SPECULAR_MAP  specular color from specularTexture
+//ALPHA_TEST    fragments where the diffuse texture is mostly transparent are discarded
+//SHADOWED      the moon's cascaded shadow map is read
+//POINT_LIGHTS  the point lights of the fragment's cluster are added
+//FOG           exponential squared fog
+//GBUFFER       geometry pass of the deferred path, the lights are applied later from the G-buffer
+//LIGHTMAP      static objects, the moon and the baked point lights come from the lightmap
+//PROBES        moving objects, the moon and the baked point lights come from the irradiance probes
+
+//locations of the shared vertex stage's outputs
+layout(location = 0) in vec3 fNormal;
+layout(location = 1) in vec4 fPosEye;
+layout(location = 2) in vec2 fTexCoords;
+layout(location = 3) in vec3 fPosition;
+layout(location = 4) in vec2 fLightmapCoords;
+layout(location = 5) flat in int fMaterial;
+
+layout(location = 0) out vec4 fColor;
+//G-buffer targets of the deferred path, fColor holds the albedo and moon visibility
+layout(location = 1) out vec4 gNormal;
+layout(location = 2) out vec4 gSpecular;
 
 //lighting
 uniform	vec3 lightDir;
 uniform	vec3 lightColor;
 
-//point lights
-#define NR_POINT_LIGHTS 7
-uniform vec3 pointLightPositions[NR_POINT_LIGHTS];
-uniform vec3 pointLightColors[NR_POINT_LIGHTS];
+//clustered point lights, binned on the CPU into froxels, positions already in eye space
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLights;
+uniform ivec3 clusterCount;
+uniform vec2 clusterTileScale;
+uniform float clusterSliceScale;
+uniform float clusterSliceBias;
+uniform bool showClusterHeatmap;
+
+//point light shadows, one depth cube per shadowed light
+uniform samplerCubeArrayShadow pointShadowMap;
+uniform float pointShadowNear;
+//flags in the w of the light data: shadow slot + 1 in the low bits, LIGHT_BAKED
+#define LIGHT_SLOT_MASK 255
+#define LIGHT_BAKED 256
+
+//baked moon and static point light irradiance (rgb) and ambient occlusion (a)
+uniform sampler2D lightmap;
+
+//irradiance probes of the moving objects: L1 spherical harmonics already convolved with the
+//cosine lobe, irradiance in rgb and visibility in a, laid out over the scene in world space
+#define PROBE_COEFFICIENT_COUNT 4
+uniform sampler3D probeCoefficients[PROBE_COEFFICIENT_COUNT];
+uniform vec3 probeGridScale;
+uniform vec3 probeGridBias;
 
 uniform mat4 view;
 
+//cascaded shadow map
+#define CASCADE_COUNT 4
+uniform mat4 lightSpaceTrMatrices[CASCADE_COUNT];
+//view space depth where each cascade ends
+uniform float cascadeSplits[CASCADE_COUNT];
+
+//shadow filtering, same order as ShadowFilter in main.cpp
+#define SHADOW_HARD 0
+#define SHADOW_PCF 1
+#define SHADOW_EVSM 2
+uniform int shadowFilter;
+uniform float evsmExponent;
+
 //texture
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
-uniform sampler2D shadowMap;
+uniform sampler2DArray shadowMap;
+uniform sampler2DArrayShadow shadowMapCompare;
+uniform sampler2DArray shadowMoments;
 
-//base color
-uniform bool useTexture;
-uniform bool hasDiffuseTexture;
-uniform vec3 baseColor;
+//.mtl colors of every material, ambient, diffuse and specular texels per entry
+uniform samplerBuffer materials;
 
 
 vec3 ambient;
@@ -36,6 +87,7 @@ vec3 diffuse;
 vec3 specular;
 float specularStrength = 0.5f;
 float shininess = 32.0f;
+float lightBleedingReduction = 0.3f;
 
 vec3 normal;
 vec3 lightDire;
@@ -67,13 +119,12 @@ void computeLightComponents()
 	specular = specularStrength * specCoeff * lightColor;
 }
 
-vec3 computePointLights(vec3 lightPos, vec3 lightCol){
+vec3 computePointLights(vec3 lightPosEye, vec3 lightCol, float radius){
 	vec3 cameraPosEye = vec3(0.0f);
-	vec4 lightPosEye = view * vec4(lightPos, 1.0f);
 	vec3 normalEye = normalize(fNormal);
 
 	//direction from frag to light
-	vec3 lightDir = normalize(lightPosEye.xyz - fPosEye.xyz);
+	vec3 lightDir = normalize(lightPosEye - fPosEye.xyz);
 
 	//compute diffuse light
 	float diff = max(dot(normalEye, lightDir), 0.0f);
@@ -84,8 +135,11 @@ vec3 computePointLights(vec3 lightPos, vec3 lightCol){
 	float spec = pow(max(dot(viewDir, reflection), 0.0f), shininess);
 
 	//attenuation (decreses with distance)
-	float distance = length(lightPosEye.xyz - fPosEye.xyz);
+	float distance = length(lightPosEye - fPosEye.xyz);
 	float atten = 1.0f / (1.0f + 1.5f * distance + 3.0f * (distance * distance));
+	//faded out before the radius the light was binned with
+	float falloff = clamp(1.0f - pow(distance / radius, 4.0f), 0.0f, 1.0f);
+	atten *= falloff * falloff;
 
 	vec3 diffLight = diff * lightCol * atten;
 	vec3 specLight = spec * lightCol * atten * specularStrength;
@@ -93,21 +147,104 @@ vec3 computePointLights(vec3 lightPos, vec3 lightCol){
 	return diffLight + specLight;
 }
 
+//fraction of a point light reaching the fragment, the cube faces store perspective depth
+//along their axis with the light radius as far plane
+float computePointShadow(vec3 lightPosEye, float radius, float slot){
+	//the cubes are laid out in world space
+	vec3 toFragment = transpose(mat3(view)) * (fPosEye.xyz - lightPosEye);
+	vec3 axisDistances = abs(toFragment);
+	//pulled a little toward the light against acne
+	float axisDistance = max(axisDistances.x, max(axisDistances.y, axisDistances.z)) * 0.98f;
+	float near = pointShadowNear;
+	float far = radius;
+	float depth = (far + near) / (far - near) - 2.0f * far * near / ((far - near) * axisDistance);
+	return texture(pointShadowMap, vec4(toFragment, slot), depth * 0.5f + 0.5f);
+}
+
+//baked irradiance (rgb) and ambient visibility (a) around a world space normal, trilinear
+//between the 8 probes around the fragment
+vec4 sampleProbes(vec3 normalWorld){
+	vec3 coords = fPosition * probeGridScale + probeGridBias;
+	vec4 irradiance = texture(probeCoefficients[0], coords)
+		+ texture(probeCoefficients[1], coords) * normalWorld.x
+		+ texture(probeCoefficients[2], coords) * normalWorld.y
+		+ texture(probeCoefficients[3], coords) * normalWorld.z;
+	return vec4(max(irradiance.rgb, 0.0f), clamp(irradiance.a, 0.0f, 1.0f));
+}
+
+//upper bound of the fraction of light reaching the fragment, from the moments
+float chebyshevUpperBound(vec2 moments, float mean, float minVariance){
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = mean - moments.x;
+    float pMax = variance / (variance + d * d);
+
+    //light bleeding reduction, the lowest bounds are cut to full shadow
+    pMax = clamp((pMax - lightBleedingReduction) / (1.0f - lightBleedingReduction), 0.0f, 1.0f);
+    return mean <= moments.x ? 1.0f : pMax;
+}
+
 float computeShadow(){
+    //first cascade whose slice holds the fragment
+    float viewDepth = -fPosEye.z;
+    int cascade = 0;
+    while (cascade < CASCADE_COUNT - 1 && viewDepth > cascadeSplits[cascade])
+        cascade++;
+
+    vec4 fragPosLightSpace = lightSpaceTrMatrices[cascade] * vec4(fPosition, 1.0f);
     vec3 normalizedCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
 	
     normalizedCoords = normalizedCoords * 0.5 + 0.5;
-    float closestDepth = texture(shadowMap, normalizedCoords.xy).r;
+
+    //taken before any branch, the mipmapped moments are sampled with them
+    vec2 coordsDx = dFdx(normalizedCoords.xy);
+    vec2 coordsDy = dFdy(normalizedCoords.xy);
+
+    //no shadow past the last cascade
+    if (viewDepth > cascadeSplits[CASCADE_COUNT - 1])
+        return 0.0f;
+
     float currentDepth = normalizedCoords.z;
     if (normalizedCoords.z > 1.0f)
         return 0.0f;
 
+    if (shadowFilter == SHADOW_EVSM) {
+        //lit outside the map, like the border of the depth map
+        if (any(lessThan(normalizedCoords.xy, vec2(0.0f))) || any(greaterThan(normalizedCoords.xy, vec2(1.0f))))
+            return 0.0f;
+
+        vec2 moments = textureGrad(shadowMoments, vec3(normalizedCoords.xy, cascade), coordsDx, coordsDy).rg;
+        float warpedDepth = exp(evsmExponent * (currentDepth * 2.0f - 1.0f));
+        float depthScale = 0.0001f * evsmExponent * warpedDepth;
+        return 1.0f - chebyshevUpperBound(moments, warpedDepth, depthScale * depthScale);
+    }
+
     float bias = max(0.005f * (1.0f - dot(normal, lightDire)), 0.0001f);
 
+    if (shadowFilter == SHADOW_PCF) {
+        //4 bilinear compares one texel apart, 16 texels in total
+        vec2 texelSize = 1.0f / vec2(textureSize(shadowMapCompare, 0).xy);
+        float lit = 0.0f;
+        for (int x = 0; x < 2; x++) {
+            for (int y = 0; y < 2; y++) {
+                vec2 offset = (vec2(x, y) * 2.0f - 1.0f) * texelSize;
+                lit += texture(shadowMapCompare, vec4(normalizedCoords.xy + offset, cascade, currentDepth - bias));
+            }
+        }
+        return 1.0f - lit / 4.0f;
+    }
+
+    float closestDepth = texture(shadowMap, vec3(normalizedCoords.xy, cascade)).r;
     float shadow = currentDepth - bias > closestDepth ? 1.0f : 0.0f;
     return shadow;
 }
 
+//froxel of the fragment: screen tile and exponential depth slice
+int computeCluster(){
+	ivec2 tile = min(ivec2(gl_FragCoord.xy * clusterTileScale), clusterCount.xy - 1);
+	int slice = clamp(int(log(-fPosEye.z) * clusterSliceScale - clusterSliceBias), 0, clusterCount.z - 1);
+	return (slice * clusterCount.y + tile.y) * clusterCount.x + tile.x;
+}
+
 float computeFog(){
 	float fogDensity = 0.4f;
 	float fragmentDistance = length(fPosEye);
@@ -124,15 +261,24 @@ void main()
 	vec3 diffColor;
 	vec3 specColor;
 
-	if(useTexture) {
-		//with texture -> we sample the colors
-		diffColor = texture(diffuseTexture, fTexCoords).rgb;
-		specColor = texture(specularTexture, fTexCoords).rgb;
-	}else{
-		//without texture -> we use the uniform color
-		diffColor = baseColor;
-		specColor = vec3(1.0f);
-	}
+#ifdef TEXTURED
+	//with texture -> we sample the colors
+	vec4 diffSample = texture(diffuseTexture, fTexCoords);
+#ifdef ALPHA_TEST
+	if (diffSample.a < 0.5f)
+		discard;
+#endif
+	diffColor = diffSample.rgb;
+#else
+	//without texture -> we use the material color
+	diffColor = texelFetch(materials, 3 * fMaterial + 1).rgb;
+#endif
+
+#ifdef SPECULAR_MAP
+	specColor = texture(specularTexture, fTexCoords).rgb;
+#else
+	specColor = vec3(1.0f);
+#endif
 
 	//vec3 baseColor = vec3(0.9f, 0.35f, 0.0f);//orange
 	
@@ -140,22 +286,68 @@ void main()
 	diffuse *= diffColor;
 	specular *= specColor;
 
+	//the lightmap and the probes already have the moon's shadows
+#ifdef SHADOWED
 	float shadow = computeShadow();
-
+#else
+	float shadow = 0.0f;
+#endif
+
+#ifdef GBUFFER
+	fColor = vec4(diffColor, 1.0f - shadow);
+	gNormal = vec4(normal, 0.0f);
+	gSpecular = vec4(specColor, 1.0f);
+#else
+
+#if defined(LIGHTMAP)
+	vec4 baked = texture(lightmap, fLightmapCoords);
+	vec3 color = min(ambient * baked.a + baked.rgb * diffColor, 1.0f);
+#elif defined(PROBES)
+	vec4 probe = sampleProbes(transpose(mat3(view)) * normal);
+	vec3 color = min(ambient * probe.a + probe.rgb * diffColor, 1.0f);
+#else
 	vec3 color = min((ambient + (1.0f - shadow)*diffuse) + (1.0f - shadow)*specular, 1.0f);
+#endif
 
-	//add  point lights
+#ifdef POINT_LIGHTS
+	//add the point lights of the fragment's cluster
+	uvec2 cluster = texelFetch(clusterGrid, computeCluster()).rg;
 	vec3 pointLight = vec3(0.0f);
-	for (int i = 0; i < NR_POINT_LIGHTS; i++){
-		pointLight += computePointLights(pointLightPositions[i], pointLightColors[i]);
+	for (uint i = 0u; i < cluster.y; i++){
+		int light = int(texelFetch(clusterLights, int(cluster.x + i)).r);
+		vec4 positionRadius = texelFetch(lightData, 2 * light);
+		vec4 colorFlags = texelFetch(lightData, 2 * light + 1);
+		int flags = int(colorFlags.a);
+#if defined(LIGHTMAP) || defined(PROBES)
+		if ((flags & LIGHT_BAKED) != 0)
+			continue;
+#endif
+		vec3 contribution = computePointLights(positionRadius.xyz, colorFlags.rgb, positionRadius.w);
+		int slot = (flags & LIGHT_SLOT_MASK) - 1;
+		if (slot >= 0)
+			contribution *= computePointShadow(positionRadius.xyz, positionRadius.w, float(slot));
+		pointLight += contribution;
 	}
 
 	color += pointLight * diffColor;
 
-	//vec3 color = min((ambient + diffuse) + specular, 1.0f);
+	//light count heatmap: blue for one light, through green to red at 16 and more
+	if (showClusterHeatmap) {
+		float heat = clamp(float(cluster.y) / 16.0f, 0.0f, 1.0f);
+		vec3 heatColor = cluster.y == 0u ? vec3(0.0f) : mix(mix(vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f), clamp(heat * 2.0f, 0.0f, 1.0f)),
+		                                                    vec3(1.0f, 0.0f, 0.0f), clamp(heat * 2.0f - 1.0f, 0.0f, 1.0f));
+		fColor = vec4(mix(color, heatColor, 0.7f), 1.0f);
+		return;
+	}
+#endif
+
+#ifdef FOG
     float fogFactor = computeFog();
 	vec4 fogColor = vec4(0.01f, 0.01f, 0.05f, 1.0f);
 	fColor = fogColor * (1 - fogFactor) + vec4(color * fogFactor, 1.0f);
-    //fColor = vec4(color, 1.0f);
+#else
+	fColor = vec4(color, 1.0f);
+#endif
     //fColor = vec4(outDbg, 1.0f);
+#endif
 }
@@ -3,18 +3,30 @@
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+layout(location=3) in vec2 vLightmapCoords;
+//entry of the material table, a constant attribute set per draw
+layout(location=4) in int vMaterial;
 
-out vec3 fNormal;
-out vec4 fPosEye;
-out vec2 fTexCoords;
-out vec4 fragPosLightSpace;
-out vec3 fPosition;
+//the stage is linked on its own and shared by every fragment variant, so the outputs match
+//the fragment inputs by location and the built-in block is declared
+layout(location=0) out vec3 fNormal;
+layout(location=1) out vec4 fPosEye;
+layout(location=2) out vec2 fTexCoords;
+layout(location=3) out vec3 fPosition;
+layout(location=4) out vec2 fLightmapCoords;
+layout(location=5) flat out int fMaterial;
 
-uniform mat4 model;
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+//per-draw constants, the object's range of the frame's constant ring
+layout(std140) uniform DrawConstants {
+	mat4 model;
+	mat3 normalMatrix;
+};
 uniform mat4 view;
 uniform mat4 projection;
-uniform	mat3 normalMatrix;
-uniform mat4 lightSpaceTrMatrix;
 
 void main() 
 {
@@ -22,7 +34,8 @@ void main()
 	fPosEye = view * model * vec4(vPosition, 1.0f);
 	fNormal = normalize(normalMatrix * vNormal);
 	fTexCoords = vTexCoords;
+	fLightmapCoords = vLightmapCoords;
+	fMaterial = vMaterial;
 	fPosition = vec3(model * vec4(vPosition, 1.0f));
-	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
 	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
 }